@@ -8,7 +8,8 @@ int main()
         throw std::runtime_error("Failed to load the image!");
 
     // Size of the image in bytes
-    // same as width() * height() * channels()
+    // same as pitch() * height(), which is width() * height() * channels()
+    // unless LoadOptions::row_alignment was set
     size_t size = image.size();
 
     // Get the pixel at 0, 0.
@@ -30,6 +31,13 @@ int main()
     auto height = image.height();
 
     // Retrieve pointer to image data.
-    // Total size is width * height * format.
+    // Total size is pitch * height.
     image.data();
+
+    // Pixels of a row, rows are pitch() bytes apart.
+    for (auto* pixel : image.row(1))
+        pixel[0] = 0;
+
+    // A rectangle of the image, without copying it.
+    auto sprite = image.view(0, 0, 16, 16);
 }
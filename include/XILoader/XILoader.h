@@ -3,8 +3,12 @@
 #include "utils.h"
 #include "data_stream.h"
 #include "image.h"
+#include "shared_image.h"
+#include "convert.h"
+#include "block_compression.h"
 #include "bmp.h"
 #include "png.h"
+#include "batch_reader.h"
 
 namespace XIL {
 
@@ -24,9 +28,17 @@ namespace XIL {
         Loader(Loader&&) = delete;
 
         static Image load(const std::string& path, bool flip = false)
+        {
+            LoadOptions options;
+            options.flip = flip;
+
+            return load(path, options);
+        }
+
+        static Image load(const std::string& path, const LoadOptions& options)
         {
             try {
-                return load_verbose(path, flip);
+                return load_verbose(path, options);
             }
             catch (const std::exception&) // suppress any exceptions
             {
@@ -35,9 +47,17 @@ namespace XIL {
         }
 
         static Image load_raw(void* data, size_t size, bool flip = false)
+        {
+            LoadOptions options;
+            options.flip = flip;
+
+            return load_raw(data, size, options);
+        }
+
+        static Image load_raw(void* data, size_t size, const LoadOptions& options)
         {
             try {
-                return load_raw_verbose(data, size, flip);
+                return load_raw_verbose(data, size, options);
             }
             catch (const std::exception&) // suppress any exceptions
             {
@@ -47,36 +67,152 @@ namespace XIL {
 
         // Any exceptions encountered during the process of loading are rethrown to the caller
         static Image load_verbose(const std::string& path, bool flip = false)
+        {
+            LoadOptions options;
+            options.flip = flip;
+
+            return load_verbose(path, options);
+        }
+
+        // Any exceptions encountered during the process of loading are rethrown to the caller
+        static Image load_verbose(const std::string& path, const LoadOptions& options)
         {
             Image image;
+            MappedFile mapping;
             DataStream file_stream;
 
-            read_file(path, file_stream);
-            load_image(file_stream, image, flip);
+            open_file(path, file_stream, mapping, options.memory_map, options.memory_map_min_size);
+            load_image(file_stream, image, options);
 
             return image;
         }
 
+        // Loads an image from a pull based source, PNGs are decoded as the data arrives,
+        // other formats are read into memory first
+        static Image load(StreamReader& reader, const LoadOptions& options = {})
+        {
+            try {
+                return load_verbose(reader, options);
+            }
+            catch (const std::exception&) // suppress any exceptions
+            {
+                return {};
+            }
+        }
+
+        // Any exceptions encountered during the process of loading are rethrown to the caller
+        static Image load_verbose(StreamReader& reader, const LoadOptions& options = {})
+        {
+            Image image;
+            uint8_t magic[4]{};
+
+            reader.peek(magic, sizeof(magic));
+
+            if (deduce_file_format(magic) == FileFormat::PNG)
+            {
+                PNG::load(reader, image, options);
+            }
+            else
+            {
+                DataStream file_stream = reader.get_rest();
+                load_image(file_stream, image, options);
+            }
+
+            return image;
+        }
+
+        // Reads all the files through io_uring where available (a thread pool otherwise) and decodes
+        // each one on the calling thread as soon as its read completes. The images are in the order
+        // of 'paths', the ones that couldn't be loaded are empty.
+        static std::vector<Image> load_batch(const std::vector<std::string>& paths, const LoadOptions& options = {},
+                                             BatchBackend backend = BatchBackend::AUTO)
+        {
+            std::vector<Image> images(paths.size());
+
+            BatchReader::read(paths,
+                [&](size_t index, DataStream& file)
+                {
+                    try {
+                        load_image(file, images[index], options);
+                    }
+                    catch (const std::exception&) // suppress any exceptions
+                    {
+                        images[index] = {};
+                    }
+                }, backend);
+
+            return images;
+        }
+
         // Any exceptions encountered during the process of loading are rethrown to the caller
         static Image load_raw_verbose(void* data, size_t size, bool flip = false)
+        {
+            LoadOptions options;
+            options.flip = flip;
+
+            return load_raw_verbose(data, size, options);
+        }
+
+        // Any exceptions encountered during the process of loading are rethrown to the caller
+        static Image load_raw_verbose(void* data, size_t size, const LoadOptions& options)
         {
             Image image;
             DataStream data_stream(data, size);
 
-            load_image(data_stream, image, flip);
+            load_image(data_stream, image, options);
 
             return image;
         }
+
+        // References the pixels of 'data' without copying or converting them,
+        // currently only uncompressed 32 bit top to bottom BMPs (BGRA order) can be viewed.
+        // 'data' has to outlive the returned image.
+        static BorrowedImage view_raw(const void* data, size_t size)
+        {
+            try {
+                return view_raw_verbose(data, size);
+            }
+            catch (const std::exception&) // suppress any exceptions
+            {
+                return {};
+            }
+        }
+
+        // Any exceptions encountered during the process of viewing are rethrown to the caller
+        static BorrowedImage view_raw_verbose(const void* data, size_t size)
+        {
+            BorrowedImage image;
+            DataStream data_stream(const_cast<void*>(data), size);
+
+            if (deduce_file_format(data_stream) != FileFormat::BMP)
+                throw std::runtime_error("Only BMPs can be viewed");
+
+            BMP::view(data_stream, image);
+
+            return image;
+        }
+
+        // Same as view_raw, 'file' has to stay mapped for as long as the returned image is used
+        static BorrowedImage view(const MappedFile& file)
+        {
+            return view_raw(file.data(), file.size());
+        }
+
+        // Any exceptions encountered during the process of viewing are rethrown to the caller
+        static BorrowedImage view_verbose(const MappedFile& file)
+        {
+            return view_raw_verbose(file.data(), file.size());
+        }
     private:
-        static void load_image(DataStream& file, Image& image, bool flip)
+        static void load_image(DataStream& file, Image& image, const LoadOptions& options)
         {
             switch (deduce_file_format(file))
             {
             case FileFormat::BMP:
-                BMP::load(file, image, flip);
+                BMP::load(file, image, options);
                 break;
             case FileFormat::PNG:
-                PNG::load(file, image, flip);
+                PNG::load(file, image, options);
                 break;
             case FileFormat::JPEG:
                 throw std::runtime_error("JPEG loading is not yet implemented");
@@ -88,8 +224,17 @@ namespace XIL {
         static FileFormat deduce_file_format(DataStream& file)
         {
             uint8_t magic[4];
+
+            if (!file.has_atleast(sizeof(magic)))
+                return FileFormat::UNKNOWN;
+
             file.peek_n(4, magic);
 
+            return deduce_file_format(magic);
+        }
+
+        static FileFormat deduce_file_format(const uint8_t (&magic)[4])
+        {
             if (magic[0] == 'B' &&
                 magic[1] == 'M')
                 return FileFormat::BMP;
@@ -112,3 +257,8 @@ namespace XIL {
 
 using XILoader = XIL::Loader;
 using XImage   = XIL::Image;
+
+// builds on top of Loader
+#include "sequence_loader.h"
+#include "parallel_loader.h"
+#include "image_cache.h"
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <condition_variable>
+
+#include "utils.h"
+#include "data_stream.h"
+#include "thread_pool.h"
+
+#ifdef XIL_IO_URING
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+#endif
+
+namespace XIL {
+
+    enum class BatchBackend
+    {
+        AUTO        = 0,
+        IO_URING    = 1,
+        THREAD_POOL = 2
+    };
+
+    // Reads many files at once and hands each one over on the calling thread as soon as its read
+    // completes, so the caller can decode it while the rest are still being read.
+    // Files that couldn't be read are handed over as empty streams.
+    class BatchReader
+    {
+    public:
+        using Callback = std::function<void(size_t index, DataStream& file)>;
+
+        // files being read at the same time, bounds the memory held by pending reads
+        static constexpr size_t max_in_flight = 64;
+
+        BatchReader() = delete;
+
+        // Uses io_uring where available, otherwise or if 'backend' asks for it a pool of threads
+        // doing blocking reads. Returns the backend that was used.
+        static BatchBackend read(const std::vector<std::string>& paths, const Callback& on_read,
+                                 BatchBackend backend = BatchBackend::AUTO)
+        {
+        #ifdef XIL_IO_URING
+            if (backend != BatchBackend::THREAD_POOL)
+            {
+                IoUring ring;
+
+                if (ring.init(max_in_flight, { IORING_OP_OPENAT, IORING_OP_READ }))
+                {
+                    read_io_uring(ring, paths, on_read);
+                    return BatchBackend::IO_URING;
+                }
+            }
+        #else
+            XIL_UNUSED(backend);
+        #endif
+
+            read_thread_pool(paths, on_read);
+            return BatchBackend::THREAD_POOL;
+        }
+
+    #ifdef XIL_IO_URING
+        // Minimal io_uring wrapper on top of the raw syscalls, so liburing isn't required
+        class IoUring
+        {
+        private:
+            int m_Fd = -1;
+
+            void*  m_SqRing = nullptr;
+            size_t m_SqRingSize = 0;
+            void*  m_CqRing = nullptr;
+            size_t m_CqRingSize = 0;
+            io_uring_sqe* m_Sqes = nullptr;
+            size_t m_SqesSize = 0;
+
+            unsigned* m_SqHead = nullptr;
+            unsigned* m_SqTail = nullptr;
+            unsigned* m_SqArray = nullptr;
+            unsigned  m_SqMask = 0;
+            unsigned  m_SqEntries = 0;
+
+            unsigned* m_CqHead = nullptr;
+            unsigned* m_CqTail = nullptr;
+            io_uring_cqe* m_Cqes = nullptr;
+            unsigned  m_CqMask = 0;
+
+            unsigned m_ToSubmit = 0;
+        public:
+            IoUring() = default;
+            IoUring(const IoUring&) = delete;
+            IoUring& operator=(const IoUring&) = delete;
+
+            // Fails if the kernel doesn't support io_uring, it's disabled or it can't run all of 'opcodes'.
+            // io_uring_setup works from 5.1 but most opcodes came later, probing them needs 5.6.
+            bool init(unsigned entries, std::initializer_list<uint8_t> opcodes) noexcept
+            {
+                io_uring_params params{};
+
+                m_Fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+                if (m_Fd < 0 || !supports(opcodes))
+                    return false;
+
+                m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+                bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+                if (single_mmap)
+                    m_SqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+
+                m_SqRing = map(m_SqRingSize, IORING_OFF_SQ_RING);
+                if (!m_SqRing)
+                    return false;
+
+                if (single_mmap)
+                    m_CqRing = m_SqRing;
+                else if (!(m_CqRing = map(m_CqRingSize, IORING_OFF_CQ_RING)))
+                    return false;
+
+                m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                m_Sqes = static_cast<io_uring_sqe*>(map(m_SqesSize, IORING_OFF_SQES));
+                if (!m_Sqes)
+                    return false;
+
+                auto* sq = static_cast<uint8_t*>(m_SqRing);
+                m_SqHead    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                m_SqTail    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                m_SqArray   = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                m_SqMask    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                m_SqEntries = params.sq_entries;
+
+                auto* cq = static_cast<uint8_t*>(m_CqRing);
+                m_CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                m_CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                m_Cqes   = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+                m_CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+
+                return true;
+            }
+
+            // Queues 'sqe' until the next submit(), returns false if the submission queue is full
+            bool push(const io_uring_sqe& sqe) noexcept
+            {
+                unsigned tail = *m_SqTail;
+
+                if (tail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE) >= m_SqEntries)
+                    return false;
+
+                unsigned slot = tail & m_SqMask;
+                m_Sqes[slot] = sqe;
+                m_SqArray[slot] = slot;
+
+                __atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+                m_ToSubmit++;
+
+                return true;
+            }
+
+            // Submits the queued entries and waits for at least 'wait_for' completions
+            void submit(unsigned wait_for)
+            {
+                for (;;)
+                {
+                    long submitted = syscall(__NR_io_uring_enter, m_Fd, m_ToSubmit, wait_for,
+                                             wait_for ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+                    if (submitted >= 0)
+                    {
+                        m_ToSubmit -= static_cast<unsigned>(submitted);
+                        return;
+                    }
+
+                    if (errno != EINTR)
+                        throw std::runtime_error("io_uring_enter failed");
+                }
+            }
+
+            bool pop(io_uring_cqe& into) noexcept
+            {
+                unsigned head = *m_CqHead;
+
+                if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+                    return false;
+
+                into = m_Cqes[head & m_CqMask];
+                __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+
+                return true;
+            }
+
+            ~IoUring()
+            {
+                if (m_Sqes)
+                    munmap(m_Sqes, m_SqesSize);
+
+                if (m_CqRing && m_CqRing != m_SqRing)
+                    munmap(m_CqRing, m_CqRingSize);
+
+                if (m_SqRing)
+                    munmap(m_SqRing, m_SqRingSize);
+
+                if (m_Fd >= 0)
+                    close(m_Fd);
+            }
+
+        private:
+            bool supports(std::initializer_list<uint8_t> opcodes) noexcept
+            {
+                const unsigned max_ops = 256;
+                alignas(io_uring_probe) uint8_t buffer[sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op)] = {};
+                auto* probe = reinterpret_cast<io_uring_probe*>(buffer);
+
+                if (syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_PROBE, probe, max_ops) < 0)
+                    return false;
+
+                for (uint8_t opcode : opcodes)
+                    if (opcode >= probe->ops_len || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+                        return false;
+
+                return true;
+            }
+
+            void* map(size_t size, off_t offset) noexcept
+            {
+                void* at = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, offset);
+
+                return at == MAP_FAILED ? nullptr : at;
+            }
+        };
+    #endif
+
+    private:
+        static void read_thread_pool(const std::vector<std::string>& paths, const Callback& on_read)
+        {
+            struct completed_read
+            {
+                size_t index;
+                DataStream file;
+            };
+
+            std::mutex mutex;
+            std::condition_variable read_done;
+            std::deque<completed_read> completed;
+
+            size_t next = 0;
+            size_t in_flight = 0;
+
+            // blocking reads don't need a core each, use a few more threads than there are cores
+            size_t threads = std::min(std::max<size_t>(ThreadPool::default_thread_count(), 4), max_in_flight);
+
+            // declared last so that it finishes the queued reads before the state above goes away
+            ThreadPool pool(std::min(threads, std::max<size_t>(paths.size(), 1)));
+
+            while (next < paths.size() || in_flight)
+            {
+                for (; next < paths.size() && in_flight < max_in_flight; next++, in_flight++)
+                {
+                    pool.submit(
+                        [&, next]()
+                        {
+                            DataStream file;
+
+                            try {
+                                pread_file(paths[next], file);
+                            }
+                            catch (const std::exception&) // handed over as an empty stream
+                            {
+                            }
+
+                            std::lock_guard<std::mutex> lock(mutex);
+                            completed.push_back({ next, std::move(file) });
+                            read_done.notify_one();
+                        });
+                }
+
+                completed_read read;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    read_done.wait(lock, [&]() { return !completed.empty(); });
+
+                    read = std::move(completed.front());
+                    completed.pop_front();
+                }
+
+                in_flight--;
+                on_read(read.index, read.file);
+            }
+        }
+
+    #ifdef XIL_IO_URING
+        // Every file goes through an asynchronous openat followed by as many reads as it takes,
+        // only the fstat in between is synchronous
+        static void read_io_uring(IoUring& ring, const std::vector<std::string>& paths, const Callback& on_read)
+        {
+            struct pending_read
+            {
+                size_t index;
+                int fd;
+                uint8_t* data;
+                size_t size;
+                size_t done;
+            };
+
+            std::vector<pending_read> slots(std::min(max_in_flight, paths.size()));
+            std::vector<size_t> free_slots;
+            std::vector<size_t> ready_slots;
+
+            for (size_t i = slots.size(); i-- > 0;)
+            {
+                slots[i] = { 0, -1, nullptr, 0, 0 };
+                free_slots.push_back(i);
+            }
+
+            size_t next = 0;
+            size_t kernel_ops = 0;
+
+            auto queue = [&](io_uring_sqe& sqe, size_t slot)
+            {
+                sqe.user_data = slot;
+
+                // never full, every slot has at most one operation in flight
+                bool queued = ring.push(sqe);
+                assert(queued);
+                XIL_UNUSED(queued);
+
+                kernel_ops++;
+            };
+
+            auto queue_read = [&](size_t slot)
+            {
+                auto& file = slots[slot];
+                io_uring_sqe sqe{};
+
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd     = file.fd;
+                sqe.addr   = reinterpret_cast<uintptr_t>(file.data + file.done);
+                sqe.len    = static_cast<uint32_t>(std::min<size_t>(file.size - file.done, 1u << 30));
+                sqe.off    = file.done;
+
+                queue(sqe, slot);
+            };
+
+            // done with the slot, handed over as an empty stream if the read failed
+            auto finish = [&](size_t slot, bool failed)
+            {
+                auto& file = slots[slot];
+
+                if (file.fd >= 0)
+                    close(file.fd);
+
+                file.fd = -1;
+
+                if (failed)
+                {
+                    delete[] file.data;
+                    file.data = nullptr;
+                    file.size = 0;
+                }
+
+                ready_slots.push_back(slot);
+            };
+
+            auto opened = [&](size_t slot, int result)
+            {
+                auto& file = slots[slot];
+
+                if (result < 0)
+                    return finish(slot, true);
+
+                file.fd = result;
+
+                struct stat info;
+                if (fstat(file.fd, &info) || !S_ISREG(info.st_mode) || static_cast<uint64_t>(info.st_size) > SIZE_MAX)
+                    return finish(slot, true);
+
+                file.size = static_cast<size_t>(info.st_size);
+                file.data = new (std::nothrow) uint8_t[file.size];
+
+                if (!file.data)
+                    return finish(slot, true);
+
+                if (!file.size)
+                    return finish(slot, false);
+
+                queue_read(slot);
+            };
+
+            auto read_some = [&](size_t slot, int result)
+            {
+                auto& file = slots[slot];
+
+                if (result == -EINTR || result == -EAGAIN)
+                    return queue_read(slot);
+
+                // 0 means the file got shorter since fstat
+                if (result <= 0)
+                    return finish(slot, true);
+
+                file.done += static_cast<size_t>(result);
+
+                if (file.done < file.size)
+                    queue_read(slot);
+                else
+                    finish(slot, false);
+            };
+
+            auto drain = [&]()
+            {
+                io_uring_cqe cqe;
+
+                while (ring.pop(cqe))
+                {
+                    kernel_ops--;
+
+                    size_t slot = static_cast<size_t>(cqe.user_data);
+
+                    if (slots[slot].fd < 0)
+                        opened(slot, cqe.res);
+                    else
+                        read_some(slot, cqe.res);
+                }
+            };
+
+            try {
+                while (next < paths.size() || kernel_ops || !ready_slots.empty())
+                {
+                    for (; next < paths.size() && !free_slots.empty(); next++)
+                    {
+                        size_t slot = free_slots.back();
+                        free_slots.pop_back();
+
+                        slots[slot] = { next, -1, nullptr, 0, 0 };
+
+                        io_uring_sqe sqe{};
+                        sqe.opcode     = IORING_OP_OPENAT;
+                        sqe.fd         = AT_FDCWD;
+                        sqe.addr       = reinterpret_cast<uintptr_t>(paths[next].c_str());
+                        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+
+                        queue(sqe, slot);
+                    }
+
+                    ring.submit(kernel_ops ? 1 : 0);
+                    drain();
+
+                    // the follow up reads run while the ready files are being decoded
+                    ring.submit(0);
+
+                    for (size_t slot : ready_slots)
+                    {
+                        auto& file = slots[slot];
+                        DataStream stream(file.data, file.size, true);
+
+                        file.data = nullptr;
+                        free_slots.push_back(slot);
+
+                        on_read(file.index, stream);
+                    }
+
+                    ready_slots.clear();
+                }
+            }
+            catch (...)
+            {
+                // the kernel may still be writing into the buffers, wait for
+                // everything in flight without queueing anything new
+                try {
+                    io_uring_cqe cqe;
+
+                    while (kernel_ops)
+                    {
+                        ring.submit(1);
+
+                        while (ring.pop(cqe))
+                        {
+                            kernel_ops--;
+
+                            auto& file = slots[static_cast<size_t>(cqe.user_data)];
+                            if (file.fd < 0 && cqe.res >= 0)
+                                file.fd = cqe.res;
+                        }
+                    }
+                }
+                catch (...)
+                {
+                }
+
+                for (auto& file : slots)
+                {
+                    if (file.fd >= 0)
+                        close(file.fd);
+
+                    delete[] file.data;
+                }
+
+                throw;
+            }
+        }
+    #endif
+    };
+}
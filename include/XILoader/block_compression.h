@@ -0,0 +1,1077 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "utils.h"
+#include "image_view.h"
+#include "thread_pool.h"
+#include "buffer_pool.h"
+#include "memory_resource.h"
+
+namespace XIL {
+
+    // GPU block compressed formats, every 4x4 block of pixels is encoded into a fixed number of bytes
+    enum class BlockFormat
+    {
+        BC1 = 1, // RGB, 8 bytes per block
+        BC3 = 3, // RGBA, 16 bytes per block
+        BC4 = 4, // one channel, 8 bytes per block
+        BC5 = 5  // two channels, 16 bytes per block
+    };
+
+    enum class BlockQuality
+    {
+        FAST   = 0, // bounding box endpoints, no refinement
+        NORMAL = 1, // principal axis endpoints refined once
+        HIGH   = 2  // the best of several candidates refined until they stop improving
+    };
+
+    struct BlockOptions
+    {
+        BlockFormat format = BlockFormat::BC1;
+        BlockQuality quality = BlockQuality::NORMAL;
+
+        // compresses bands of block rows alongside the calling thread when set
+        ThreadPool* thread_pool = nullptr;
+    };
+
+    // Blocks of a compressed image, row by row, ready to be uploaded
+    class CompressedImage
+    {
+    public:
+        friend class BlockCompressor;
+    private:
+        PixelContainer m_Data;
+        size_t m_Width;
+        size_t m_Height;
+        BlockFormat m_Format;
+    public:
+        CompressedImage() noexcept
+            : m_Width(0),
+            m_Height(0),
+            m_Format(BlockFormat::BC1)
+        {
+        }
+
+        static size_t block_size(BlockFormat format) noexcept
+        {
+            return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+        }
+
+        size_t block_size() const noexcept
+        {
+            return block_size(m_Format);
+        }
+
+        BlockFormat format() const noexcept
+        {
+            return m_Format;
+        }
+
+        // in pixels
+        size_t width() const noexcept
+        {
+            return m_Width;
+        }
+
+        size_t height() const noexcept
+        {
+            return m_Height;
+        }
+
+        size_t blocks_x() const noexcept
+        {
+            return (m_Width + 3) / 4;
+        }
+
+        size_t blocks_y() const noexcept
+        {
+            return (m_Height + 3) / 4;
+        }
+
+        // bytes per row of blocks
+        size_t pitch() const noexcept
+        {
+            return blocks_x() * block_size();
+        }
+
+        const uint8_t* data() const noexcept
+        {
+            return m_Data.data();
+        }
+
+        size_t size() const noexcept
+        {
+            return m_Data.size();
+        }
+
+        bool ok() const noexcept
+        {
+            return !m_Data.empty();
+        }
+
+        operator bool() const noexcept
+        {
+            return ok();
+        }
+    };
+
+    // BC1/BC3/BC4/BC5 encoder and decoder.
+    // BC1 and BC3 encode RGB (gray is replicated), BC1 without alpha and BC3 with it (255 if there's none).
+    // BC4 encodes the first channel, BC5 the first two: red and green, gray and alpha or gray twice.
+    class BlockCompressor
+    {
+    private:
+        struct ColorBlock
+        {
+            uint16_t color0;
+            uint16_t color1;
+            uint32_t indices;
+            uint32_t error;
+        };
+
+        struct ValueBlock
+        {
+            uint8_t  value0;
+            uint8_t  value1;
+            uint8_t  indices[16];
+            uint32_t error;
+        };
+    public:
+        // block rows per band, see ThreadPool::parallel_rows
+        static constexpr size_t min_rows_per_thread = 8;
+
+        BlockCompressor() = delete;
+
+        static CompressedImage compress(ConstImageView src, const BlockOptions& options = {},
+                                        BufferPool* pool = nullptr, PixelResource* resource = nullptr)
+        {
+            if (src.empty())
+                throw std::runtime_error("Can't compress an empty image");
+
+            CompressedImage image;
+            image.m_Width = src.width();
+            image.m_Height = src.height();
+            image.m_Format = options.format;
+
+            size_t size = checked_mul(checked_mul(image.blocks_x(), image.blocks_y()), image.block_size());
+            image.m_Data = BufferPool::acquire(pool, size, resource);
+            resize_uninitialized(image.m_Data, size);
+
+            uint8_t* out = image.m_Data.data();
+            size_t pitch = image.pitch();
+
+            ThreadPool::parallel_rows(options.thread_pool, image.blocks_y(), min_rows_per_thread,
+                [&](size_t first, size_t last)
+                {
+                    compress_rows(src, options.format, options.quality, first, last - first, out + first * pitch);
+                });
+
+            return image;
+        }
+
+        // Compresses 'count' rows of blocks starting at block row 'first' into 'out', blocks sticking out
+        // of the image repeat its last row and column
+        static void compress_rows(ConstImageView src, BlockFormat format, BlockQuality quality,
+                                  size_t first, size_t count, uint8_t* out) noexcept
+        {
+            size_t blocks_x = (src.width() + 3) / 4;
+            size_t block_size = CompressedImage::block_size(format);
+
+            // the second BC5 channel
+            size_t second = src.channels() == 2 ? 3 : (src.channels() == 1 ? 0 : 1);
+
+            alignas(16) uint8_t rgba[64];
+            alignas(16) uint8_t values[16];
+
+            for (size_t by = first; by < first + count; by++)
+            {
+                for (size_t bx = 0; bx < blocks_x; bx++, out += block_size)
+                {
+                    load_block(src, bx, by, rgba);
+
+                    switch (format)
+                    {
+                    case BlockFormat::BC1:
+                        encode_color_block(rgba, quality, out);
+                        break;
+                    case BlockFormat::BC3:
+                        extract_channel(rgba, 3, values);
+                        encode_value_block(values, quality, out);
+                        encode_color_block(rgba, quality, out + 8);
+                        break;
+                    case BlockFormat::BC4:
+                        extract_channel(rgba, 0, values);
+                        encode_value_block(values, quality, out);
+                        break;
+                    case BlockFormat::BC5:
+                        extract_channel(rgba, 0, values);
+                        encode_value_block(values, quality, out);
+                        extract_channel(rgba, second, values);
+                        encode_value_block(values, quality, out + 8);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // channels of the images decompress() writes
+        static uint8_t decompressed_channels(BlockFormat format) noexcept
+        {
+            switch (format)
+            {
+            case BlockFormat::BC4: return 1;
+            case BlockFormat::BC5: return 2;
+            default:               return 4;
+            }
+        }
+
+        // Decodes every block into 'dst', which has to be as large as the image and have decompressed_channels()
+        static void decompress(const CompressedImage& image, ImageView dst)
+        {
+            if (dst.width() != image.width() || dst.height() != image.height() ||
+                dst.channels() != decompressed_channels(image.format()))
+                throw std::runtime_error("The destination doesn't match the compressed image");
+
+            const uint8_t* in = image.data();
+            uint8_t channels = dst.channels();
+
+            alignas(16) uint8_t rgba[64];
+            alignas(16) uint8_t values[2][16];
+
+            for (size_t by = 0; by < image.blocks_y(); by++)
+            {
+                for (size_t bx = 0; bx < image.blocks_x(); bx++, in += image.block_size())
+                {
+                    switch (image.format())
+                    {
+                    case BlockFormat::BC1:
+                        decode_color_block(in, rgba, false);
+                        break;
+                    case BlockFormat::BC3:
+                        decode_color_block(in + 8, rgba, true);
+                        decode_value_block(in, values[0]);
+
+                        for (size_t i = 0; i < 16; i++)
+                            rgba[i * 4 + 3] = values[0][i];
+                        break;
+                    case BlockFormat::BC4:
+                        decode_value_block(in, values[0]);
+                        break;
+                    case BlockFormat::BC5:
+                        decode_value_block(in, values[0]);
+                        decode_value_block(in + 8, values[1]);
+                        break;
+                    }
+
+                    size_t width = std::min<size_t>(4, image.width() - bx * 4);
+                    size_t height = std::min<size_t>(4, image.height() - by * 4);
+
+                    for (size_t y = 0; y < height; y++)
+                    {
+                        uint8_t* to = dst.pixel_unchecked(bx * 4, by * 4 + y);
+
+                        for (size_t x = 0; x < width; x++, to += channels)
+                        {
+                            size_t i = y * 4 + x;
+
+                            if (channels == 4)
+                                memcpy(to, rgba + i * 4, 4);
+                            else
+                                for (size_t c = 0; c < channels; c++)
+                                    to[c] = values[c][i];
+                        }
+                    }
+                }
+            }
+        }
+
+        // Encodes the RGB of 16 RGBA pixels into an 8 byte color block, always in the 4 color mode
+        static void encode_color_block(const uint8_t* rgba, BlockQuality quality, uint8_t* out) noexcept
+        {
+            uint8_t low[4], high[4];
+            color_bounds(rgba, low, high);
+
+            ColorBlock block;
+
+            if (low[0] == high[0] && low[1] == high[1] && low[2] == high[2])
+            {
+                block = solid_color(low);
+            }
+            else if (quality == BlockQuality::FAST)
+            {
+                int a[3], b[3];
+                box_endpoints(rgba, low, high, a, b);
+                block = fit_colors(rgba, a, b);
+            }
+            else
+            {
+                int a[3], b[3];
+                principal_endpoints(rgba, low, high, a, b);
+                block = fit_colors(rgba, a, b);
+
+                if (quality == BlockQuality::HIGH)
+                {
+                    box_endpoints(rgba, low, high, a, b);
+                    ColorBlock box = fit_colors(rgba, a, b);
+
+                    if (box.error < block.error)
+                        block = box;
+                }
+
+                // least squares endpoints for the chosen indices, again with the new indices until it stops improving
+                size_t iterations = quality == BlockQuality::HIGH ? 4 : 1;
+
+                for (size_t i = 0; i < iterations && block.error; i++)
+                {
+                    if (!refine_colors(rgba, block, a, b))
+                        break;
+
+                    ColorBlock refined = fit_colors(rgba, a, b);
+
+                    if (refined.error >= block.error)
+                        break;
+
+                    block = refined;
+                }
+            }
+
+            write_u16(out, block.color0);
+            write_u16(out + 2, block.color1);
+            write_u32(out + 4, block.indices);
+        }
+
+        // Encodes 16 values into an 8 byte BC4 block
+        static void encode_value_block(const uint8_t* values, BlockQuality quality, uint8_t* out) noexcept
+        {
+            uint8_t low, high;
+            value_bounds(values, low, high);
+
+            ValueBlock block = fit_values(values, high, low);
+
+            if (quality != BlockQuality::FAST && low != high)
+            {
+                // the 6 value mode has exact 0 and 255, the rest of the values get the in between ones
+                uint8_t inner_low = 255, inner_high = 0;
+
+                for (size_t i = 0; i < 16; i++)
+                {
+                    if (values[i] != 0 && values[i] != 255)
+                    {
+                        inner_low = std::min(inner_low, values[i]);
+                        inner_high = std::max(inner_high, values[i]);
+                    }
+                }
+
+                if ((low == 0 || high == 255) && inner_low <= inner_high)
+                {
+                    ValueBlock extremes = fit_values(values, inner_low, inner_high);
+
+                    if (extremes.error < block.error)
+                        block = extremes;
+                }
+            }
+
+            if (quality == BlockQuality::HIGH && block.value0 > block.value1)
+            {
+                for (size_t i = 0; i < 4 && block.error; i++)
+                {
+                    int a[1], b[1];
+
+                    if (!refine_values(values, block, a, b))
+                        break;
+
+                    // a == b would switch to the 6 value mode
+                    if (a[0] <= b[0])
+                        break;
+
+                    ValueBlock refined = fit_values(values, static_cast<uint8_t>(a[0]), static_cast<uint8_t>(b[0]));
+
+                    if (refined.error >= block.error)
+                        break;
+
+                    block = refined;
+                }
+            }
+
+            out[0] = block.value0;
+            out[1] = block.value1;
+
+            uint64_t bits = 0;
+
+            for (size_t i = 0; i < 16; i++)
+                bits |= static_cast<uint64_t>(block.indices[i]) << (3 * i);
+
+            for (size_t i = 0; i < 6; i++)
+                out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+
+        // 'four_colors' decodes as BC3 does, which ignores the order of the endpoints
+        static void decode_color_block(const uint8_t* in, uint8_t* rgba, bool four_colors) noexcept
+        {
+            uint16_t color0 = static_cast<uint16_t>(in[0] | in[1] << 8);
+            uint16_t color1 = static_cast<uint16_t>(in[2] | in[3] << 8);
+
+            uint8_t palette[4][4];
+            color_palette(color0, color1, four_colors || color0 > color1, palette);
+
+            for (size_t i = 0; i < 16; i++)
+                memcpy(rgba + i * 4, palette[(in[4 + i / 4] >> (2 * (i % 4))) & 3], 4);
+        }
+
+        static void decode_value_block(const uint8_t* in, uint8_t* values) noexcept
+        {
+            uint8_t palette[8];
+            value_palette(in[0], in[1], palette);
+
+            uint64_t bits = 0;
+
+            for (size_t i = 0; i < 6; i++)
+                bits |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+
+            for (size_t i = 0; i < 16; i++)
+                values[i] = palette[(bits >> (3 * i)) & 7];
+        }
+
+    private:
+        static void load_block(ConstImageView src, size_t bx, size_t by, uint8_t* rgba) noexcept
+        {
+            size_t x0 = bx * 4;
+            uint8_t channels = src.channels();
+
+            for (size_t y = 0; y < 4; y++)
+            {
+                const uint8_t* row = src.row_unchecked(std::min(by * 4 + y, src.height() - 1)).data();
+                uint8_t* to = rgba + y * 16;
+
+                if (channels == 4 && x0 + 4 <= src.width())
+                {
+                    memcpy(to, row + x0 * 4, 16);
+                    continue;
+                }
+
+                for (size_t x = 0; x < 4; x++, to += 4)
+                {
+                    const uint8_t* px = row + std::min(x0 + x, src.width() - 1) * channels;
+
+                    switch (channels)
+                    {
+                    case 1: to[0] = to[1] = to[2] = px[0]; to[3] = 255;   break;
+                    case 2: to[0] = to[1] = to[2] = px[0]; to[3] = px[1]; break;
+                    case 3: memcpy(to, px, 3); to[3] = 255;               break;
+                    default: memcpy(to, px, 4);                           break;
+                    }
+                }
+            }
+        }
+
+        static void extract_channel(const uint8_t* rgba, size_t channel, uint8_t* values) noexcept
+        {
+            for (size_t i = 0; i < 16; i++)
+                values[i] = rgba[i * 4 + channel];
+        }
+
+        static void write_u16(uint8_t* out, uint16_t value) noexcept
+        {
+            out[0] = static_cast<uint8_t>(value);
+            out[1] = static_cast<uint8_t>(value >> 8);
+        }
+
+        static void write_u32(uint8_t* out, uint32_t value) noexcept
+        {
+            for (size_t i = 0; i < 4; i++)
+                out[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+
+        static int clamp_255(float value) noexcept
+        {
+            return static_cast<int>(std::min(std::max(value + 0.5f, 0.0f), 255.0f));
+        }
+
+        // Color endpoints
+
+        static uint16_t pack_565(const int* rgb) noexcept
+        {
+            return static_cast<uint16_t>(((rgb[0] * 31 + 127) / 255) << 11 |
+                                         ((rgb[1] * 63 + 127) / 255) << 5 |
+                                         ((rgb[2] * 31 + 127) / 255));
+        }
+
+        static void unpack_565(uint16_t color, uint8_t* rgb) noexcept
+        {
+            uint32_t r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+
+            rgb[0] = static_cast<uint8_t>(r << 3 | r >> 2);
+            rgb[1] = static_cast<uint8_t>(g << 2 | g >> 4);
+            rgb[2] = static_cast<uint8_t>(b << 3 | b >> 2);
+        }
+
+        static void color_palette(uint16_t color0, uint16_t color1, bool four_colors, uint8_t (&palette)[4][4]) noexcept
+        {
+            unpack_565(color0, palette[0]);
+            unpack_565(color1, palette[1]);
+
+            for (size_t c = 0; c < 3; c++)
+            {
+                uint32_t a = palette[0][c], b = palette[1][c];
+
+                palette[2][c] = static_cast<uint8_t>(four_colors ? (2 * a + b + 1) / 3 : (a + b + 1) / 2);
+                palette[3][c] = static_cast<uint8_t>(four_colors ? (a + 2 * b + 1) / 3 : 0);
+            }
+
+            palette[0][3] = palette[1][3] = palette[2][3] = 255;
+            palette[3][3] = four_colors ? 255 : 0;
+        }
+
+        // per channel minimum and maximum of the block
+        static void color_bounds(const uint8_t* rgba, uint8_t* low, uint8_t* high) noexcept
+        {
+        #ifdef XIL_SSE2
+            const __m128i* rows = reinterpret_cast<const __m128i*>(rgba);
+            __m128i r0 = _mm_loadu_si128(rows), r1 = _mm_loadu_si128(rows + 1);
+            __m128i r2 = _mm_loadu_si128(rows + 2), r3 = _mm_loadu_si128(rows + 3);
+
+            __m128i min = _mm_min_epu8(_mm_min_epu8(r0, r1), _mm_min_epu8(r2, r3));
+            __m128i max = _mm_max_epu8(_mm_max_epu8(r0, r1), _mm_max_epu8(r2, r3));
+
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 8));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 8));
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 4));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+
+            uint32_t lows = static_cast<uint32_t>(_mm_cvtsi128_si32(min));
+            uint32_t highs = static_cast<uint32_t>(_mm_cvtsi128_si32(max));
+
+            memcpy(low, &lows, 4);
+            memcpy(high, &highs, 4);
+        #else
+            for (size_t c = 0; c < 4; c++)
+            {
+                low[c] = 255;
+                high[c] = 0;
+            }
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                for (size_t c = 0; c < 4; c++)
+                {
+                    low[c] = std::min(low[c], rgba[i * 4 + c]);
+                    high[c] = std::max(high[c], rgba[i * 4 + c]);
+                }
+            }
+        #endif
+        }
+
+        // Single colors interpolated from the closest pair of 5 or 6 bit endpoints,
+        // a lot closer than rounding the color to 565
+        struct SolidColorTable
+        {
+            uint8_t pairs5[256][2];
+            uint8_t pairs6[256][2];
+
+            SolidColorTable() noexcept
+            {
+                fill(pairs5, 5);
+                fill(pairs6, 6);
+            }
+
+            static void fill(uint8_t (&pairs)[256][2], uint32_t bits) noexcept
+            {
+                uint32_t levels = 1u << bits;
+
+                for (uint32_t value = 0; value < 256; value++)
+                {
+                    uint32_t best = ~0u;
+
+                    for (uint32_t a = 0; a < levels; a++)
+                    {
+                        for (uint32_t b = 0; b < levels; b++)
+                        {
+                            uint32_t ea = a << (8 - bits) | a >> (2 * bits - 8);
+                            uint32_t eb = b << (8 - bits) | b >> (2 * bits - 8);
+                            uint32_t interpolated = (2 * ea + eb + 1) / 3;
+
+                            // prefer close endpoints, they hold up better on decoders that round differently
+                            uint32_t error = (interpolated > value ? interpolated - value : value - interpolated) * 256 +
+                                             (ea > eb ? ea - eb : eb - ea);
+
+                            if (error < best)
+                            {
+                                best = error;
+                                pairs[value][0] = static_cast<uint8_t>(a);
+                                pairs[value][1] = static_cast<uint8_t>(b);
+                            }
+                        }
+                    }
+                }
+            }
+        };
+
+        static ColorBlock solid_color(const uint8_t* rgb) noexcept
+        {
+            static const SolidColorTable table;
+
+            ColorBlock block;
+            block.color0 = static_cast<uint16_t>(table.pairs5[rgb[0]][0] << 11 | table.pairs6[rgb[1]][0] << 5 | table.pairs5[rgb[2]][0]);
+            block.color1 = static_cast<uint16_t>(table.pairs5[rgb[0]][1] << 11 | table.pairs6[rgb[1]][1] << 5 | table.pairs5[rgb[2]][1]);
+
+            // index 2 is 2/3 of color0, the same pixel is index 3 with the endpoints swapped
+            if (block.color0 < block.color1)
+            {
+                std::swap(block.color0, block.color1);
+                block.indices = 0xffffffff;
+            }
+            else
+            {
+                block.indices = block.color0 == block.color1 ? 0 : 0xaaaaaaaa;
+            }
+
+            block.error = 0; // never compared against
+            return block;
+        }
+
+        // Inset corners of the bounding box, on the diagonal the colors lean towards
+        static void box_endpoints(const uint8_t* rgba, const uint8_t* low, const uint8_t* high, int* a, int* b) noexcept
+        {
+            int center[3];
+
+            for (size_t c = 0; c < 3; c++)
+            {
+                int inset = (high[c] - low[c]) / 16;
+
+                a[c] = high[c] - inset;
+                b[c] = low[c] + inset;
+                center[c] = (high[c] + low[c]) / 2;
+            }
+
+            int red_green = 0, blue_green = 0;
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                const uint8_t* px = rgba + i * 4;
+                int green = px[1] - center[1];
+
+                red_green += (px[0] - center[0]) * green;
+                blue_green += (px[2] - center[2]) * green;
+            }
+
+            if (red_green < 0)
+                std::swap(a[0], b[0]);
+
+            if (blue_green < 0)
+                std::swap(a[2], b[2]);
+        }
+
+        // The colors furthest apart along the principal axis of the block
+        static void principal_endpoints(const uint8_t* rgba, const uint8_t* low, const uint8_t* high, int* a, int* b) noexcept
+        {
+            int sums[3] = {};
+            int products[6] = {}; // rr, rg, rb, gg, gb, bb
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                const uint8_t* px = rgba + i * 4;
+
+                sums[0] += px[0];
+                sums[1] += px[1];
+                sums[2] += px[2];
+
+                products[0] += px[0] * px[0];
+                products[1] += px[0] * px[1];
+                products[2] += px[0] * px[2];
+                products[3] += px[1] * px[1];
+                products[4] += px[1] * px[2];
+                products[5] += px[2] * px[2];
+            }
+
+            float covariance[6];
+            const size_t first[6] = { 0, 0, 0, 1, 1, 2 };
+            const size_t second[6] = { 0, 1, 2, 1, 2, 2 };
+
+            for (size_t i = 0; i < 6; i++)
+                covariance[i] = (products[i] - sums[first[i]] * sums[second[i]] / 16.0f) / 16.0f;
+
+            // power iteration, starting from the extent of the block
+            float axis[3] = { float(high[0] - low[0]), float(high[1] - low[1]), float(high[2] - low[2]) };
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                float next[3] = {
+                    axis[0] * covariance[0] + axis[1] * covariance[1] + axis[2] * covariance[2],
+                    axis[0] * covariance[1] + axis[1] * covariance[3] + axis[2] * covariance[4],
+                    axis[0] * covariance[2] + axis[1] * covariance[4] + axis[2] * covariance[5]
+                };
+
+                float length = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+
+                if (length < 1e-6f)
+                {
+                    box_endpoints(rgba, low, high, a, b);
+                    return;
+                }
+
+                for (size_t c = 0; c < 3; c++)
+                    axis[c] = next[c] * (1.0f / length);
+            }
+
+            int32_t projections[16];
+            project(rgba, axis, projections);
+
+            size_t min_at = 0, max_at = 0;
+
+            for (size_t i = 1; i < 16; i++)
+            {
+                min_at = projections[i] < projections[min_at] ? i : min_at;
+                max_at = projections[i] > projections[max_at] ? i : max_at;
+            }
+
+            for (size_t c = 0; c < 3; c++)
+            {
+                a[c] = rgba[max_at * 4 + c];
+                b[c] = rgba[min_at * 4 + c];
+            }
+        }
+
+        // Dot products of the pixels with 'axis' (at most 1 per component) in 8 bit fixed point
+        static void project(const uint8_t* rgba, const float* axis, int32_t (&projections)[16]) noexcept
+        {
+            int16_t fixed[3];
+
+            for (size_t c = 0; c < 3; c++)
+                fixed[c] = static_cast<int16_t>(std::lround(axis[c] * 256.0f));
+
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+            const __m128i weights = _mm_setr_epi16(fixed[0], fixed[1], fixed[2], 0, fixed[0], fixed[1], fixed[2], 0);
+
+            for (size_t row = 0; row < 4; row++)
+            {
+                __m128i px = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + row * 16)), rgb_mask);
+
+                // (r * x + g * y, b * z) per pixel, summed into a 32 bit lane per pixel
+                __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights));
+                __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights));
+                __m128i dots = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                             _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(projections + row * 4), dots);
+            }
+        #else
+            for (size_t i = 0; i < 16; i++)
+            {
+                const uint8_t* px = rgba + i * 4;
+                projections[i] = px[0] * fixed[0] + px[1] * fixed[1] + px[2] * fixed[2];
+            }
+        #endif
+        }
+
+        // Quantizes the endpoints and picks the closest palette color for every pixel
+        static ColorBlock fit_colors(const uint8_t* rgba, const int* a, const int* b) noexcept
+        {
+            ColorBlock block;
+            block.color0 = pack_565(a);
+            block.color1 = pack_565(b);
+
+            // color0 > color1 selects the 4 color mode
+            if (block.color0 < block.color1)
+                std::swap(block.color0, block.color1);
+
+            uint8_t palette[4][4];
+            color_palette(block.color0, block.color1, true, palette);
+
+            // equal endpoints are the 3 color mode, index 0 is still the color
+            if (block.color0 == block.color1)
+                for (size_t i = 1; i < 4; i++)
+                    memcpy(palette[i], palette[0], 4);
+
+            block.indices = select_colors(rgba, palette, block.error);
+            return block;
+        }
+
+        static uint32_t select_colors(const uint8_t* rgba, const uint8_t (&palette)[4][4], uint32_t& error) noexcept
+        {
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+
+            // every color twice, as 16 bit lanes without alpha
+            __m128i colors[4];
+
+            for (size_t k = 0; k < 4; k++)
+                colors[k] = _mm_setr_epi16(palette[k][0], palette[k][1], palette[k][2], 0,
+                                           palette[k][0], palette[k][1], palette[k][2], 0);
+
+            __m128i errors = zero;
+            uint32_t indices = 0;
+
+            for (size_t row = 0; row < 4; row++)
+            {
+                __m128i px = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + row * 16)), rgb_mask);
+                __m128i lo = _mm_unpacklo_epi8(px, zero);
+                __m128i hi = _mm_unpackhi_epi8(px, zero);
+
+                __m128i best = zero, best_index = zero;
+
+                for (size_t k = 0; k < 4; k++)
+                {
+                    __m128i dlo = _mm_sub_epi16(lo, colors[k]);
+                    __m128i dhi = _mm_sub_epi16(hi, colors[k]);
+
+                    // (r^2 + g^2, b^2) per pixel, summed into a 32 bit lane per pixel
+                    __m128 slo = _mm_castsi128_ps(_mm_madd_epi16(dlo, dlo));
+                    __m128 shi = _mm_castsi128_ps(_mm_madd_epi16(dhi, dhi));
+                    __m128i distance = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                                     _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+                    if (!k)
+                    {
+                        best = distance;
+                        continue;
+                    }
+
+                    __m128i closer = _mm_cmplt_epi32(distance, best);
+
+                    best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+                    best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(static_cast<int>(k))),
+                                              _mm_andnot_si128(closer, best_index));
+                }
+
+                errors = _mm_add_epi32(errors, best);
+
+                // 2 bits per pixel
+                best_index = _mm_or_si128(best_index, _mm_srli_epi64(best_index, 30));
+                best_index = _mm_or_si128(best_index, _mm_slli_epi32(_mm_srli_si128(best_index, 8), 4));
+                indices |= (static_cast<uint32_t>(_mm_cvtsi128_si32(best_index)) & 0xff) << (8 * row);
+            }
+
+            errors = _mm_add_epi32(errors, _mm_srli_si128(errors, 8));
+            errors = _mm_add_epi32(errors, _mm_srli_si128(errors, 4));
+            error = static_cast<uint32_t>(_mm_cvtsi128_si32(errors));
+
+            return indices;
+        #else
+            uint32_t indices = 0;
+            error = 0;
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                const uint8_t* px = rgba + i * 4;
+                uint32_t best = ~0u, best_index = 0;
+
+                for (uint32_t k = 0; k < 4; k++)
+                {
+                    uint32_t distance = 0;
+
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        int d = px[c] - palette[k][c];
+                        distance += d * d;
+                    }
+
+                    if (distance < best)
+                    {
+                        best = distance;
+                        best_index = k;
+                    }
+                }
+
+                error += best;
+                indices |= best_index << (2 * i);
+            }
+
+            return indices;
+        #endif
+        }
+
+        // Endpoints minimizing the squared error of 'count' values given the weight of the
+        // first endpoint in every one of them, in 1 / 'scale'
+        template<size_t Channels>
+        static bool least_squares(const uint8_t* values, size_t stride, const uint8_t* weights, int scale,
+                                  int (&a)[Channels], int (&b)[Channels]) noexcept
+        {
+            // at most 16 * 255 * scale, 32 bits are plenty
+            int32_t aa = 0, bb = 0, ab = 0;
+            int32_t ax[Channels] = {}, bx[Channels] = {};
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                int wa = weights[i], wb = scale - wa;
+
+                aa += wa * wa;
+                bb += wb * wb;
+                ab += wa * wb;
+
+                for (size_t c = 0; c < Channels; c++)
+                {
+                    ax[c] += wa * values[i * stride + c];
+                    bx[c] += wb * values[i * stride + c];
+                }
+            }
+
+            int32_t determinant = aa * bb - ab * ab;
+
+            if (!determinant)
+                return false;
+
+            float factor = static_cast<float>(scale) / static_cast<float>(determinant);
+
+            for (size_t c = 0; c < Channels; c++)
+            {
+                a[c] = clamp_255(static_cast<float>(ax[c] * bb - bx[c] * ab) * factor);
+                b[c] = clamp_255(static_cast<float>(bx[c] * aa - ax[c] * ab) * factor);
+            }
+
+            return true;
+        }
+
+        static bool refine_colors(const uint8_t* rgba, const ColorBlock& block, int (&a)[3], int (&b)[3]) noexcept
+        {
+            // share of color0 in each palette entry, in thirds
+            static const uint8_t shares[4] = { 3, 0, 2, 1 };
+            uint8_t weights[16];
+
+            for (size_t i = 0; i < 16; i++)
+                weights[i] = shares[(block.indices >> (2 * i)) & 3];
+
+            return least_squares(rgba, 4, weights, 3, a, b);
+        }
+
+        // Single channel endpoints
+
+        static void value_bounds(const uint8_t* values, uint8_t& low, uint8_t& high) noexcept
+        {
+        #ifdef XIL_SSE2
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+            __m128i min = v, max = v;
+
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 8));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 8));
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 4));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 2));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 2));
+            min = _mm_min_epu8(min, _mm_srli_si128(min, 1));
+            max = _mm_max_epu8(max, _mm_srli_si128(max, 1));
+
+            low = static_cast<uint8_t>(_mm_cvtsi128_si32(min));
+            high = static_cast<uint8_t>(_mm_cvtsi128_si32(max));
+        #else
+            low = 255;
+            high = 0;
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                low = std::min(low, values[i]);
+                high = std::max(high, values[i]);
+            }
+        #endif
+        }
+
+        // value0 > value1 interpolates 6 values between them, otherwise 4 and adds 0 and 255
+        static void value_palette(uint8_t value0, uint8_t value1, uint8_t (&palette)[8]) noexcept
+        {
+            uint32_t a = value0, b = value1;
+
+            palette[0] = value0;
+            palette[1] = value1;
+
+            if (value0 > value1)
+            {
+                for (uint32_t i = 2; i < 8; i++)
+                    palette[i] = static_cast<uint8_t>(((8 - i) * a + (i - 1) * b + 3) / 7);
+            }
+            else
+            {
+                for (uint32_t i = 2; i < 6; i++)
+                    palette[i] = static_cast<uint8_t>(((6 - i) * a + (i - 1) * b + 2) / 5);
+
+                palette[6] = 0;
+                palette[7] = 255;
+            }
+        }
+
+        static ValueBlock fit_values(const uint8_t* values, uint8_t value0, uint8_t value1) noexcept
+        {
+            ValueBlock block;
+            block.value0 = value0;
+            block.value1 = value1;
+
+            uint8_t palette[8];
+            value_palette(value0, value1, palette);
+
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+
+            __m128i best = zero, best_index = zero;
+
+            for (int k = 0; k < 8; k++)
+            {
+                __m128i entry = _mm_set1_epi8(static_cast<char>(palette[k]));
+                __m128i distance = _mm_or_si128(_mm_subs_epu8(v, entry), _mm_subs_epu8(entry, v));
+
+                if (!k)
+                {
+                    best = distance;
+                    continue;
+                }
+
+                __m128i min = _mm_min_epu8(distance, best);
+                __m128i closer = _mm_andnot_si128(_mm_cmpeq_epi8(min, best), _mm_set1_epi8(-1));
+
+                best = min;
+                best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi8(static_cast<char>(k))),
+                                          _mm_andnot_si128(closer, best_index));
+            }
+
+            __m128i lo = _mm_unpacklo_epi8(best, zero);
+            __m128i hi = _mm_unpackhi_epi8(best, zero);
+            __m128i errors = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+
+            errors = _mm_add_epi32(errors, _mm_srli_si128(errors, 8));
+            errors = _mm_add_epi32(errors, _mm_srli_si128(errors, 4));
+
+            block.error = static_cast<uint32_t>(_mm_cvtsi128_si32(errors));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(block.indices), best_index);
+        #else
+            block.error = 0;
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                uint32_t best = ~0u;
+
+                for (uint8_t k = 0; k < 8; k++)
+                {
+                    int d = values[i] - palette[k];
+                    uint32_t distance = static_cast<uint32_t>(d * d);
+
+                    if (distance < best)
+                    {
+                        best = distance;
+                        block.indices[i] = k;
+                    }
+                }
+
+                block.error += best;
+            }
+        #endif
+
+            return block;
+        }
+
+        static bool refine_values(const uint8_t* values, const ValueBlock& block, int (&a)[1], int (&b)[1]) noexcept
+        {
+            // share of value0 in each palette entry of the 8 value mode, in sevenths
+            static const uint8_t shares[8] = { 7, 0, 6, 5, 4, 3, 2, 1 };
+            uint8_t weights[16];
+
+            for (size_t i = 0; i < 16; i++)
+                weights[i] = shares[block.indices[i]];
+
+            return least_squares(values, 1, weights, 7, a, b);
+        }
+    };
+}
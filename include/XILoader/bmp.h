@@ -6,30 +6,74 @@
 #include "utils.h"
 #include "data_stream.h"
 #include "image.h"
+#include "convert.h"
+#include "png.h"
 
 namespace XIL
 {
     class BMP
     {
-        struct rgba_mask
+        // Extracts a single channel from a bitfield sample,
+        // everything is precomputed once when the mask is parsed
+        struct channel_mask
         {
-            uint32_t r;
-            int32_t  r_shift;
-            int8_t   r_bits;
+            uint32_t mask;
+
+            // aligns the top (at most 8) bits of the mask to bit 0
+            uint8_t  shift;
+
+            // scales the extracted bits up to the 0-255 range
+            uint16_t mul;
+            uint8_t  post_shift;
 
-            uint32_t g;
-            int32_t  g_shift;
-            int8_t   g_bits;
+            void set(uint32_t m)
+            {
+                static const uint16_t mul_table[9] = {
+                   0   /*0b00000000*/,
+                   0xff/*0b11111111*/, 0x55/*0b01010101*/,
+                   0x49/*0b01001001*/, 0x11/*0b00010001*/,
+                   0x21/*0b00100001*/, 0x41/*0b01000001*/,
+                   0x81/*0b10000001*/, 0x01/*0b00000001*/,
+                };
+
+                static const uint8_t shift_table[9] = {
+                   0,0,0,
+                   1,0,2,
+                   4,6,0,
+                };
+
+                mask = m;
+
+                if (!mask)
+                {
+                    shift = 0;
+                    mul = 0;
+                    post_shift = 0;
+                    return;
+                }
 
-            uint32_t b;
-            int32_t  b_shift;
-            int8_t   b_bits;
+                // channels wider than 8 bits are truncated to their top 8 bits
+                uint8_t bits = std::min<uint8_t>(count_bits(mask), 8);
 
-            uint32_t a;
-            int32_t  a_shift;
-            int8_t   a_bits;
+                shift = highest_set_bit(mask) + 1 - bits;
+                mul = mul_table[bits];
+                post_shift = shift_table[bits];
+            }
 
-            bool has_alpha() { return a; }
+            uint8_t extract(uint32_t sample) const noexcept
+            {
+                return ((((sample & mask) >> shift) * mul) >> post_shift) & UINT8_MAX;
+            }
+        };
+
+        struct rgba_mask
+        {
+            channel_mask r;
+            channel_mask g;
+            channel_mask b;
+            channel_mask a;
+
+            bool has_alpha() const noexcept { return a.mask; }
         };
 
         struct bmp_data {
@@ -40,23 +84,141 @@ namespace XIL
             uint32_t compression_method;
             uint32_t colors;
 
+            // size of the (possibly compressed) pixel array, 0 if unspecified
+            uint32_t raw_size;
+
             // bytes per color
             // can be 3 or 4 (99% of the time its 4)
             uint16_t bpc;
             uint16_t bpp;
             uint8_t channels;
-            uint16_t width;
-            uint16_t height;
+            uint32_t width;
+            uint32_t height;
             rgba_mask masks;
 
+            // sizes in bytes, overflow checked once by compute_sizes()
+            size_t row_padded;       // a row inside the pixel array
+            size_t pixel_array_size; // the entire uncompressed pixel array
+            size_t row_size;         // a decoded row
+            size_t pitch;            // a decoded row including the row alignment padding
+            size_t image_size;       // the entire decoded image
+
+            // premultiply RGBA rows as they're written
+            bool premultiply;
+
+            // where the decoded pixels are allocated from
+            BufferPool* pool;
+            PixelResource* resource;
+
             bool has_palette()   const noexcept { return colors; }
-            bool has_rgba_mask() const noexcept { return masks.a | masks.r | masks.g | masks.b; }
+            bool is_rle()        const noexcept { return compression_method == 1 || compression_method == 2; }
+
+            // BI_JPEG & BI_PNG, the OS22X header uses 4 for RLE24 instead
+            bool is_embedded()   const noexcept
+            {
+                return (compression_method == 4 || compression_method == 5) && (dib_size != 16) && (dib_size != 64);
+            }
+            bool has_rgba_mask() const noexcept { return masks.a.mask | masks.r.mask | masks.g.mask | masks.b.mask; }
         };
     public:
-        static void load(DataStream& file, Image& image, bool force_flip)
+        static void load(DataStream& file, Image& image, const LoadOptions& options)
         {
             bmp_data idata{};
 
+            read_headers(file, idata);
+
+            if (idata.is_embedded())
+            {
+                load_embedded(file, idata, image, options);
+                return;
+            }
+
+            idata.flipped = idata.flipped != options.flip;
+
+            // the 4th byte of 32 bit BI_RGB pixels is usually unused and 0, only an alpha mask makes it alpha
+            idata.premultiply = options.premultiply_alpha && (idata.channels == 4) && idata.masks.has_alpha();
+
+            idata.pitch = options.pitch_for(idata.row_size);
+            idata.image_size = checked_mul(idata.pitch, idata.height);
+
+            idata.pool = options.buffer_pool.get();
+            idata.resource = options.pixel_resource();
+            image.m_Pool = options.buffer_pool;
+
+            // load the pixel array
+            load_pixel_array(file, idata, image.m_Image.data);
+
+            image.m_Image.channels = idata.channels;
+            image.m_Image.width    = idata.width;
+            image.m_Image.height   = idata.height;
+            image.m_Image.pitch    = idata.pitch;
+            image.m_Image.premultiplied = idata.premultiply;
+
+            // RLE images are cleared up front
+            if (!idata.is_rle())
+                image.m_Image.clear_padding();
+
+            if (options.generate_mipmaps)
+                image.generate_mipmaps(options.mipmap_options);
+        }
+
+        // References the pixel array of an uncompressed 32 bit top to bottom BMP as is (BGRA, bit masks included),
+        // only the headers are validated so this is O(1) in image size
+        static void view(DataStream& file, BorrowedImage& image)
+        {
+            bmp_data idata{};
+
+            read_headers(file, idata);
+
+            if (!is_viewable(idata))
+                throw std::runtime_error("Only uncompressed 32 bit top to bottom BGRA BMPs can be viewed");
+
+            DataCursor pixel_array = file.get_cursor(idata.pixel_array_size);
+
+            image.m_Data     = pixel_array.data_ptr();
+            image.m_Width    = idata.width;
+            image.m_Height   = idata.height;
+            image.m_Pitch    = idata.row_padded;
+            image.m_Channels = 4;
+            image.m_Order    = BorrowedImage::Order::BGRA;
+        }
+    private:
+        // Hands the embedded file over to its own decoder without copying it
+        static void load_embedded(DataStream& file, const bmp_data& idata, Image& image, const LoadOptions& options)
+        {
+            DataStream payload = file.get_subset(idata.raw_size ? idata.raw_size : file.bytes_left());
+
+            if (idata.compression_method == 4)
+                throw std::runtime_error("JPEG loading is not yet implemented");
+
+            static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+            if (!payload.has_atleast(sizeof(png_signature)) ||
+                memcmp(payload.data_ptr(), png_signature, sizeof(png_signature)))
+                throw std::runtime_error("Invalid embedded PNG signature");
+
+            PNG::load(payload, image, options);
+        }
+
+        static bool is_viewable(const bmp_data& idata)
+        {
+            if ((idata.bpp != 32) || !idata.flipped)
+                return false;
+
+            if (idata.compression_method == 0)
+                return true;
+
+            // bit masks that describe plain BGRA. Without an alpha mask (BGRX) loading makes the image
+            // opaque, while a view would pass the unused byte, usually 0, off as alpha.
+            return (idata.masks.r.mask == 0x00ff0000) &&
+                   (idata.masks.g.mask == 0x0000ff00) &&
+                   (idata.masks.b.mask == 0x000000ff) &&
+                   (idata.masks.a.mask == 0xff000000);
+        }
+
+        // Reads everything up to the pixel array
+        static void read_headers(DataStream& file, bmp_data& idata)
+        {
             // skip magic numbers
             file.skip_n(2);
 
@@ -89,11 +251,13 @@ namespace XIL
             else
             {
                 int32_t width = file.get_i32();
-                idata.width = static_cast<uint16_t>(width);
+                if (width < 0)
+                    throw std::runtime_error("Invalid width (width < 0)");
+                idata.width = static_cast<uint32_t>(width);
 
-                int32_t height = file.get_i32();
+                int64_t height = file.get_i32();
                 if (height < 0) idata.flipped = true;
-                idata.height = static_cast<uint16_t>(abs(height));
+                idata.height = static_cast<uint32_t>(height < 0 ? -height : height);
             }
 
             uint16_t color_planes = file.get_u16();
@@ -108,7 +272,7 @@ namespace XIL
                 idata.compression_method = file.get_u32();
 
                 // Raw bitmap size
-                file.skip_n(4);
+                idata.raw_size = file.get_u32();
 
                 // Horizontal resolution
                 file.skip_n(4);
@@ -130,12 +294,20 @@ namespace XIL
             if (!idata.colors && idata.bpp <= 8)
                 idata.colors = static_cast<uint32_t>(pow(2, idata.bpp));
 
-            // Bit masks
-            if (idata.compression_method &&
-                (idata.compression_method != 3) &&
-                (idata.compression_method != 6))
+            // 1 & 2 are RLE8 & RLE4, 3 & 6 are bit masks, 4 & 5 are embedded JPEG & PNG
+            if ((idata.compression_method > 3) && (idata.compression_method != 6) && !idata.is_embedded())
                 throw std::runtime_error("Compressed BMPs are unsupported");
 
+            // the embedded file carries its own colors
+            if (idata.is_embedded())
+                idata.colors = 0;
+
+            if ((idata.compression_method == 1) && (idata.bpp != 8))
+                throw std::runtime_error("RLE8 compressed BMPs have to be 8 bpp");
+
+            if ((idata.compression_method == 2) && (idata.bpp != 4))
+                throw std::runtime_error("RLE4 compressed BMPs have to be 4 bpp");
+
             // OS22XBITMAPHEADER: Huffman 1D
             if (idata.compression_method == 3 && (idata.dib_size == 16 || idata.dib_size == 64))
                 throw std::runtime_error("Huffman 1D compressed BMPs are unsupported");
@@ -157,24 +329,19 @@ namespace XIL
             // BITMAPINFOHEADER stores this after the dib
             if ((idata.compression_method == 3) || (idata.compression_method == 6))
             {
-                idata.masks.r = file.get_u32();
-                idata.masks.r_bits = count_bits(idata.masks.r);
-                idata.masks.r_shift = highest_set_bit(idata.masks.r) - 7;
-
-                idata.masks.g = file.get_u32();
-                idata.masks.g_bits = count_bits(idata.masks.g);
-                idata.masks.g_shift = highest_set_bit(idata.masks.g) - 7;
-
-                idata.masks.b = file.get_u32();
-                idata.masks.b_bits = count_bits(idata.masks.b);
-                idata.masks.b_shift = highest_set_bit(idata.masks.b) - 7;
+                idata.masks.r.set(file.get_u32());
+                idata.masks.g.set(file.get_u32());
+                idata.masks.b.set(file.get_u32());
 
                 if ((idata.compression_method == 6) || (idata.dib_size >= 56))
-                {
-                    idata.masks.a = file.get_u32();
-                    idata.masks.a_bits = count_bits(idata.masks.a);
-                    idata.masks.a_shift = highest_set_bit(idata.masks.a) - 7;
-                }
+                    idata.masks.a.set(file.get_u32());
+            }
+            // uncompressed 16 bit images are always 5-5-5
+            else if (idata.bpp == 16)
+            {
+                idata.masks.r.set(0x7c00);
+                idata.masks.g.set(0x03e0);
+                idata.masks.b.set(0x001f);
             }
 
             // OS22X
@@ -234,19 +401,27 @@ namespace XIL
             auto pixel_array_gap = idata.pao - file.bytes_read();
             if (pixel_array_gap) file.skip_n(pixel_array_gap);
 
-            idata.flipped = idata.flipped != force_flip;
+            compute_sizes(idata);
+        }
 
-            // load the pixel array
-            load_pixel_array(file, idata, image.m_Image.data);
+        static void compute_sizes(bmp_data& idata)
+        {
+            size_t row_bits = checked_mul(idata.width, idata.bpp);
 
-            image.m_Image.channels = idata.channels;
-            image.m_Image.width    = idata.width;
-            image.m_Image.height   = idata.height;
+            // rows are padded to 4 bytes
+            idata.row_padded = checked_mul(checked_add(row_bits, 31) / 32, 4);
+            idata.pixel_array_size = checked_mul(idata.row_padded, idata.height);
+
+            idata.row_size = checked_mul(idata.width, idata.channels);
+            idata.pitch = idata.row_size;
+            idata.image_size = checked_mul(idata.row_size, idata.height);
         }
-    private:
+
         static void load_pixel_array(DataStream& file, bmp_data& image_data, ImageData::Container& to)
         {
-            if (image_data.has_palette())
+            if (image_data.is_rle())
+                load_rle(file, image_data, to);
+            else if (image_data.has_palette())
                 load_indexed(file, image_data, to);
             else if (image_data.has_rgba_mask())
                 load_sampled(file, image_data, to);
@@ -254,206 +429,361 @@ namespace XIL
                 load_raw(file, image_data, to);
         }
 
+        // Storage for the decoded pixels, only called once the pixel array has been validated
+        static void allocate_pixels(const bmp_data& idata, ImageData::Container& to)
+        {
+            to = BufferPool::acquire(idata.pool, idata.image_size, idata.resource);
+            resize_uninitialized(to, idata.image_size);
+        }
+
         static void load_indexed(DataStream& file, bmp_data& idata, ImageData::Container& to)
         {
-            uint32_t row_padded = static_cast<uint32_t>((ceil(idata.width / (8.0 / idata.bpp)) + 3)) & (~3);
-            to.resize(3ull * idata.width * idata.height);
+            if (idata.bpp != 1 && idata.bpp != 2 && idata.bpp != 4 && idata.bpp != 8)
+                throw std::runtime_error("Indexed BMPs have to be 1, 2, 4 or 8 bpp");
+
+            // validate the entire pixel array once before allocating anything
+            DataCursor pixel_array = file.get_cursor(idata.pixel_array_size);
+
+            allocate_pixels(idata, to);
 
-            DataStream row_buffer;
+            // every possible byte value mapped to the RGB values of all the pixels it stores
+            std::vector<uint8_t> lut;
+            build_indexed_lut(idata, lut);
 
-            // current Y of the image
             for (size_t i = 1; i < idata.height + 1ull; i++)
             {
-                row_buffer = file.get_subset(row_padded);
+                const uint8_t* row_buffer = pixel_array.take_n(idata.row_padded);
+                uint8_t* row = to.data() + row_offset(idata, i, to.size());
 
-                size_t pixel_count = 0;
-
-                for (;; row_buffer.next_byte())
+                switch (idata.bpp)
                 {
-                    for (int8_t pixel = 8 - idata.bpp; pixel >= 0; pixel -= idata.bpp)
-                    {
-                        pixel_count++;
-
-                        uint8_t RGB[3];
-
-                        size_t palette_index = row_buffer.get_bits(pixel, static_cast<uint8_t>(idata.bpp));
+                case 1:
+                    unpack_indexed_row<8>(row, row_buffer, idata.width, lut.data());
+                    break;
+                case 2:
+                    unpack_indexed_row<4>(row, row_buffer, idata.width, lut.data());
+                    break;
+                case 4:
+                    unpack_indexed_row<2>(row, row_buffer, idata.width, lut.data());
+                    break;
+                case 8:
+                    unpack_indexed_row<1>(row, row_buffer, idata.width, lut.data());
+                    break;
+                }
+            }
+        }
 
-                        RGB[0] = idata.palette[palette_index * idata.bpc + 2];
-                        RGB[1] = idata.palette[palette_index * idata.bpc + 1];
-                        RGB[2] = idata.palette[palette_index * idata.bpc + 0];
+        // Palette swizzled from BGR(X) into RGB,
+        // indices outside of the palette are black
+        static void swizzle_palette(const bmp_data& idata, uint8_t (&RGB)[256][3])
+        {
+            memset(RGB, 0, sizeof(RGB));
 
-                        size_t row_offset;
+            for (size_t i = 0; i < idata.colors && i < 256; i++)
+            {
+                RGB[i][0] = idata.palette[i * idata.bpc + 2];
+                RGB[i][1] = idata.palette[i * idata.bpc + 1];
+                RGB[i][2] = idata.palette[i * idata.bpc + 0];
+            }
+        }
 
-                        // flipped meaning stored top to bottom
-                        if (idata.flipped)
-                            row_offset = idata.width * (i - 1) * idata.channels;
-                        else
-                        {
-                            row_offset = idata.width * i * idata.channels;
-                            row_offset = to.size() - row_offset;
-                        }
+        static void build_indexed_lut(const bmp_data& idata, std::vector<uint8_t>& lut)
+        {
+            uint8_t RGB[256][3];
+            swizzle_palette(idata, RGB);
 
-                        auto total_offset = row_offset + ((pixel_count - 1) * 3);
+            size_t pixels_per_byte = 8 / idata.bpp;
+            uint8_t index_mask = XIL_BITS(idata.bpp);
 
-                        XIL_MEMCPY(
-                            to.data() + total_offset,
-                            to.size() - total_offset,
-                            RGB, 3
-                        );
+            lut.resize(256 * pixels_per_byte * 3);
+            uint8_t* entry = lut.data();
 
-                        if (pixel_count == idata.width)
-                            break;
-                    }
-                    if (pixel_count == idata.width)
-                        break;
+            for (size_t byte = 0; byte < 256; byte++)
+            {
+                // leftmost pixel is stored in the most significant bits
+                for (size_t pixel = 0; pixel < pixels_per_byte; pixel++, entry += 3)
+                {
+                    size_t index = (byte >> (8 - idata.bpp * (pixel + 1))) & index_mask;
+                    memcpy(entry, RGB[index], 3);
                 }
             }
         }
 
-        static void load_sampled(DataStream& file, bmp_data& idata, ImageData::Container& to)
+        template<size_t pixels_per_byte>
+        static void unpack_indexed_row(uint8_t* row, const uint8_t* indices, size_t width, const uint8_t* lut)
         {
-            uint8_t bytes_per_pixel = idata.bpp / 8;
-            uint32_t row_padded = (idata.width * bytes_per_pixel + 3) & (~3);
-            to.resize(static_cast<size_t>(idata.channels) * idata.width * idata.height);
+            constexpr size_t entry_size = pixels_per_byte * 3;
 
-            DataStream row_buffer;
+            size_t full_bytes = width / pixels_per_byte;
+            size_t pixels_left = width % pixels_per_byte;
 
-            for (size_t i = 1; i < idata.height + 1ull; i++)
+            for (size_t i = 0; i < full_bytes; i++, row += entry_size)
+                memcpy(row, lut + indices[i] * entry_size, entry_size);
+
+            if (pixels_left)
+                memcpy(row, lut + indices[full_bytes] * entry_size, pixels_left * 3);
+        }
+
+        static void load_rle(DataStream& file, bmp_data& idata, ImageData::Container& to)
+        {
+            bool rle4 = idata.compression_method == 2;
+
+            // pixels skipped by deltas or an early end of line/bitmap are left black
+            allocate_pixels(idata, to);
+            std::fill(to.begin(), to.end(), uint8_t(0));
+
+            uint8_t RGB[256][3];
+            swizzle_palette(idata, RGB);
+
+            size_t x = 0;
+            size_t y = 0;
+            uint8_t* row = to.data() + row_offset(idata, 1, to.size());
+
+            // the encoded size isn't known up front, so the rest of the file is validated
+            // once and every command only checks that it fits into what's left
+            DataCursor rle = file.get_cursor(file.bytes_left());
+
+            // y is counted in file order, rows past the end of the image are ignored
+            while (y < idata.height)
             {
-                row_buffer = file.get_subset(row_padded);
+                if (!rle.has_atleast(2))
+                    throw std::runtime_error("Unexpected end of RLE data");
 
-                for (size_t j = 0; j < static_cast<size_t>(idata.width) * bytes_per_pixel; j += bytes_per_pixel)
+                uint8_t count = rle.get_u8();
+                uint8_t value = rle.get_u8();
+
+                // encoded mode, 'count' pixels of 'value'
+                if (count)
                 {
-                    uint32_t sample;
+                    size_t pixels = std::min<size_t>(count, idata.width - x);
 
-                    if (bytes_per_pixel == 2)
-                        sample = row_buffer.get_u16();
-                    else if (bytes_per_pixel == 4)
-                        sample = row_buffer.get_u32();
+                    if (rle4)
+                        fill_pattern(row + x * 3, pixels, RGB[value >> 4], RGB[value & 0xf]);
                     else
-                        throw std::runtime_error("This image shouldn't be sampled (not 16/32 bpp)");
+                        fill_pattern(row + x * 3, pixels, RGB[value], RGB[value]);
 
-                    uint8_t RGBA[4];
-                    RGBA[0] = shift_signed_as_byte(sample & idata.masks.r, idata.masks.r_shift, idata.masks.r_bits);
-                    RGBA[1] = shift_signed_as_byte(sample & idata.masks.g, idata.masks.g_shift, idata.masks.g_bits);
-                    RGBA[2] = shift_signed_as_byte(sample & idata.masks.b, idata.masks.b_shift, idata.masks.b_bits);
+                    x += pixels;
+                    continue;
+                }
 
-                    if (idata.channels == 4)
-                    {
-                        if (idata.masks.has_alpha())
-                            RGBA[3] = shift_signed_as_byte(sample & idata.masks.a, idata.masks.a_shift, idata.masks.a_bits);
-                        else
-                            RGBA[3] = 255;
-                    }
+                switch (value)
+                {
+                case 0: // end of line
+                    x = 0;
+                    y++;
+                    break;
+                case 1: // end of bitmap
+                    return;
+                case 2: // delta
+                    if (!rle.has_atleast(2))
+                        throw std::runtime_error("Unexpected end of RLE data");
+
+                    x += rle.get_u8();
+                    y += rle.get_u8();
+
+                    if (x > idata.width)
+                        throw std::runtime_error("RLE delta moves past the end of the row");
+                    break;
+                default: // absolute mode, 'value' pixels stored as is
+                {
+                    size_t encoded_size = rle4 ? (value + 1ull) / 2 : value;
 
-                    // since we could be forcing a different number of channels 
-                    // we have to account for that
-                    auto pixel_offset = idata.channels * (j / bytes_per_pixel);
+                    // absolute runs are padded to a 16 bit boundary
+                    size_t padded_size = (encoded_size + 1) & (~1);
 
-                    size_t row_offset;
+                    if (!rle.has_atleast(padded_size))
+                        throw std::runtime_error("Unexpected end of RLE data");
 
-                    // flipped meaning stored top to bottom
-                    if (idata.flipped)
-                        row_offset = idata.width * (i - 1) * idata.channels;
-                    else
+                    const uint8_t* indices = rle.take_n(padded_size);
+
+                    size_t pixels = std::min<size_t>(value, idata.width - x);
+                    uint8_t* out = row + x * 3;
+
+                    for (size_t i = 0; i < pixels; i++, out += 3)
                     {
-                        row_offset = idata.width * i * idata.channels;
-                        row_offset = to.size() - row_offset;
+                        uint8_t index = rle4 ? (indices[i / 2] >> ((i & 1) ? 0 : 4)) & 0xf : indices[i];
+                        memcpy(out, RGB[index], 3);
                     }
 
-                    auto total_offset = row_offset + pixel_offset;
-
-                    XIL_MEMCPY(
-                        to.data() + total_offset,
-                        to.size() - total_offset,
-                        RGBA, idata.channels
-                    );
+                    x += pixels;
+                    break;
+                }
                 }
+
+                if (y < idata.height)
+                    row = to.data() + row_offset(idata, y + 1, to.size());
             }
         }
 
-        static void load_raw(DataStream& file, bmp_data& idata, ImageData::Container& to)
+        // Fills 'pixels' RGB pixels alternating between 'first' and 'second'
+        static void fill_pattern(uint8_t* at, size_t pixels, const uint8_t* first, const uint8_t* second)
         {
-            uint8_t bytes_per_pixel = idata.bpp / 8;
-            uint32_t row_padded = (idata.width * bytes_per_pixel + 3) & (~3);
-            to.resize(static_cast<size_t>(idata.channels) * idata.width * idata.height);
+            if (!pixels)
+                return;
 
-            DataStream row_buffer;
+            size_t size = pixels * 3;
+
+            // single gray color, the most common case for RLE images
+            if (first == second && first[0] == first[1] && first[1] == first[2])
+            {
+                memset(at, first[0], size);
+                return;
+            }
+
+            memcpy(at, first, 3);
+            if (pixels > 1)
+                memcpy(at + 3, second, 3);
+
+            // keep doubling the already filled part
+            size_t filled = std::min<size_t>(size, 6);
+
+            while (filled < size)
+            {
+                size_t chunk = std::min(filled, size - filled);
+                memcpy(at + filled, at, chunk);
+                filled += chunk;
+            }
+        }
+
+        static void load_sampled(DataStream& file, bmp_data& idata, ImageData::Container& to)
+        {
+            if (idata.bpp != 16 && idata.bpp != 32)
+                throw std::runtime_error("This image shouldn't be sampled (not 16/32 bpp)");
+
+            // validate the entire pixel array once before allocating anything
+            DataCursor pixel_array = file.get_cursor(idata.pixel_array_size);
+
+            allocate_pixels(idata, to);
+
+            // every possible 16 bit sample mapped to its RGBA value
+            std::vector<uint8_t> lut;
+            if (idata.bpp == 16)
+                build_sampled_lut(idata.masks, lut);
 
             for (size_t i = 1; i < idata.height + 1ull; i++)
             {
-                row_buffer = file.get_subset(row_padded);
+                const uint8_t* row_buffer = pixel_array.take_n(idata.row_padded);
+                uint8_t* row = to.data() + row_offset(idata, i, to.size());
 
-                for (size_t j = 0; j < static_cast<size_t>(idata.width) * bytes_per_pixel; j += bytes_per_pixel)
-                {
-                    // assert here to get rid of the warning
-                    assert(j + 2 < row_padded);
+                if (idata.bpp == 32)
+                    convert_sampled_row_32(row, row_buffer, idata.width, idata.masks);
+                else if (idata.channels == 4)
+                    convert_sampled_row_16<4>(row, row_buffer, idata.width, lut.data());
+                else
+                    convert_sampled_row_16<3>(row, row_buffer, idata.width, lut.data());
 
-                    uint8_t RGB[4]{};
+                if (idata.premultiply)
+                    Convert::premultiply_rgba(row, idata.width);
+            }
+        }
 
-                    RGB[2] = row_buffer.get_u8();
-                    RGB[1] = row_buffer.get_u8();
-                    RGB[0] = row_buffer.get_u8();
-                    if (idata.channels >= 4)
-                        RGB[3] = row_buffer.get_u8();
+        static void build_sampled_lut(const rgba_mask& masks, std::vector<uint8_t>& lut)
+        {
+            lut.resize((UINT16_MAX + 1) * 4ull);
+            uint8_t* entry = lut.data();
+
+            for (uint32_t sample = 0; sample <= UINT16_MAX; sample++, entry += 4)
+            {
+                entry[0] = masks.r.extract(sample);
+                entry[1] = masks.g.extract(sample);
+                entry[2] = masks.b.extract(sample);
+                entry[3] = masks.has_alpha() ? masks.a.extract(sample) : 255;
+            }
+        }
 
-                    // since we could be forcing a different number of channels 
-                    // we have to account for that
-                    auto pixel_offset = idata.channels * (j / bytes_per_pixel);
+        template<size_t channels>
+        static void convert_sampled_row_16(uint8_t* row, const uint8_t* samples, size_t width, const uint8_t* lut)
+        {
+            for (size_t x = 0; x < width; x++, row += channels, samples += 2)
+            {
+                size_t sample = samples[0] | (samples[1] << 8);
+                memcpy(row, lut + sample * 4, channels);
+            }
+        }
 
-                    size_t row_offset;
+        static void convert_sampled_row_32(uint8_t* row, const uint8_t* samples, size_t width, const rgba_mask& masks)
+        {
+            size_t x = 0;
 
-                    // flipped meaning stored top to bottom
-                    if (idata.flipped)
-                        row_offset = idata.width * (i - 1) * idata.channels;
-                    else
-                    {
-                        row_offset = idata.width * i * idata.channels;
-                        row_offset = to.size() - row_offset;
-                    }
+        #ifdef XIL_SSE2
+            if XIL_CONSTEXPR (host_endiannes() == byte_order::LITTLE)
+            {
+                const __m128i opaque = _mm_set1_epi32(masks.has_alpha() ? 0 : 0xff000000);
 
-                    auto total_offset = row_offset + pixel_offset;
+                for (; x + 4 <= width; x += 4)
+                {
+                    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + x * 4));
+
+                    __m128i RGBA = _mm_or_si128(extract_channel(px, masks.r), opaque);
+                    RGBA = _mm_or_si128(RGBA, _mm_slli_epi32(extract_channel(px, masks.g), 8));
+                    RGBA = _mm_or_si128(RGBA, _mm_slli_epi32(extract_channel(px, masks.b), 16));
+                    RGBA = _mm_or_si128(RGBA, _mm_slli_epi32(extract_channel(px, masks.a), 24));
 
-                    XIL_MEMCPY(
-                        to.data() + total_offset,
-                        to.size() - total_offset,
-                        RGB, idata.channels
-                    );
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x * 4), RGBA);
                 }
             }
+        #endif
+
+            for (; x < width; x++)
+            {
+                const uint8_t* at = samples + x * 4;
+                uint32_t sample = at[0] | (at[1] << 8) | (at[2] << 16) | (static_cast<uint32_t>(at[3]) << 24);
+
+                row[x * 4 + 0] = masks.r.extract(sample);
+                row[x * 4 + 1] = masks.g.extract(sample);
+                row[x * 4 + 2] = masks.b.extract(sample);
+                row[x * 4 + 3] = masks.has_alpha() ? masks.a.extract(sample) : 255;
+            }
         }
 
-        // Tranforms a given RGBAX fraction into a 0-255 range R/G/B/A channel
-        static uint8_t shift_signed_as_byte(uint32_t x, int32_t by, uint8_t bits)
+    #ifdef XIL_SSE2
+        // SIMD version of channel_mask::extract for 4 samples at once
+        static __m128i extract_channel(__m128i samples, const channel_mask& channel)
         {
-            static uint32_t mul_table[9] = {
-               0   /*0b00000000*/,
-               0xff/*0b11111111*/, 0x55/*0b01010101*/,
-               0x49/*0b01001001*/, 0x11/*0b00010001*/,
-               0x21/*0b00100001*/, 0x41/*0b01000001*/,
-               0x81/*0b10000001*/, 0x01/*0b00000001*/,
-            };
-
-            static uint32_t shift_table[9] = {
-               0,0,0,
-               1,0,2,
-               4,6,0,
-            };
-
-            if (by < 0)
-                x <<= -by;
-            else
-                x >>= by;
+            __m128i value = _mm_and_si128(samples, _mm_set1_epi32(channel.mask));
+            value = _mm_srl_epi32(value, _mm_cvtsi32_si128(channel.shift));
+
+            // value < 256 and mul < 256, so a 16 bit multiply is exact
+            value = _mm_mullo_epi16(value, _mm_set1_epi32(channel.mul));
+            value = _mm_srl_epi32(value, _mm_cvtsi32_si128(channel.post_shift));
+
+            return _mm_and_si128(value, _mm_set1_epi32(UINT8_MAX));
+        }
+    #endif
+
+        static void load_raw(DataStream& file, bmp_data& idata, ImageData::Container& to)
+        {
+            if (idata.bpp != 24 && idata.bpp != 32)
+                throw std::runtime_error("Raw BMPs have to be either 24 or 32 bpp");
+
+            // validate the entire pixel array once before allocating anything
+            DataCursor pixel_array = file.get_cursor(idata.pixel_array_size);
 
-            if (!((x >= 0) && (x < 256)))
-                throw std::runtime_error("Invalid conversion (x)");
+            allocate_pixels(idata, to);
 
-            x >>= (8 - bits);
+            for (size_t i = 1; i < idata.height + 1ull; i++)
+            {
+                const uint8_t* row_buffer = pixel_array.take_n(idata.row_padded);
+                uint8_t* row = to.data() + row_offset(idata, i, to.size());
 
-            if (!((bits >= 0) && (bits <= 8)))
-                throw std::runtime_error("Invalid conversion (bits)");
+                if (idata.channels == 4)
+                    Convert::bgra_to_rgba(row, row_buffer, idata.width);
+                else
+                    Convert::bgr_to_rgb(row, row_buffer, idata.width);
 
-            return ((x * mul_table[bits]) >> shift_table[bits]) & UINT8_MAX;
+                if (idata.premultiply)
+                    Convert::premultiply_rgba(row, idata.width);
+            }
+        }
+
+        // Offset of the 'row'th (1 based, in file order) row inside the output image
+        static size_t row_offset(const bmp_data& idata, size_t row, size_t image_size)
+        {
+            // flipped meaning stored top to bottom
+            if (idata.flipped)
+                return idata.pitch * (row - 1);
+            else
+                return image_size - idata.pitch * row;
         }
     };
 }
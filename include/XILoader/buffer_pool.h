@@ -0,0 +1,219 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "memory_resource.h"
+
+namespace XIL {
+
+    // Thread safe pool of pixel buffers bucketed by size class, images loaded with a pool
+    // return their storage to it once destroyed so that the next image of a similar size
+    // reuses the already allocated and faulted in memory instead of going to malloc.
+    class BufferPool
+    {
+    public:
+        using Buffer = PixelContainer;
+
+        // smaller buffers are cheaper to allocate than to pool
+        static constexpr size_t min_pooled_size = 4096;
+    private:
+        // four classes per power of two, so a buffer wastes at most 25% of its capacity
+        static constexpr size_t classes_per_doubling = 4;
+
+        std::vector<std::vector<Buffer>> m_Buckets;
+        size_t m_Retained;
+        size_t m_MaxRetained;
+        size_t m_Hits;
+        size_t m_Misses;
+        mutable std::mutex m_Mutex;
+    public:
+        // Keeps at most 'max_retained' bytes of unused buffers around,
+        // buffers released past that are freed
+        explicit BufferPool(size_t max_retained = 256 * 1024 * 1024)
+            : m_Retained(0),
+            m_MaxRetained(max_retained),
+            m_Hits(0),
+            m_Misses(0)
+        {
+        }
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        // Empty buffer with a capacity of at least 'bytes' allocated from 'resource',
+        // nullptr stands for the default resource
+        Buffer acquire(size_t bytes, PixelResource* resource = nullptr)
+        {
+            Buffer buffer = make_buffer(resource);
+
+            if (bytes <= min_pooled_size)
+            {
+                buffer.reserve(bytes);
+                return buffer;
+            }
+
+            size_t index = class_index(bytes);
+
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+
+                if (index < m_Buckets.size())
+                {
+                    auto& bucket = m_Buckets[index];
+
+                    // only a buffer from the same resource will do
+                    for (size_t i = bucket.size(); i--;)
+                    {
+                        if (bucket[i].get_allocator() != buffer.get_allocator())
+                            continue;
+
+                        std::swap(bucket[i], bucket.back());
+                        buffer = std::move(bucket.back());
+                        bucket.pop_back();
+                        m_Retained -= buffer.capacity();
+                        m_Hits++;
+
+                        return buffer;
+                    }
+                }
+
+                m_Misses++;
+            }
+
+            // rounded up to the class so that the buffer can serve the whole class later on
+            buffer.reserve(class_size(index));
+            return buffer;
+        }
+
+        // Takes the storage of 'buffer' back, it's freed instead if the pool is full
+        void release(Buffer&& buffer) noexcept
+        {
+            Buffer released = std::move(buffer);
+            size_t capacity = released.capacity();
+
+            if (capacity <= min_pooled_size)
+                return;
+
+            // the largest class this buffer can fully serve
+            size_t index = class_index(capacity);
+
+            if (class_size(index) > capacity)
+            {
+                if (!index)
+                    return;
+
+                index--;
+            }
+
+            released.clear();
+
+            std::lock_guard<std::mutex> lock(m_Mutex);
+
+            if (m_Retained > m_MaxRetained || capacity > m_MaxRetained - m_Retained)
+                return;
+
+            try {
+                if (index >= m_Buckets.size())
+                    m_Buckets.resize(index + 1);
+
+                m_Buckets[index].push_back(std::move(released));
+                m_Retained += capacity;
+            }
+            catch (const std::exception&) // out of memory, just free the buffer
+            {
+            }
+        }
+
+        // Frees every retained buffer
+        void trim()
+        {
+            std::vector<std::vector<Buffer>> buckets;
+
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                buckets.swap(m_Buckets);
+                m_Retained = 0;
+            }
+        }
+
+        // Lowering the cap takes effect for the following releases, call trim() to free memory right away
+        void set_max_retained(size_t max_retained)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_MaxRetained = max_retained;
+        }
+
+        size_t max_retained() const
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return m_MaxRetained;
+        }
+
+        // bytes currently held by unused buffers
+        size_t retained() const
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return m_Retained;
+        }
+
+        // number of pooled acquisitions served by a retained buffer / by a new allocation
+        size_t hits() const
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return m_Hits;
+        }
+
+        size_t misses() const
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return m_Misses;
+        }
+
+        // Takes a buffer from 'pool' or allocates one if there is no pool
+        static Buffer acquire(BufferPool* pool, size_t bytes, PixelResource* resource = nullptr)
+        {
+            if (pool)
+                return pool->acquire(bytes, resource);
+
+            Buffer buffer = make_buffer(resource);
+            buffer.reserve(bytes);
+            return buffer;
+        }
+
+        static void release(BufferPool* pool, Buffer&& buffer) noexcept
+        {
+            if (pool)
+                pool->release(std::move(buffer));
+        }
+    private:
+        static Buffer make_buffer(PixelResource* resource) noexcept
+        {
+        #ifdef XIL_PMR
+            return Buffer(PixelAllocator<uint8_t>(resource));
+        #else
+            XIL_UNUSED(resource);
+            return Buffer();
+        #endif
+        }
+
+        // classes are (5, 6, 7, 8) * 2^(n - 2) for the sizes in (2^n, 2^(n + 1)]
+        static size_t class_index(size_t bytes) noexcept
+        {
+            size_t log = 0;
+            for (size_t value = bytes - 1; value > 1; value >>= 1)
+                log++;
+
+            size_t step = size_t(1) << (log - 2);
+            size_t sub_class = (bytes - 1) / step - classes_per_doubling;
+
+            return (log - 12) * classes_per_doubling + sub_class;
+        }
+
+        static size_t class_size(size_t index) noexcept
+        {
+            return (classes_per_doubling + 1 + index % classes_per_doubling) << (10 + index / classes_per_doubling);
+        }
+    };
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "utils.h"
+
+namespace XIL {
+
+    // Row-level pixel conversion kernels shared by the decoders
+    class Convert
+    {
+    public:
+        Convert() = delete;
+
+        // Exact round(color * alpha / 255) for any 8-bit color and alpha
+        static uint8_t mul_div_255(uint32_t color, uint32_t alpha) noexcept
+        {
+            uint32_t t = color * alpha + 128;
+
+            return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+        }
+
+        // Multiplies the color channels of a GRAY_A or RGBA row by its alpha channel in place
+        static void premultiply(uint8_t* pixels, size_t count, uint8_t channels) noexcept
+        {
+            if (channels == 4)
+                premultiply_rgba(pixels, count);
+            else if (channels == 2)
+                premultiply_gray_alpha(pixels, count);
+        }
+
+        static void premultiply_rgba(uint8_t* pixels, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                auto* at = reinterpret_cast<__m128i*>(pixels + i * 4);
+                __m128i px = _mm_loadu_si128(at);
+
+                __m128i lo = premultiply_lanes<_MM_SHUFFLE(3, 3, 3, 3)>(_mm_unpacklo_epi8(px, zero), alpha_lanes);
+                __m128i hi = premultiply_lanes<_MM_SHUFFLE(3, 3, 3, 3)>(_mm_unpackhi_epi8(px, zero), alpha_lanes);
+
+                _mm_storeu_si128(at, _mm_packus_epi16(lo, hi));
+            }
+        #endif
+
+            for (; i < count; i++)
+            {
+                uint8_t* px = pixels + i * 4;
+
+                px[0] = mul_div_255(px[0], px[3]);
+                px[1] = mul_div_255(px[1], px[3]);
+                px[2] = mul_div_255(px[2], px[3]);
+            }
+        }
+
+        static void premultiply_gray_alpha(uint8_t* pixels, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i alpha_lanes = _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+
+            for (; i + 8 <= count; i += 8)
+            {
+                auto* at = reinterpret_cast<__m128i*>(pixels + i * 2);
+                __m128i px = _mm_loadu_si128(at);
+
+                __m128i lo = premultiply_lanes<_MM_SHUFFLE(3, 3, 1, 1)>(_mm_unpacklo_epi8(px, zero), alpha_lanes);
+                __m128i hi = premultiply_lanes<_MM_SHUFFLE(3, 3, 1, 1)>(_mm_unpackhi_epi8(px, zero), alpha_lanes);
+
+                _mm_storeu_si128(at, _mm_packus_epi16(lo, hi));
+            }
+        #endif
+
+            for (; i < count; i++)
+            {
+                uint8_t* px = pixels + i * 2;
+
+                px[0] = mul_div_255(px[0], px[1]);
+            }
+        }
+
+        // Swaps the R and B channels of 'count' 3 channel pixels, 'dst' and 'src' must not overlap
+        static void bgr_to_rgb(uint8_t* dst, const uint8_t* src, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #ifdef XIL_SSSE3
+            // 5 pixels per iteration, the 16th byte is rewritten by the next one
+            const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+
+            for (; i + 6 <= count; i += 5)
+            {
+                __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(px, swizzle));
+            }
+        #endif
+
+            for (; i < count; i++)
+            {
+                dst[i * 3 + 0] = src[i * 3 + 2];
+                dst[i * 3 + 1] = src[i * 3 + 1];
+                dst[i * 3 + 2] = src[i * 3 + 0];
+            }
+        }
+
+        // Swaps the R and B channels of 'count' 4 channel pixels, 'dst' and 'src' must not overlap
+        static void bgra_to_rgba(uint8_t* dst, const uint8_t* src, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #if defined(XIL_SSSE3)
+            const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(px, swizzle));
+            }
+        #elif defined(XIL_SSE2)
+            const __m128i ga_mask = _mm_set1_epi32(0xff00ff00);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+                __m128i rb = _mm_andnot_si128(ga_mask, px);
+
+                rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+                px = _mm_or_si128(_mm_and_si128(ga_mask, px), rb);
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), px);
+            }
+        #endif
+
+            for (; i < count; i++)
+            {
+                dst[i * 4 + 0] = src[i * 4 + 2];
+                dst[i * 4 + 1] = src[i * 4 + 1];
+                dst[i * 4 + 2] = src[i * 4 + 0];
+                dst[i * 4 + 3] = src[i * 4 + 3];
+            }
+        }
+
+    private:
+    #ifdef XIL_SSE2
+        // 'lanes' holds 8 widened channels, 'alpha_shuffle' broadcasts
+        // each pixel's alpha over its own lanes, alpha lanes are multiplied by 255
+        template<int alpha_shuffle>
+        static __m128i premultiply_lanes(__m128i lanes, __m128i alpha_lanes) noexcept
+        {
+            __m128i alpha = _mm_shufflelo_epi16(lanes, alpha_shuffle);
+            alpha = _mm_shufflehi_epi16(alpha, alpha_shuffle);
+            alpha = _mm_or_si128(
+                _mm_andnot_si128(alpha_lanes, alpha),
+                _mm_and_si128(alpha_lanes, _mm_set1_epi16(255)));
+
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(lanes, alpha), _mm_set1_epi16(128));
+
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        }
+    #endif
+    };
+}
@@ -2,13 +2,130 @@
 
 #include <string>
 #include <vector>
+#include <istream>
+#include <functional>
+#include <algorithm>
+#include <new>
 
 #include <assert.h>
 
 #include "utils.h"
 
+#ifdef XIL_POSIX
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+#endif
+
 namespace XIL {
 
+    // Forward reader over a region that has already been validated as a whole by
+    // DataStream::get_cursor(), individual reads are only checked by assert so that
+    // hot loops don't pay for a branch and an exception edge on every read
+    class DataCursor
+    {
+    private:
+        const uint8_t* m_At;
+        const uint8_t* m_End;
+    public:
+        DataCursor() noexcept
+            : m_At(nullptr),
+            m_End(nullptr)
+        {
+        }
+
+        DataCursor(const void* data, size_t size) noexcept
+            : m_At(static_cast<const uint8_t*>(data)),
+            m_End(static_cast<const uint8_t*>(data) + size)
+        {
+        }
+
+        bool has_atleast(size_t bytes) const noexcept
+        {
+            return bytes_left() >= bytes;
+        }
+
+        size_t bytes_left() const noexcept
+        {
+            return static_cast<size_t>(m_End - m_At);
+        }
+
+        uint8_t get_u8() noexcept
+        {
+            assert(has_atleast(1));
+
+            return *m_At++;
+        }
+
+        uint16_t get_u16() noexcept
+        {
+            assert(has_atleast(2));
+
+            uint16_t out = m_At[0] | (m_At[1] << 8);
+            m_At += 2;
+
+            return out;
+        }
+
+        uint32_t get_u32() noexcept
+        {
+            assert(has_atleast(4));
+
+            uint32_t out = m_At[0] | (m_At[1] << 8) | (m_At[2] << 16) | (static_cast<uint32_t>(m_At[3]) << 24);
+            m_At += 4;
+
+            return out;
+        }
+
+        uint32_t get_u32_big() noexcept
+        {
+            assert(has_atleast(4));
+
+            uint32_t out = (static_cast<uint32_t>(m_At[0]) << 24) | (m_At[1] << 16) | (m_At[2] << 8) | m_At[3];
+            m_At += 4;
+
+            return out;
+        }
+
+        void get_n(size_t bytes, void* to) noexcept
+        {
+            assert(has_atleast(bytes));
+
+            memcpy(to, m_At, bytes);
+            m_At += bytes;
+        }
+
+        // Returns the current position and moves past 'bytes' bytes
+        const uint8_t* take_n(size_t bytes) noexcept
+        {
+            assert(has_atleast(bytes));
+
+            auto at = m_At;
+            m_At += bytes;
+
+            return at;
+        }
+
+        void skip_n(size_t bytes) noexcept
+        {
+            assert(has_atleast(bytes));
+
+            m_At += bytes;
+        }
+
+        const uint8_t* data_ptr() const noexcept
+        {
+            return m_At;
+        }
+    };
+
     class DataStream
     {
         friend class ChunkedBitReader;
@@ -182,6 +299,18 @@ namespace XIL {
             return DataStream(cur, bytes);
         }
 
+        // Validates the next 'bytes' bytes once and hands them out as an unchecked cursor
+        DataCursor get_cursor(size_t bytes)
+        {
+            if (bytes > bytes_left())
+                throw std::runtime_error("Buffer overflow");
+
+            auto cur = cursor();
+            m_BytesRead += bytes;
+
+            return DataCursor(cur, bytes);
+        }
+
         void rewind_n(size_t bytes)
         {
             if (m_Size - bytes_left() < bytes)
@@ -237,8 +366,9 @@ namespace XIL {
     private:
         void delete_if_owner()
         {
+            // owned data is always allocated as uint8_t[]
             if (m_Owner)
-                delete[] m_Data;
+                delete[] static_cast<uint8_t*>(m_Data);
         }
 
         void* cursor() const
@@ -255,11 +385,24 @@ namespace XIL {
         if (!file) throw std::runtime_error("Couldn't open the file");
 
         fseek(file, 0, SEEK_END);
-        size_t fsize = ftell(file);
+        long end = ftell(file);
         rewind(file);
 
-        uint8_t* data = new uint8_t[fsize];
-        if (!XIL_READ_EXACTLY(fsize, data, fsize, file))
+        // directories and other unseekable files
+        if (end < 0)
+        {
+            fclose(file);
+            throw std::runtime_error("Couldn't read the file");
+        }
+
+        size_t fsize = static_cast<size_t>(end);
+
+        uint8_t* data = new (std::nothrow) uint8_t[fsize];
+        bool read = data && XIL_READ_EXACTLY(fsize, data, fsize, file);
+
+        fclose(file);
+
+        if (!read)
         {
             delete[] data;
             throw std::runtime_error("Couldn't read the file");
@@ -268,6 +411,391 @@ namespace XIL {
         into.init_with(data, fsize, true);
     }
 
+    // Same as read_file but reads straight into the buffer with pread, without any stdio buffering
+    static inline void pread_file(const std::string& path, DataStream& into)
+    {
+    #ifdef XIL_POSIX
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Couldn't open the file");
+
+        struct stat info;
+        if (fstat(fd, &info) || !S_ISREG(info.st_mode) || static_cast<uint64_t>(info.st_size) > SIZE_MAX)
+        {
+            close(fd);
+            throw std::runtime_error("Couldn't read the file");
+        }
+
+        size_t size = static_cast<size_t>(info.st_size);
+        uint8_t* data = new (std::nothrow) uint8_t[size];
+        size_t done = 0;
+
+        while (data && done < size)
+        {
+            ssize_t got = pread(fd, data + done, size - done, static_cast<off_t>(done));
+
+            if (got < 0 && errno == EINTR)
+                continue;
+
+            if (got <= 0)
+                break;
+
+            done += static_cast<size_t>(got);
+        }
+
+        close(fd);
+
+        if (!data || done != size)
+        {
+            delete[] data;
+            throw std::runtime_error("Couldn't read the file");
+        }
+
+        into.init_with(data, size, true);
+    #else
+        read_file(path, into);
+    #endif
+    }
+
+    // Size of the file in bytes, 0 if it doesn't exist or isn't a regular file.
+    // Only opened on platforms that can't stat it.
+    static inline size_t file_size(const std::string& path) noexcept
+    {
+    #ifdef XIL_POSIX
+        struct stat info;
+
+        if (stat(path.c_str(), &info) || !S_ISREG(info.st_mode) || static_cast<uint64_t>(info.st_size) > SIZE_MAX)
+            return 0;
+
+        return static_cast<size_t>(info.st_size);
+    #elif defined(_WIN32)
+        struct _stat64 info;
+
+        if (_stat64(path.c_str(), &info) || !(info.st_mode & _S_IFREG) || static_cast<uint64_t>(info.st_size) > SIZE_MAX)
+            return 0;
+
+        return static_cast<size_t>(info.st_size);
+    #else
+        FILE* file;
+        XIL_OPEN_FILE(file, path);
+
+        if (!file) return 0;
+
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fclose(file);
+
+        return end > 0 ? static_cast<size_t>(end) : 0;
+    #endif
+    }
+
+    // Read-only mapping of an entire file, the pages are paged in by the kernel
+    // on first access instead of being copied into a separate buffer
+    class MappedFile
+    {
+    private:
+        uint8_t* m_Data = nullptr;
+        size_t   m_Size = 0;
+    public:
+        MappedFile() = default;
+
+        explicit MappedFile(const std::string& path)
+        {
+            if (!map(path))
+                throw std::runtime_error("Couldn't map the file");
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other) noexcept
+            : m_Data(other.m_Data), m_Size(other.m_Size)
+        {
+            other.m_Data = nullptr;
+            other.m_Size = 0;
+        }
+
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this == &other)
+                return *this;
+
+            unmap();
+
+            m_Data = other.m_Data;
+            m_Size = other.m_Size;
+            other.m_Data = nullptr;
+            other.m_Size = 0;
+
+            return *this;
+        }
+
+        // Returns false if the file couldn't be mapped or is smaller than 'min_size',
+        // in which case it should be read instead. Always fails for empty files and on platforms without mmap.
+        bool map(const std::string& path, size_t min_size = 0) noexcept
+        {
+            unmap();
+
+        #ifdef XIL_MMAP
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            if (fstat(fd, &info) || !S_ISREG(info.st_mode) || info.st_size <= 0 ||
+                static_cast<uint64_t>(info.st_size) > SIZE_MAX ||
+                static_cast<uint64_t>(info.st_size) < min_size)
+            {
+                close(fd);
+                return false;
+            }
+
+            size_t size = static_cast<size_t>(info.st_size);
+
+            // decoders consume the whole file front to back, so fault it in up front
+            // where possible, otherwise ask for aggressive readahead
+        #ifdef MAP_POPULATE
+            void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        #else
+            void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        #endif
+
+            // the mapping keeps its own reference to the file
+            close(fd);
+
+            if (data == MAP_FAILED)
+                return false;
+
+        #ifndef MAP_POPULATE
+            madvise(data, size, MADV_SEQUENTIAL);
+            madvise(data, size, MADV_WILLNEED);
+        #endif
+
+            m_Data = static_cast<uint8_t*>(data);
+            m_Size = size;
+
+            return true;
+        #else
+            XIL_UNUSED(path);
+            XIL_UNUSED(min_size);
+            return false;
+        #endif
+        }
+
+        void unmap() noexcept
+        {
+        #ifdef XIL_MMAP
+            if (m_Data)
+                munmap(m_Data, m_Size);
+        #endif
+
+            m_Data = nullptr;
+            m_Size = 0;
+        }
+
+        const uint8_t* data() const noexcept { return m_Data; }
+        size_t size() const noexcept { return m_Size; }
+        bool ok() const noexcept { return m_Data != nullptr; }
+
+        ~MappedFile()
+        {
+            unmap();
+        }
+    };
+
+    // Maps the file if 'allow_mapping' is set and it's at least 'min_mapped_size' bytes, reads it into memory otherwise.
+    // 'into' references 'mapping' in the first case so the mapping has to outlive it.
+    static inline void open_file(const std::string& path, DataStream& into, MappedFile& mapping,
+                                 bool allow_mapping = true, size_t min_mapped_size = 0)
+    {
+        if (allow_mapping && mapping.map(path, min_mapped_size))
+            into.init_with(const_cast<uint8_t*>(mapping.data()), mapping.size(), false);
+        else
+            read_file(path, into);
+    }
+
+    // Pull based input, lets the decoders consume a file while it's still arriving
+    // instead of requiring all of it to be in memory up front
+    class StreamReader
+    {
+    public:
+        // Writes up to 'size' bytes to 'to' and returns how many were written, 0 means end of input
+        using ReadCallback = std::function<size_t(void* to, size_t size)>;
+    private:
+        ReadCallback m_Read;
+        std::vector<uint8_t> m_Peeked;
+        size_t m_PeekedOffset;
+        size_t m_BytesRead;
+    public:
+        explicit StreamReader(ReadCallback read)
+            : m_Read(std::move(read)),
+            m_PeekedOffset(0),
+            m_BytesRead(0)
+        {
+        }
+
+        // 'stream' has to outlive the reader
+        explicit StreamReader(std::istream& stream)
+            : StreamReader([&stream](void* to, size_t size) -> size_t
+                {
+                    stream.read(static_cast<char*>(to), static_cast<std::streamsize>(size));
+                    return static_cast<size_t>(stream.gcount());
+                })
+        {
+        }
+
+        StreamReader(const StreamReader& other) = delete;
+        StreamReader& operator=(const StreamReader& other) = delete;
+
+        // Reads until either 'size' bytes have been read or the input is exhausted
+        size_t read(void* to, size_t size)
+        {
+            auto* out = static_cast<uint8_t*>(to);
+            size_t done = 0;
+
+            if (m_PeekedOffset < m_Peeked.size())
+            {
+                done = std::min(size, m_Peeked.size() - m_PeekedOffset);
+                XIL_MEMCPY(out, size, m_Peeked.data() + m_PeekedOffset, done);
+                m_PeekedOffset += done;
+            }
+
+            while (done < size)
+            {
+                size_t got = m_Read(out + done, size - done);
+
+                if (!got)
+                    break;
+
+                done += got;
+            }
+
+            m_BytesRead += done;
+
+            return done;
+        }
+
+        // Same as read() but the bytes are returned again by the next read
+        size_t peek(void* to, size_t size)
+        {
+            if (m_PeekedOffset == m_Peeked.size())
+            {
+                m_Peeked.clear();
+                m_PeekedOffset = 0;
+            }
+
+            size_t available = m_Peeked.size() - m_PeekedOffset;
+
+            if (available < size)
+            {
+                m_Peeked.resize(m_PeekedOffset + size);
+
+                size_t done = available;
+                while (done < size)
+                {
+                    size_t got = m_Read(m_Peeked.data() + m_PeekedOffset + done, size - done);
+
+                    if (!got)
+                        break;
+
+                    done += got;
+                }
+
+                m_Peeked.resize(m_PeekedOffset + done);
+                available = done;
+            }
+
+            size = std::min(size, available);
+            XIL_MEMCPY(to, size, m_Peeked.data() + m_PeekedOffset, size);
+
+            return size;
+        }
+
+        void get_n(size_t bytes, void* to)
+        {
+            if (read(to, bytes) != bytes)
+                throw std::runtime_error("Unexpected end of stream");
+        }
+
+        uint32_t get_u32_big()
+        {
+            uint8_t bytes[4];
+
+            get_n(sizeof(bytes), bytes);
+
+            return (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+        }
+
+        void skip_n(size_t bytes)
+        {
+            uint8_t scratch[4096];
+
+            while (bytes)
+            {
+                size_t now = std::min(bytes, sizeof(scratch));
+                get_n(now, scratch);
+                bytes -= now;
+            }
+        }
+
+        // Reads the next 'bytes' bytes into a stream that owns them
+        DataStream get_subset(size_t bytes)
+        {
+            DataStream subset(new uint8_t[bytes], bytes, true);
+
+            get_n(bytes, subset.data_ptr());
+
+            return subset;
+        }
+
+        // Reads everything that's left into a stream that owns it
+        DataStream get_rest()
+        {
+            size_t capacity = 64 * 1024;
+            size_t size = 0;
+            auto* data = new uint8_t[capacity];
+
+            for (;;)
+            {
+                if (size == capacity)
+                {
+                    size_t new_capacity = 0;
+                    uint8_t* grown = nullptr;
+
+                    try {
+                        new_capacity = checked_mul(capacity, 2);
+                        grown = new uint8_t[new_capacity];
+                    }
+                    catch (...)
+                    {
+                        delete[] data;
+                        throw;
+                    }
+
+                    XIL_MEMCPY(grown, new_capacity, data, size);
+                    delete[] data;
+
+                    data = grown;
+                    capacity = new_capacity;
+                }
+
+                size_t got = read(data + size, capacity - size);
+
+                if (!got)
+                    break;
+
+                size += got;
+            }
+
+            return DataStream(data, size, true);
+        }
+
+        size_t bytes_read() const
+        {
+            return m_BytesRead;
+        }
+    };
+
     class ChunkedBitReader
     {
     private:
@@ -280,6 +808,7 @@ namespace XIL {
         };
     private:
         std::vector<DataChunk> m_ChunkedData;
+        std::function<bool(ChunkedBitReader&)> m_ChunkProvider;
         size_t m_ActiveChunk;
         uint8_t m_CurrentBit;
         bool m_ReverseMode;
@@ -336,6 +865,28 @@ namespace XIL {
             m_ChunkedData.push_back({ static_cast<uint8_t*>(data), size, offset, grant_ownership });
         }
 
+        // 'provider' is called whenever the reader runs out of chunks, it should append more and return true,
+        // or return false if there's no more data. Consumed chunks are released right away in that mode.
+        void set_chunk_provider(std::function<bool(ChunkedBitReader&)> provider)
+        {
+            m_ChunkProvider = std::move(provider);
+        }
+
+        // Pulls chunks from the provider until there's at least one byte to read, returns false if there's none
+        bool fetch_first_chunk()
+        {
+            while (m_ChunkedData.size() == m_ActiveChunk || current_chunk().active_byte >= current_chunk().size)
+            {
+                if (m_ActiveChunk < m_ChunkedData.size())
+                    release_chunk(m_ChunkedData[m_ActiveChunk++]);
+
+                if (m_ChunkedData.size() == m_ActiveChunk && (!m_ChunkProvider || !m_ChunkProvider(*this)))
+                    return false;
+            }
+
+            return true;
+        }
+
         size_t bytes_left() const
         {
             size_t total = bytes_left_for_current_chunk();
@@ -483,11 +1034,8 @@ namespace XIL {
 
         ~ChunkedBitReader()
         {
-            for (const auto& chnk : m_ChunkedData)
-            {
-                if (chnk.should_be_deleted)
-                    delete[] chnk.data;
-            }
+            for (auto& chnk : m_ChunkedData)
+                release_chunk(chnk);
         }
 
     private:
@@ -513,15 +1061,45 @@ namespace XIL {
 
         void next_chunk()
         {
-            if (m_ChunkedData.size() - 1 == m_ActiveChunk)
-                throw std::runtime_error("Buffer overflow");
-            else
+            // nothing ever reads behind the current chunk, so its data can go right away
+            release_chunk(current_chunk());
+
+            for (;;)
             {
+                while (m_ChunkedData.size() - 1 == m_ActiveChunk)
+                {
+                    if (!m_ChunkProvider || !m_ChunkProvider(*this))
+                        throw std::runtime_error("Buffer overflow");
+                }
+
                 m_ActiveChunk++;
-                m_CurrentBit = 0;
+
+                if (current_chunk().active_byte < current_chunk().size)
+                    break;
+
+                // skip empty chunks
+                release_chunk(current_chunk());
+            }
+
+            m_CurrentBit = 0;
+
+            // keep the chunk list short for long streams
+            if (m_ChunkProvider)
+            {
+                m_ChunkedData.erase(m_ChunkedData.begin(), m_ChunkedData.begin() + m_ActiveChunk);
+                m_ActiveChunk = 0;
             }
         }
 
+        static void release_chunk(DataChunk& chnk) noexcept
+        {
+            if (chnk.should_be_deleted)
+                delete[] chnk.data;
+
+            chnk.data = nullptr;
+            chnk.should_be_deleted = false;
+        }
+
         uint8_t current_byte() const
         {
             return current_chunk().data[current_chunk().active_byte] >> m_CurrentBit;
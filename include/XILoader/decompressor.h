@@ -220,7 +220,8 @@ namespace XIL {
             int64_t count;
             auto next = &with_tree.lengths[1];
 
-            for (;;)
+            // incomplete trees from corrupt data can't decode every code
+            while (length < static_cast<int64_t>(HuffmanT::length_count()))
             {
                 code |= from.get_bits(1);
                 count = *next++;
@@ -232,6 +233,8 @@ namespace XIL {
                 code <<= 1;
                 length++;
             }
+
+            throw std::runtime_error("Invalid Huffman code");
         }
 
         template<typename HuffmanTL, typename HuffmanTD>
@@ -284,6 +287,8 @@ namespace XIL {
                     length = static_cast<size_t>(length_base[symbol]) + from.get_bits(extra_len_bits);
 
                     symbol = decode_one(from, distance_tree);
+                    if (symbol >= 30)
+                        throw std::runtime_error("Distance symbol is outside of [30] range");
 
                     auto extra_dist_bits = static_cast<uint8_t>(distance_extra[symbol]);
                     distance = static_cast<size_t>(distance_base[symbol]) + from.get_bits(extra_dist_bits);
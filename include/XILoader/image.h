@@ -1,9 +1,16 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <algorithm>
 
 #include "utils.h"
+#include "buffer_pool.h"
+#include "memory_resource.h"
+#include "image_view.h"
+#include "transform.h"
+#include "mipmap.h"
+#include "resize.h"
 
 namespace XIL {
 
@@ -17,20 +24,100 @@ namespace XIL {
         basic_ImageData()
             : width(0),
             height(0),
-            channels(0)
+            pitch(0),
+            channels(0),
+            premultiplied(false)
         {
         }
 
         Container data;
         size_t    width;
         size_t    height;
+        size_t    pitch; // distance between two rows in bytes
         uint8_t   channels;
+        bool      premultiplied;
 
         const Element* data_ptr() const noexcept { return data.data(); }
               Element* data_ptr()       noexcept { return data.data(); }
+
+        const Element* row(size_t y) const noexcept { return data_ptr() + y * pitch; }
+              Element* row(size_t y)       noexcept { return data_ptr() + y * pitch; }
+
+        // bytes taken by the pixels of a row, the rest of the pitch is padding
+        size_t row_size() const noexcept { return width * channels; }
+
+        // Zeroes the padding at the end of every row
+        void clear_padding() noexcept
+        {
+            size_t padding = pitch - row_size();
+
+            if (!padding)
+                return;
+
+            for (size_t y = 0; y < height; y++)
+                memset(row(y) + row_size(), 0, padding);
+        }
+    };
+    using ImageData = basic_ImageData<uint8_t, PixelContainer>;
+
+    struct LoadOptions
+    {
+        // flip the image vertically
+        bool flip = false;
+
+        // multiply the color channels by alpha while decoding,
+        // has no effect on images without an alpha channel
+        bool premultiply_alpha = false;
+
+        // map files passed by path into memory instead of reading them, falls back to reading
+        // if the file can't be mapped. Off by default: a file truncated by another process
+        // while it's mapped raises SIGBUS instead of failing the load, only map files nothing
+        // else writes to.
+        bool memory_map = false;
+
+        // files smaller than this are read even if 'memory_map' is set,
+        // copying them is cheaper than setting up and faulting in a mapping
+        size_t memory_map_min_size = 4 * 1024 * 1024;
+
+        // rows of the decoded image start at multiples of this many bytes (4, 16, 64...),
+        // has to be a power of 2. Rows are tightly packed by default, alignments above 16
+        // also need an aligned memory resource for the first row to be aligned.
+        size_t row_alignment = 1;
+
+        // pixel buffers are drawn from this pool and returned to it when the image is
+        // destroyed, every image allocates its own storage if there is no pool
+        std::shared_ptr<BufferPool> buffer_pool;
+
+        // build the mip chain right after decoding, see Image::mipmaps()
+        bool generate_mipmaps = false;
+        MipOptions mipmap_options;
+
+    #ifdef XIL_PMR
+        // pixel storage is allocated from this resource, nullptr for the default resource,
+        // it has to outlive the images and any buffer pool they return their storage to
+        PixelResource* memory_resource = nullptr;
+    #endif
+
+        // distance between the rows of an image whose pixels take 'row_size' bytes per row
+        size_t pitch_for(size_t row_size) const
+        {
+            if (!row_alignment || (row_alignment & (row_alignment - 1)))
+                throw std::runtime_error("The row alignment has to be a power of 2");
+
+            return checked_add(row_size, row_alignment - 1) & ~(row_alignment - 1);
+        }
+
+        PixelResource* pixel_resource() const noexcept
+        {
+        #ifdef XIL_PMR
+            return memory_resource;
+        #else
+            return nullptr;
+        #endif
+        }
     };
-    using ImageData = basic_ImageData<uint8_t, std::vector<uint8_t>>;
 
+    // image[x][y] style access, prefer Image::row() and Image::view()
     class ImageViewer
     {
     private:
@@ -44,17 +131,7 @@ namespace XIL {
     public:
         uint8_t* at_y(size_t y)
         {
-            if (y >= m_Image.height)
-                throw std::runtime_error("The 'y' coordinate exceeded image height");
-
-            if (m_AtX >= m_Image.width)
-                throw std::runtime_error("The 'x' coordinate exceeded image width");
-
-            size_t pixel_loc = m_Image.width * y;
-            pixel_loc += m_AtX ? m_AtX + 1 : m_AtX;
-            pixel_loc *= m_Image.channels;
-
-            return &m_Image.data[pixel_loc];
+            return ImageView(m_Image.data_ptr(), m_Image.width, m_Image.height, m_Image.pitch, m_Image.channels).at(m_AtX, y);
         }
 
         uint8_t* operator[](size_t y)
@@ -87,12 +164,46 @@ namespace XIL {
         friend class PNG;
     private:
         ImageData m_Image;
+
+        // the levels below the image, if generated
+        MipChain m_Mips;
+
+        // where the storage goes back to on destruction, if anywhere
+        std::shared_ptr<BufferPool> m_Pool;
     public:
         Image() = default;
-        Image(Image&& other) = default;
-        Image& operator=(Image&& other) = default;
         Image(const Image& other) = delete;
         Image& operator=(const Image& other) = delete;
+
+        // the moved from image is left empty
+        Image(Image&& other) noexcept
+            : m_Image(std::move(other.m_Image)),
+            m_Mips(std::move(other.m_Mips)),
+            m_Pool(std::move(other.m_Pool))
+        {
+            other.m_Image = ImageData();
+            other.m_Mips = MipChain();
+        }
+
+        Image& operator=(Image&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release_storage();
+                m_Image = std::move(other.m_Image);
+                m_Mips = std::move(other.m_Mips);
+                m_Pool = std::move(other.m_Pool);
+                other.m_Image = ImageData();
+                other.m_Mips = MipChain();
+            }
+
+            return *this;
+        }
+
+        ~Image()
+        {
+            release_storage();
+        }
     public:
         uint8_t* data() noexcept
         {
@@ -121,6 +232,12 @@ namespace XIL {
             return width() && height();
         }
 
+        // true if the color channels have been multiplied by alpha
+        bool premultiplied() const noexcept
+        {
+            return m_Image.premultiplied;
+        }
+
         operator bool() const noexcept
         {
             return ok();
@@ -136,9 +253,69 @@ namespace XIL {
             return m_Image.height;
         }
 
+        // distance between two rows in bytes, width() * channels() unless
+        // a row alignment was requested while loading
+        size_t pitch() const noexcept
+        {
+            return m_Image.pitch;
+        }
+
+        // The pixels of row 'y', throws if 'y' is outside of the image
+        PixelRow row(size_t y)
+        {
+            return view().row(y);
+        }
+
+        ConstPixelRow row(size_t y) const
+        {
+            return view().row(y);
+        }
+
+        PixelRow row_unchecked(size_t y) noexcept
+        {
+            return view().row_unchecked(y);
+        }
+
+        ConstPixelRow row_unchecked(size_t y) const noexcept
+        {
+            return view().row_unchecked(y);
+        }
+
+        ImageView view() noexcept
+        {
+            return ImageView(data(), width(), height(), pitch(), m_Image.channels);
+        }
+
+        ConstImageView view() const noexcept
+        {
+            return ConstImageView(data(), width(), height(), pitch(), m_Image.channels);
+        }
+
+        // The 'width' x 'height' rectangle at 'x', 'y' without copying it,
+        // throws if it doesn't fit into the image
+        ImageView view(size_t x, size_t y, size_t width, size_t height)
+        {
+            return view().view(x, y, width, height);
+        }
+
+        ConstImageView view(size_t x, size_t y, size_t width, size_t height) const
+        {
+            return view().view(x, y, width, height);
+        }
+
+        ImageView view_unchecked(size_t x, size_t y, size_t width, size_t height) noexcept
+        {
+            return view().view_unchecked(x, y, width, height);
+        }
+
+        ConstImageView view_unchecked(size_t x, size_t y, size_t width, size_t height) const noexcept
+        {
+            return view().view_unchecked(x, y, width, height);
+        }
+
         size_t size() const noexcept
         {
-            return width() * height() * channels();
+            return pitch() * height();
         }
 
         ImageViewer at_x(size_t x)
@@ -173,17 +350,297 @@ namespace XIL {
         }
         #endif
 
+        // Deep copy with the same layout, drawing its storage from the same pool and memory resource
+        Image clone() const
+        {
+            Image copy;
+            copy.m_Pool = m_Pool;
+
+            if (!ok())
+                return copy;
+
+            copy.m_Image.width = m_Image.width;
+            copy.m_Image.height = m_Image.height;
+            copy.m_Image.pitch = m_Image.pitch;
+            copy.m_Image.channels = m_Image.channels;
+            copy.m_Image.premultiplied = m_Image.premultiplied;
+
+            copy.m_Image.data = BufferPool::acquire(m_Pool.get(), size(), storage_resource());
+            resize_uninitialized(copy.m_Image.data, size());
+            memcpy(copy.m_Image.data_ptr(), m_Image.data_ptr(), size());
+
+            if (!m_Mips.empty())
+            {
+                copy.m_Mips.m_Levels = m_Mips.m_Levels;
+                copy.m_Mips.m_Channels = m_Mips.m_Channels;
+                copy.m_Mips.m_Data = BufferPool::acquire(m_Pool.get(), m_Mips.size(), storage_resource());
+                resize_uninitialized(copy.m_Mips.m_Data, m_Mips.size());
+                memcpy(copy.m_Mips.m_Data.data(), m_Mips.data(), m_Mips.size());
+            }
+
+            return copy;
+        }
+
+        // The levels below the image, empty unless generated. Changing the
+        // pixels doesn't update them, and flipping or rotating drops them.
+        const MipChain& mipmaps() const noexcept
+        {
+            return m_Mips;
+        }
+
+        // Replaces the mip chain, its storage comes from the image's pool and memory resource
+        void generate_mipmaps(const MipOptions& options = {})
+        {
+            drop_mipmaps();
+
+            if (ok())
+                m_Mips = Mipmap::generate(view(), options, m_Pool.get(), storage_resource());
+        }
+
         void flip()
         {
-            if (width() < 2 || !ok()) return;
+            if (!ok()) return;
+
+            drop_mipmaps();
+
+            auto pixels = view();
 
             for (size_t y = 0; y < height() / 2; y++)
             {
-                std::swap_ranges(
-                    at_x(0).at_y(y),
-                    at_x(width() - 1).at_y(y),
-                    at_x(0).at_y(height() - y - 1));
+                auto* top = pixels.row_unchecked(y).data();
+                std::swap_ranges(top, top + pitch(), pixels.row_unchecked(height() - y - 1).data());
             }
         }
+
+        // Mirrors the image horizontally
+        void flip_horizontal()
+        {
+            if (!ok()) return;
+
+            drop_mipmaps();
+
+            auto pixels = view();
+            std::vector<uint8_t> scratch(m_Image.row_size());
+
+            for (size_t y = 0; y < height(); y++)
+            {
+                auto* row = pixels.row_unchecked(y).data();
+
+                memcpy(scratch.data(), row, scratch.size());
+                Transform::reverse_row(row, scratch.data(), width(), m_Image.channels);
+            }
+        }
+
+        void rotate_180()
+        {
+            if (!ok()) return;
+
+            drop_mipmaps();
+
+            auto pixels = view();
+            std::vector<uint8_t> scratch(m_Image.row_size());
+
+            for (size_t y = 0; y < (height() + 1) / 2; y++)
+            {
+                auto* top = pixels.row_unchecked(y).data();
+                auto* bottom = pixels.row_unchecked(height() - y - 1).data();
+
+                memcpy(scratch.data(), top, scratch.size());
+
+                if (top != bottom)
+                    Transform::reverse_row(top, bottom, width(), m_Image.channels);
+
+                Transform::reverse_row(bottom, scratch.data(), width(), m_Image.channels);
+            }
+        }
+
+        // The following swap width and height and move the pixels into new storage,
+        // whose rows are tightly packed regardless of the row alignment the image was loaded with
+
+        // Clockwise
+        void rotate_90()
+        {
+            reorient(&Transform::rotate_90);
+        }
+
+        void rotate_270()
+        {
+            reorient(&Transform::rotate_270);
+        }
+
+        // Mirrors the image along its main diagonal
+        void transpose()
+        {
+            reorient(&Transform::transpose);
+        }
+
+        // Resamples the image to 'width' x 'height' in new, tightly packed storage and drops the mip chain.
+        // Premultiplied images are filtered as they are, without weighting by alpha again.
+        void resize(size_t width, size_t height, const ResizeOptions& options = {})
+        {
+            if (!width || !height)
+                throw std::runtime_error("Can't resize to an empty image");
+
+            ResizeOptions resampling = options;
+            resampling.alpha_weighted = options.alpha_weighted && !premultiplied();
+
+            replace_pixels(width, height, [&](ConstImageView src, ImageView dst) { Resampler::resize(src, dst, resampling); });
+        }
+    private:
+        void reorient(void (*transform)(ConstImageView, ImageView))
+        {
+            replace_pixels(height(), width(), transform);
+        }
+
+        // Fills new storage of the given size from the current pixels and replaces them with it
+        template<typename Fn>
+        void replace_pixels(size_t width, size_t height, Fn&& fill)
+        {
+            if (!ok()) return;
+
+            ImageData replaced;
+            replaced.width = width;
+            replaced.height = height;
+            replaced.channels = m_Image.channels;
+            replaced.premultiplied = m_Image.premultiplied;
+            replaced.pitch = checked_mul(width, m_Image.channels);
+
+            size_t size = checked_mul(replaced.pitch, replaced.height);
+            replaced.data = BufferPool::acquire(m_Pool.get(), size, storage_resource());
+            resize_uninitialized(replaced.data, size);
+
+            fill(view(), ImageView(replaced.data_ptr(), replaced.width, replaced.height, replaced.pitch, replaced.channels));
+
+            release_storage();
+            m_Mips = MipChain();
+            m_Image = std::move(replaced);
+        }
+
+        PixelResource* storage_resource() const noexcept
+        {
+        #ifdef XIL_PMR
+            return m_Image.data.get_allocator().resource();
+        #else
+            return nullptr;
+        #endif
+        }
+
+        void drop_mipmaps() noexcept
+        {
+            BufferPool::release(m_Pool.get(), std::move(m_Mips.m_Data));
+            m_Mips = MipChain();
+        }
+
+        void release_storage() noexcept
+        {
+            BufferPool::release(m_Pool.get(), std::move(m_Image.data));
+            BufferPool::release(m_Pool.get(), std::move(m_Mips.m_Data));
+        }
+    };
+
+    // Non-owning image that references pixels stored elsewhere
+    // (a caller provided buffer or a mapped file) which have to outlive it
+    class BorrowedImage
+    {
+    public:
+        enum class Order
+        {
+            RGBA = 0,
+            BGRA = 1
+        };
+
+        friend class BMP;
+    private:
+        const uint8_t* m_Data;
+        size_t         m_Width;
+        size_t         m_Height;
+        size_t         m_Pitch;
+        uint8_t        m_Channels;
+        Order          m_Order;
+    public:
+        BorrowedImage() noexcept
+            : m_Data(nullptr),
+            m_Width(0),
+            m_Height(0),
+            m_Pitch(0),
+            m_Channels(0),
+            m_Order(Order::RGBA)
+        {
+        }
+    public:
+        const uint8_t* data() const noexcept
+        {
+            return ok() ? m_Data : nullptr;
+        }
+
+        // The pixels of row 'y' (top to bottom), throws if 'y' is outside of the image
+        ConstPixelRow row(size_t y) const
+        {
+            return view().row(y);
+        }
+
+        ConstPixelRow row_unchecked(size_t y) const noexcept
+        {
+            return view().row_unchecked(y);
+        }
+
+        ConstImageView view() const noexcept
+        {
+            return ConstImageView(data(), width(), height(), pitch(), m_Channels);
+        }
+
+        ConstImageView view(size_t x, size_t y, size_t width, size_t height) const
+        {
+            return view().view(x, y, width, height);
+        }
+
+        #ifdef _MSVC_LANG
+            #pragma warning(push)
+            #pragma warning(disable:26812) // unscoped enum is intended here
+        #endif
+        Image::Format channels() const noexcept
+        {
+            return static_cast<Image::Format>(m_Channels);
+        }
+        #ifdef _MSVC_LANG
+            #pragma warning(pop)
+        #endif
+
+        // order of the color channels in memory
+        Order order() const noexcept
+        {
+            return m_Order;
+        }
+
+        bool ok() const noexcept
+        {
+            return width() && height();
+        }
+
+        operator bool() const noexcept
+        {
+            return ok();
+        }
+
+        size_t width() const noexcept
+        {
+            return m_Width;
+        }
+
+        size_t height() const noexcept
+        {
+            return m_Height;
+        }
+
+        // distance between two rows in bytes
+        size_t pitch() const noexcept
+        {
+            return m_Pitch;
+        }
+
+        size_t size() const noexcept
+        {
+            return pitch() * height();
+        }
     };
 }
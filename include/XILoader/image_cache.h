@@ -0,0 +1,445 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <future>
+#include <memory>
+#include <cstring>
+#include <unordered_map>
+
+#include "XILoader.h"
+
+#ifdef _WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+#endif
+
+namespace XIL {
+
+    struct CacheStats
+    {
+        size_t hits;      // served from the cache
+        size_t misses;    // decoded, including the ones that failed
+        size_t coalesced; // waited for another thread decoding the same image instead of decoding it again
+        size_t evictions;
+        size_t entries;
+        size_t bytes;     // taken by the pixels and mip chains of the cached images
+    };
+
+    // Decoded images in front of Loader, keyed by path and modification time or by a hash of the encoded bytes.
+    // The handles share the pixels with the cache, mutating one copies them first (see SharedImage).
+    // The least recently used images are evicted once the cached ones take more than the budget,
+    // pixels still referenced by a handle stay alive until the handle lets go of them.
+    // The keys are spread over shards with a lock each, so lookups of different images rarely contend,
+    // and an image missed by several threads at once is decoded by the first one while the others wait.
+    class ImageCache
+    {
+    private:
+        struct Entry
+        {
+            std::string key;
+            SharedImage image;
+            std::vector<uint8_t> source; // the encoded bytes of load_raw images, the key is only a hash of them
+            size_t bytes = 0;
+            uint64_t last_used = 0;
+        };
+
+        struct Loading
+        {
+            std::shared_future<SharedImage> image;
+
+            // the encoded bytes of load_raw images, alive until the entry is erased
+            const void* data;
+            size_t size;
+        };
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::list<Entry> entries; // most recently used first
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+            std::unordered_map<std::string, Loading> loading;
+        };
+
+        std::vector<std::unique_ptr<Shard>> m_Shards;
+        LoadOptions m_Options;
+        size_t m_Budget;
+
+        std::atomic<size_t> m_Bytes;
+        std::atomic<uint64_t> m_Clock;
+
+        std::atomic<size_t> m_Hits;
+        std::atomic<size_t> m_Misses;
+        std::atomic<size_t> m_Coalesced;
+        std::atomic<size_t> m_Evictions;
+        std::atomic<size_t> m_Entries;
+    public:
+        // Every image is decoded with 'options', images larger than 'budget' bytes are returned without being cached
+        explicit ImageCache(size_t budget, const LoadOptions& options = {}, size_t shards = 16)
+            : m_Options(options),
+            m_Budget(budget),
+            m_Bytes(0),
+            m_Clock(0),
+            m_Hits(0),
+            m_Misses(0),
+            m_Coalesced(0),
+            m_Evictions(0),
+            m_Entries(0)
+        {
+            if (!shards)
+                shards = 1;
+
+            m_Shards.reserve(shards);
+
+            for (size_t i = 0; i < shards; i++)
+                m_Shards.emplace_back(new Shard());
+        }
+
+        ImageCache(const ImageCache&) = delete;
+        ImageCache& operator=(const ImageCache&) = delete;
+
+        SharedImage load(const std::string& path)
+        {
+            try {
+                return load_verbose(path);
+            }
+            catch (const std::exception&) // suppress any exceptions
+            {
+                return {};
+            }
+        }
+
+        // Any exceptions encountered during the process of loading are rethrown to the caller,
+        // including to the threads that waited for the same image. Failures aren't cached.
+        SharedImage load_verbose(const std::string& path)
+        {
+            std::string key;
+
+            if (!path_key(path, key))
+            {
+                m_Misses++;
+                return Loader::load_verbose(path, m_Options);
+            }
+
+            return get(key, [&]() { return Loader::load_verbose(path, m_Options); });
+        }
+
+        // Hashes all of 'data' on every call and compares it to the cached copy on a hit, so inputs crafted
+        // to collide can't be served each other's image. The bytes don't have to outlive the call.
+        SharedImage load_raw(const void* data, size_t size)
+        {
+            try {
+                return load_raw_verbose(data, size);
+            }
+            catch (const std::exception&) // suppress any exceptions
+            {
+                return {};
+            }
+        }
+
+        // Any exceptions encountered during the process of loading are rethrown to the caller
+        SharedImage load_raw_verbose(const void* data, size_t size)
+        {
+            // can't start like a path key, paths don't start with a null
+            uint64_t stamp[2] = { content_hash(data, size), static_cast<uint64_t>(size) };
+            std::string key(1, '\0');
+            key.append(reinterpret_cast<const char*>(stamp), sizeof(stamp));
+
+            return get(key, [&]() { return Loader::load_raw_verbose(const_cast<void*>(data), size, m_Options); }, data, size);
+        }
+
+        // Drops every cached image, images being decoded are cached once they're done
+        void clear()
+        {
+            for (auto& shard : m_Shards)
+            {
+                std::list<Entry> dropped;
+
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+                    dropped.swap(shard->entries);
+                    shard->index.clear();
+                }
+
+                for (const auto& entry : dropped)
+                {
+                    m_Bytes -= entry.bytes;
+                    m_Entries--;
+                }
+            }
+        }
+
+        size_t budget() const noexcept
+        {
+            return m_Budget;
+        }
+
+        // the counters are read one by one, they may be slightly off each other while other threads load
+        CacheStats stats() const noexcept
+        {
+            return { m_Hits.load(), m_Misses.load(), m_Coalesced.load(), m_Evictions.load(), m_Entries.load(), m_Bytes.load() };
+        }
+
+    private:
+        // 'data' and 'size' are the encoded bytes behind a key that is only their hash, a hit or a pending load
+        // of different bytes is a miss that isn't cached
+        template<typename Decode>
+        SharedImage get(const std::string& key, Decode&& decode, const void* data = nullptr, size_t size = 0)
+        {
+            auto& shard = *m_Shards[std::hash<std::string>()(key) % m_Shards.size()];
+
+            std::promise<SharedImage> promise;
+            std::shared_future<SharedImage> pending;
+            bool collided = false;
+
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto found = shard.index.find(key);
+
+                if (found != shard.index.end() && same_source(found->second->source.data(), found->second->source.size(), data, size))
+                {
+                    shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+                    found->second->last_used = m_Clock.fetch_add(1, std::memory_order_relaxed);
+                    m_Hits++;
+
+                    return found->second->image;
+                }
+
+                auto loading = shard.loading.find(key);
+
+                if (found != shard.index.end() || (loading != shard.loading.end() && !same_source(loading->second.data, loading->second.size, data, size)))
+                {
+                    collided = true;
+                }
+                else if (loading != shard.loading.end())
+                {
+                    pending = loading->second.image;
+                }
+                else
+                {
+                    shard.loading.emplace(key, Loading{ promise.get_future().share(), data, size });
+                }
+            }
+
+            // the key belongs to other bytes, decode these without caching them
+            if (collided)
+            {
+                m_Misses++;
+                return SharedImage(decode());
+            }
+
+            if (pending.valid())
+            {
+                m_Coalesced++;
+                return pending.get();
+            }
+
+            m_Misses++;
+            SharedImage image;
+
+            try {
+                image = SharedImage(decode());
+            }
+            catch (...)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    shard.loading.erase(key);
+                }
+
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+
+            size_t bytes = image->size() + image->mipmaps().size() + size;
+            bool cached = image && bytes <= m_Budget;
+            std::vector<uint8_t> source;
+
+            if (cached && data)
+            {
+                try {
+                    source.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+                }
+                catch (const std::bad_alloc&) // served without being cached
+                {
+                    cached = false;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.loading.erase(key);
+
+                // counted under the lock, before another thread can evict it
+                if (cached)
+                {
+                    shard.entries.push_front({ key, image, std::move(source), bytes, m_Clock.fetch_add(1, std::memory_order_relaxed) });
+                    shard.index.emplace(key, shard.entries.begin());
+                    m_Bytes += bytes;
+                    m_Entries++;
+                }
+            }
+
+            promise.set_value(image);
+
+            if (cached)
+                evict();
+
+            return image;
+        }
+
+        // Evicts the least recently used images across all the shards until the cache fits the budget,
+        // holding one lock at a time
+        void evict()
+        {
+            while (m_Bytes.load() > m_Budget)
+            {
+                Shard* oldest = nullptr;
+                uint64_t oldest_use = 0;
+
+                for (auto& shard : m_Shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+
+                    if (!shard->entries.empty() && (!oldest || shard->entries.back().last_used < oldest_use))
+                    {
+                        oldest = shard.get();
+                        oldest_use = shard->entries.back().last_used;
+                    }
+                }
+
+                if (!oldest)
+                    return;
+
+                // the pixels are freed outside the lock
+                Entry evicted;
+
+                {
+                    std::lock_guard<std::mutex> lock(oldest->mutex);
+
+                    if (oldest->entries.empty())
+                        continue;
+
+                    evicted = std::move(oldest->entries.back());
+                    oldest->index.erase(evicted.key);
+                    oldest->entries.pop_back();
+                }
+
+                m_Bytes -= evicted.bytes;
+                m_Entries--;
+                m_Evictions++;
+            }
+        }
+
+        static bool same_source(const void* cached, size_t cached_size, const void* data, size_t size) noexcept
+        {
+            return cached_size == size && (!size || !memcmp(cached, data, size));
+        }
+
+        // The path followed by the modification time and size of the file, a file rewritten in place
+        // gets a new key and its old image ages out of the cache. False if the file can't be stat'ed.
+        static bool path_key(const std::string& path, std::string& key)
+        {
+            uint64_t stamp[2];
+
+        #if defined(XIL_POSIX)
+            struct stat info;
+
+            if (stat(path.c_str(), &info))
+                return false;
+
+            #if defined(__APPLE__)
+                stamp[0] = static_cast<uint64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+            #elif defined(__linux__)
+                stamp[0] = static_cast<uint64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+            #else
+                stamp[0] = static_cast<uint64_t>(info.st_mtime);
+            #endif
+        #elif defined(_WIN32)
+            struct _stat64 info;
+
+            if (_stat64(path.c_str(), &info))
+                return false;
+
+            stamp[0] = static_cast<uint64_t>(info.st_mtime);
+        #else
+            return false;
+        #endif
+
+            stamp[1] = static_cast<uint64_t>(info.st_size);
+
+            key = path;
+            key.push_back('\0');
+            key.append(reinterpret_cast<const char*>(stamp), sizeof(stamp));
+
+            return true;
+        }
+
+        static uint64_t rotate_left(uint64_t value, int by) noexcept
+        {
+            return (value << by) | (value >> (64 - by));
+        }
+
+        static uint64_t hash_round(uint64_t acc, uint64_t input) noexcept
+        {
+            return rotate_left(acc + input * 14029467366897019727ull, 31) * 11400714785074694791ull;
+        }
+
+        static uint64_t read_word(const uint8_t* at) noexcept
+        {
+            uint64_t word;
+            memcpy(&word, at, sizeof(word));
+
+            return word;
+        }
+
+        // 64 bit hash built from the rounds of xxHash64, several GB/s with four independent lanes.
+        // Good against accidental collisions, not against inputs crafted to collide, which same_source catches.
+        static uint64_t content_hash(const void* data, size_t size) noexcept
+        {
+            const uint64_t prime1 = 11400714785074694791ull;
+            const uint64_t prime2 = 14029467366897019727ull;
+            const uint64_t prime3 = 1609587929392839161ull;
+            const uint64_t prime4 = 9650029242287828579ull;
+            const uint64_t prime5 = 2870177450012600261ull;
+
+            auto* at = static_cast<const uint8_t*>(data);
+            auto* end = at + size;
+            uint64_t hash = prime5;
+
+            if (size >= 32)
+            {
+                uint64_t lanes[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+
+                for (; end - at >= 32; at += 32)
+                    for (int i = 0; i < 4; i++)
+                        lanes[i] = hash_round(lanes[i], read_word(at + i * 8));
+
+                hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+
+                for (int i = 0; i < 4; i++)
+                    hash = (hash ^ hash_round(0, lanes[i])) * prime1 + prime4;
+            }
+
+            hash += size;
+
+            for (; end - at >= 8; at += 8)
+                hash = rotate_left(hash ^ hash_round(0, read_word(at)), 27) * prime1 + prime4;
+
+            for (; at < end; at++)
+                hash = rotate_left(hash ^ (*at * prime5), 11) * prime1;
+
+            hash ^= hash >> 33;
+            hash *= prime2;
+            hash ^= hash >> 29;
+            hash *= prime3;
+            hash ^= hash >> 32;
+
+            return hash;
+        }
+    };
+}
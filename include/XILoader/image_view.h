@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <assert.h>
+
+#include "utils.h"
+
+namespace XIL {
+
+    // Random access iterator over the pixels of a row, dereferences to a pointer to the
+    // first channel of the pixel. It's just a pointer and a stride, so loops over it
+    // compile down to the same code as indexing the row by hand.
+    template<typename T>
+    class basic_PixelIterator
+    {
+    private:
+        T*     m_Pixel;
+        size_t m_Stride;
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = T*;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = T**;
+        using reference         = T*;
+
+        basic_PixelIterator() noexcept
+            : m_Pixel(nullptr),
+            m_Stride(0)
+        {
+        }
+
+        basic_PixelIterator(T* pixel, size_t stride) noexcept
+            : m_Pixel(pixel),
+            m_Stride(stride)
+        {
+        }
+
+        T* operator*() const noexcept { return m_Pixel; }
+        T* operator[](difference_type n) const noexcept { return m_Pixel + n * static_cast<difference_type>(m_Stride); }
+
+        basic_PixelIterator& operator++() noexcept { m_Pixel += m_Stride; return *this; }
+        basic_PixelIterator& operator--() noexcept { m_Pixel -= m_Stride; return *this; }
+        basic_PixelIterator operator++(int) noexcept { auto it = *this; ++*this; return it; }
+        basic_PixelIterator operator--(int) noexcept { auto it = *this; --*this; return it; }
+
+        basic_PixelIterator& operator+=(difference_type n) noexcept { m_Pixel += n * static_cast<difference_type>(m_Stride); return *this; }
+        basic_PixelIterator& operator-=(difference_type n) noexcept { m_Pixel -= n * static_cast<difference_type>(m_Stride); return *this; }
+
+        friend basic_PixelIterator operator+(basic_PixelIterator it, difference_type n) noexcept { return it += n; }
+        friend basic_PixelIterator operator+(difference_type n, basic_PixelIterator it) noexcept { return it += n; }
+        friend basic_PixelIterator operator-(basic_PixelIterator it, difference_type n) noexcept { return it -= n; }
+
+        friend difference_type operator-(const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept
+        {
+            return (l.m_Pixel - r.m_Pixel) / static_cast<difference_type>(l.m_Stride);
+        }
+
+        friend bool operator==(const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel == r.m_Pixel; }
+        friend bool operator!=(const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel != r.m_Pixel; }
+        friend bool operator< (const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel <  r.m_Pixel; }
+        friend bool operator> (const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel >  r.m_Pixel; }
+        friend bool operator<=(const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel <= r.m_Pixel; }
+        friend bool operator>=(const basic_PixelIterator& l, const basic_PixelIterator& r) noexcept { return l.m_Pixel >= r.m_Pixel; }
+    };
+
+    // Non-owning span over the pixels of a single row,
+    // operator[] is unchecked while at() throws for pixels outside of the row
+    template<typename T>
+    class basic_PixelRow
+    {
+    private:
+        T*      m_Data;
+        size_t  m_Width;
+        uint8_t m_Channels;
+    public:
+        using iterator = basic_PixelIterator<T>;
+
+        basic_PixelRow() noexcept
+            : m_Data(nullptr),
+            m_Width(0),
+            m_Channels(0)
+        {
+        }
+
+        basic_PixelRow(T* data, size_t width, uint8_t channels) noexcept
+            : m_Data(data),
+            m_Width(width),
+            m_Channels(channels)
+        {
+        }
+
+        // a mutable row can be used where a read only one is expected
+        template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+        basic_PixelRow(const basic_PixelRow<U>& other) noexcept
+            : m_Data(other.data()),
+            m_Width(other.width()),
+            m_Channels(other.channels())
+        {
+        }
+
+        T*      data()     const noexcept { return m_Data; }
+        size_t  width()    const noexcept { return m_Width; }
+        uint8_t channels() const noexcept { return m_Channels; }
+        bool    empty()    const noexcept { return !m_Width; }
+
+        // bytes taken by the pixels, without any padding
+        size_t size() const noexcept { return m_Width * m_Channels; }
+
+        T* operator[](size_t x) const noexcept
+        {
+            assert(x < m_Width);
+            return m_Data + x * m_Channels;
+        }
+
+        T* at(size_t x) const
+        {
+            if (x >= m_Width)
+                throw std::runtime_error("The 'x' coordinate exceeded image width");
+
+            return (*this)[x];
+        }
+
+        iterator begin() const noexcept { return iterator(m_Data, m_Channels); }
+        iterator end()   const noexcept { return iterator(m_Data + size(), m_Channels); }
+    };
+
+    using PixelRow      = basic_PixelRow<uint8_t>;
+    using ConstPixelRow = basic_PixelRow<const uint8_t>;
+
+    // Non-owning 2D view over a rectangle of pixels whose rows are 'pitch' bytes apart,
+    // sub-views reference the same pixels so cutting sprites out of a sheet copies nothing.
+    // The unchecked variants only assert, the checked ones throw std::runtime_error.
+    template<typename T>
+    class basic_ImageView
+    {
+    private:
+        T*      m_Data;
+        size_t  m_Width;
+        size_t  m_Height;
+        size_t  m_Pitch;
+        uint8_t m_Channels;
+    public:
+        using row_type = basic_PixelRow<T>;
+
+        // Iterates the rows of the view top to bottom
+        class iterator
+        {
+        private:
+            T*      m_Data;
+            size_t  m_Y;
+            size_t  m_Width;
+            size_t  m_Pitch;
+            uint8_t m_Channels;
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = row_type;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = void;
+            using reference         = row_type;
+
+            iterator(const basic_ImageView& view, size_t y) noexcept
+                : m_Data(view.data()),
+                m_Y(y),
+                m_Width(view.width()),
+                m_Pitch(view.pitch()),
+                m_Channels(view.channels())
+            {
+            }
+
+            row_type operator*() const noexcept { return row_type(m_Data + m_Y * m_Pitch, m_Width, m_Channels); }
+
+            iterator& operator++() noexcept { m_Y++; return *this; }
+            iterator operator++(int) noexcept { auto it = *this; ++*this; return it; }
+
+            bool operator==(const iterator& other) const noexcept { return m_Y == other.m_Y; }
+            bool operator!=(const iterator& other) const noexcept { return m_Y != other.m_Y; }
+        };
+
+        basic_ImageView() noexcept
+            : m_Data(nullptr),
+            m_Width(0),
+            m_Height(0),
+            m_Pitch(0),
+            m_Channels(0)
+        {
+        }
+
+        basic_ImageView(T* data, size_t width, size_t height, size_t pitch, uint8_t channels) noexcept
+            : m_Data(data),
+            m_Width(width),
+            m_Height(height),
+            m_Pitch(pitch),
+            m_Channels(channels)
+        {
+        }
+
+        template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+        basic_ImageView(const basic_ImageView<U>& other) noexcept
+            : m_Data(other.data()),
+            m_Width(other.width()),
+            m_Height(other.height()),
+            m_Pitch(other.pitch()),
+            m_Channels(other.channels())
+        {
+        }
+
+        T*      data()     const noexcept { return m_Data; }
+        size_t  width()    const noexcept { return m_Width; }
+        size_t  height()   const noexcept { return m_Height; }
+        size_t  pitch()    const noexcept { return m_Pitch; }
+        uint8_t channels() const noexcept { return m_Channels; }
+        bool    empty()    const noexcept { return !m_Width || !m_Height; }
+
+        // true if the rows follow each other without any gaps,
+        // so the whole view can be processed as a single run of width() * height() pixels
+        bool contiguous() const noexcept { return m_Pitch == m_Width * m_Channels; }
+
+        row_type row_unchecked(size_t y) const noexcept
+        {
+            assert(y < m_Height);
+            return row_type(m_Data + y * m_Pitch, m_Width, m_Channels);
+        }
+
+        row_type row(size_t y) const
+        {
+            if (y >= m_Height)
+                throw std::runtime_error("The 'y' coordinate exceeded image height");
+
+            return row_unchecked(y);
+        }
+
+        T* pixel_unchecked(size_t x, size_t y) const noexcept
+        {
+            return row_unchecked(y)[x];
+        }
+
+        T* at(size_t x, size_t y) const
+        {
+            return row(y).at(x);
+        }
+
+        basic_ImageView view_unchecked(size_t x, size_t y, size_t width, size_t height) const noexcept
+        {
+            assert(x <= m_Width && width <= m_Width - x);
+            assert(y <= m_Height && height <= m_Height - y);
+
+            return basic_ImageView(m_Data + y * m_Pitch + x * m_Channels, width, height, m_Pitch, m_Channels);
+        }
+
+        basic_ImageView view(size_t x, size_t y, size_t width, size_t height) const
+        {
+            if (x > m_Width || width > m_Width - x)
+                throw std::runtime_error("The view exceeded image width");
+
+            if (y > m_Height || height > m_Height - y)
+                throw std::runtime_error("The view exceeded image height");
+
+            return view_unchecked(x, y, width, height);
+        }
+
+        iterator begin() const noexcept { return iterator(*this, 0); }
+        iterator end()   const noexcept { return iterator(*this, m_Height); }
+    };
+
+    using ImageView      = basic_ImageView<uint8_t>;
+    using ConstImageView = basic_ImageView<const uint8_t>;
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#include "utils.h"
+
+#ifdef XIL_PMR
+    #include <memory_resource>
+#endif
+
+#ifdef XIL_POSIX
+    #include <sys/mman.h>
+#endif
+
+namespace XIL {
+
+#ifdef XIL_PMR
+    using PixelResource = std::pmr::memory_resource;
+
+    // Allocates from a std::pmr::memory_resource like std::pmr::polymorphic_allocator,
+    // but the resource moves along with the container, so moving an image is always O(1).
+    // Elements are default initialized, see PixelContainer
+    template<typename T>
+    class PixelAllocator
+    {
+    private:
+        PixelResource* m_Resource;
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        PixelAllocator() noexcept
+            : m_Resource(std::pmr::get_default_resource())
+        {
+        }
+
+        // nullptr means the default resource
+        PixelAllocator(PixelResource* resource) noexcept
+            : m_Resource(resource ? resource : std::pmr::get_default_resource())
+        {
+        }
+
+        template<typename U>
+        PixelAllocator(const PixelAllocator<U>& other) noexcept
+            : m_Resource(other.resource())
+        {
+        }
+
+        T* allocate(size_t count)
+        {
+            if (count > SIZE_MAX / sizeof(T))
+                throw std::bad_array_new_length();
+
+            return static_cast<T*>(m_Resource->allocate(count * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* ptr, size_t count) noexcept
+        {
+            m_Resource->deallocate(ptr, count * sizeof(T), alignof(T));
+        }
+
+        template<typename U>
+        void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value)
+        {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+
+        template<typename U, typename... Args>
+        void construct(U* ptr, Args&&... args)
+        {
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+        }
+
+        PixelResource* resource() const noexcept
+        {
+            return m_Resource;
+        }
+
+        template<typename U>
+        bool operator==(const PixelAllocator<U>& other) const noexcept
+        {
+            return *m_Resource == *other.resource();
+        }
+
+        template<typename U>
+        bool operator!=(const PixelAllocator<U>& other) const noexcept
+        {
+            return !(*this == other);
+        }
+    };
+
+    // Unlike std::vector, growing a PixelContainer with resize() leaves the new bytes uninitialized,
+    // the allocator default initializes them. Zero them explicitly (assign, std::fill) if they
+    // might not all be written.
+    using PixelContainer = std::vector<uint8_t, PixelAllocator<uint8_t>>;
+
+    // Aligns every allocation to at least 'alignment' bytes,
+    // 64 covers a cache line and the widest SIMD loads
+    class AlignedResource : public PixelResource
+    {
+    private:
+        size_t m_Alignment;
+    public:
+        explicit AlignedResource(size_t alignment = 64)
+            : m_Alignment(alignment)
+        {
+            if (!alignment || (alignment & (alignment - 1)))
+                throw std::runtime_error("The alignment has to be a power of 2");
+        }
+
+        size_t alignment() const noexcept
+        {
+            return m_Alignment;
+        }
+    private:
+        // The aligned operator new goes through memalign, which doesn't get to reuse freed
+        // multi-megabyte blocks the way malloc does and faults them in from scratch every time.
+        // Over-allocating and storing the original pointer right before the block avoids that.
+        size_t padding(size_t alignment) const noexcept
+        {
+            return std::max(alignment, m_Alignment) + sizeof(void*);
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            size_t extra = padding(alignment);
+
+            if (bytes > SIZE_MAX - extra)
+                throw std::bad_alloc();
+
+            auto* allocation = static_cast<uint8_t*>(::operator new(bytes + extra));
+
+            auto mask = static_cast<uintptr_t>(extra - sizeof(void*) - 1);
+            auto aligned = (reinterpret_cast<uintptr_t>(allocation) + sizeof(void*) + mask) & ~mask;
+            auto* block = reinterpret_cast<uint8_t*>(aligned);
+
+            memcpy(block - sizeof(void*), &allocation, sizeof(void*));
+            return block;
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+        {
+            XIL_UNUSED(bytes);
+            XIL_UNUSED(alignment);
+
+            void* allocation;
+            memcpy(&allocation, static_cast<uint8_t*>(ptr) - sizeof(void*), sizeof(void*));
+
+            ::operator delete(allocation);
+        }
+
+        bool do_is_equal(const PixelResource& other) const noexcept override
+        {
+            auto* aligned = dynamic_cast<const AlignedResource*>(&other);
+
+            return aligned && aligned->m_Alignment == m_Alignment;
+        }
+    };
+
+    // Backs large allocations with 2 MiB aligned anonymous mappings that the kernel is asked
+    // to back with transparent huge pages, so walking a large frame takes far fewer TLB misses.
+    // Allocations are rounded up to whole huge pages, anything smaller than 'min_size' goes
+    // to 'upstream' instead. Only has an effect on POSIX systems.
+    class HugePageResource : public PixelResource
+    {
+    public:
+        static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+    private:
+        PixelResource* m_Upstream;
+        size_t m_MinSize;
+    public:
+        explicit HugePageResource(size_t min_size = huge_page_size, PixelResource* upstream = std::pmr::get_default_resource())
+            : m_Upstream(upstream),
+            m_MinSize(min_size)
+        {
+        }
+
+        HugePageResource(const HugePageResource&) = delete;
+        HugePageResource& operator=(const HugePageResource&) = delete;
+
+        PixelResource* upstream() const noexcept
+        {
+            return m_Upstream;
+        }
+    private:
+        bool is_mapped(size_t bytes, size_t alignment) const noexcept
+        {
+        #ifdef XIL_POSIX
+            return bytes >= m_MinSize && alignment <= huge_page_size && bytes <= SIZE_MAX - 2 * huge_page_size;
+        #else
+            XIL_UNUSED(bytes);
+            XIL_UNUSED(alignment);
+            return false;
+        #endif
+        }
+
+        static size_t round_to_pages(size_t bytes) noexcept
+        {
+            return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            if (!is_mapped(bytes, alignment))
+                return m_Upstream->allocate(bytes, alignment);
+
+        #ifdef XIL_POSIX
+            size_t size = round_to_pages(bytes);
+
+            // mmap only guarantees page alignment, map an extra huge page and trim the excess
+            void* mapping = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (mapping == MAP_FAILED)
+                throw std::bad_alloc();
+
+            auto start = reinterpret_cast<uintptr_t>(mapping);
+            auto aligned = (start + huge_page_size - 1) & ~static_cast<uintptr_t>(huge_page_size - 1);
+
+            if (aligned != start)
+                munmap(mapping, aligned - start);
+
+            if (size_t tail = start + huge_page_size - aligned)
+                munmap(reinterpret_cast<void*>(aligned + size), tail);
+
+            #ifdef MADV_HUGEPAGE
+                madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+            #endif
+
+            return reinterpret_cast<void*>(aligned);
+        #else
+            return nullptr;
+        #endif
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+        {
+            if (!is_mapped(bytes, alignment))
+            {
+                m_Upstream->deallocate(ptr, bytes, alignment);
+                return;
+            }
+
+        #ifdef XIL_POSIX
+            munmap(ptr, round_to_pages(bytes));
+        #endif
+        }
+
+        bool do_is_equal(const PixelResource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // Shared instances that live for the duration of the program
+    inline AlignedResource* aligned_resource()
+    {
+        static AlignedResource resource;
+        return &resource;
+    }
+
+    inline HugePageResource* huge_page_resource()
+    {
+        static HugePageResource resource(HugePageResource::huge_page_size, aligned_resource());
+        return &resource;
+    }
+#else
+    // without std::pmr pixels always come from the global allocator
+    class PixelResource;
+
+    // std::allocator that default initializes elements, see PixelContainer
+    template<typename T>
+    class PixelAllocator : public std::allocator<T>
+    {
+    public:
+        template<typename U>
+        struct rebind { using other = PixelAllocator<U>; };
+
+        PixelAllocator() = default;
+
+        template<typename U>
+        PixelAllocator(const PixelAllocator<U>&) noexcept
+        {
+        }
+
+        template<typename U>
+        void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value)
+        {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+
+        template<typename U, typename... Args>
+        void construct(U* ptr, Args&&... args)
+        {
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+        }
+    };
+
+    // Unlike std::vector, growing a PixelContainer with resize() leaves the new bytes uninitialized,
+    // the allocator default initializes them. Zero them explicitly (assign, std::fill) if they
+    // might not all be written.
+    using PixelContainer = std::vector<uint8_t, PixelAllocator<uint8_t>>;
+#endif
+
+    // Resizes 'container' without zeroing the new bytes, they're indeterminate until written.
+    // Same as resize() on a PixelContainer, spelled out where the bytes are expected to be garbage.
+    // Zeroing in the allocator only for plain resize() would need a check per constructed byte,
+    // which compilers don't hoist out of the loop, so the allocator never zeroes.
+    // Every decoder writes each byte of its output, the ones that might not have to clear it.
+    inline void resize_uninitialized(PixelContainer& container, size_t size)
+    {
+        container.resize(size);
+    }
+}
@@ -0,0 +1,579 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "utils.h"
+#include "image_view.h"
+#include "buffer_pool.h"
+#include "memory_resource.h"
+
+namespace XIL {
+
+    struct MipOptions
+    {
+        // average in linear light instead of on the sRGB encoded values, alpha is always linear
+        bool srgb = false;
+
+        // weight the colors by alpha so that transparent pixels don't bleed into the visible ones,
+        // images loaded with premultiply_alpha are already filtered correctly without it
+        bool alpha_weighted = false;
+
+        // number of levels below the base image to generate, 0 for all of them down to 1x1
+        size_t max_levels = 0;
+    };
+
+    // Every level below the base image in a single allocation, ready to be uploaded level by level.
+    // Rows are tightly packed and every level starts at a multiple of 16 bytes.
+    class MipChain
+    {
+    public:
+        struct Level
+        {
+            size_t width;
+            size_t height;
+            size_t offset; // from data()
+        };
+
+        friend class Image;
+    private:
+        PixelContainer m_Data;
+        std::vector<Level> m_Levels;
+        uint8_t m_Channels;
+    public:
+        MipChain() noexcept
+            : m_Channels(0)
+        {
+        }
+
+        // Room for the levels below a 'width' x 'height' image
+        MipChain(size_t width, size_t height, uint8_t channels, size_t max_levels = 0,
+                 BufferPool* pool = nullptr, PixelResource* resource = nullptr)
+            : m_Channels(channels)
+        {
+            size_t size = 0;
+
+            while ((width > 1 || height > 1) && (!max_levels || m_Levels.size() < max_levels))
+            {
+                width = next_size(width);
+                height = next_size(height);
+
+                m_Levels.push_back({ width, height, size });
+                size = checked_add(size, checked_mul(checked_mul(width, height), channels));
+                size = checked_add(size, 15) & ~size_t(15);
+            }
+
+            m_Data = BufferPool::acquire(pool, size, resource);
+            resize_uninitialized(m_Data, size);
+
+            // only the padding between the levels, the levels are written by the filter
+            for (size_t i = 0; i < m_Levels.size(); i++)
+            {
+                size_t end = m_Levels[i].offset + m_Levels[i].width * m_Levels[i].height * channels;
+                size_t next = i + 1 < m_Levels.size() ? m_Levels[i + 1].offset : size;
+
+                memset(m_Data.data() + end, 0, next - end);
+            }
+        }
+
+        // size of the level below one of 'size' pixels
+        static size_t next_size(size_t size) noexcept
+        {
+            return size > 1 ? size / 2 : 1;
+        }
+
+        // number of levels, level(0) is half the size of the base image
+        size_t levels() const noexcept
+        {
+            return m_Levels.size();
+        }
+
+        bool empty() const noexcept
+        {
+            return m_Levels.empty();
+        }
+
+        const Level& info(size_t level) const
+        {
+            if (level >= m_Levels.size())
+                throw std::runtime_error("The mip level doesn't exist");
+
+            return m_Levels[level];
+        }
+
+        ImageView level(size_t level)
+        {
+            const auto& at = info(level);
+            return ImageView(m_Data.data() + at.offset, at.width, at.height, at.width * m_Channels, m_Channels);
+        }
+
+        ConstImageView level(size_t level) const
+        {
+            const auto& at = info(level);
+            return ConstImageView(m_Data.data() + at.offset, at.width, at.height, at.width * m_Channels, m_Channels);
+        }
+
+        uint8_t channels() const noexcept
+        {
+            return m_Channels;
+        }
+
+        const uint8_t* data() const noexcept
+        {
+            return m_Data.data();
+        }
+
+        // bytes taken by all the levels, including the padding between them
+        size_t size() const noexcept
+        {
+            return m_Data.size();
+        }
+    };
+
+    // 2x2 box filter downsampling. Odd dimensions are filtered exactly, every pixel of a level
+    // covers 2 + 1 / size pixels of the level above it, so no row or column gets dropped.
+    class Mipmap
+    {
+    public:
+        // Fixed point weights of the source rows or columns of a destination pixel
+        struct Taps
+        {
+            size_t   first;
+            size_t   count;
+            uint32_t weights[3]; // sum to 'one'
+        };
+
+        // Row buffers reused across the rows of a chain
+        struct Scratch
+        {
+            std::vector<uint16_t> sums;
+            std::vector<uint32_t> totals;
+        };
+
+        // weights per axis sum to 'one', so filtered values carry 16 fractional bits
+        static constexpr uint32_t one = 256;
+
+        Mipmap() = delete;
+
+        // The whole chain below 'base'
+        static MipChain generate(ConstImageView base, const MipOptions& options = {},
+                                 BufferPool* pool = nullptr, PixelResource* resource = nullptr);
+
+        // Source rows or columns of pixel 'index' of a level 'size' pixels wide or high
+        static Taps taps(size_t size, size_t index) noexcept
+        {
+            if (size == 1)
+                return { 0, 1, { one, 0, 0 } };
+
+            if (!(size & 1))
+                return { 2 * index, 2, { one / 2, one / 2, 0 } };
+
+            // 'size' = 2n + 1, pixel i covers (n - i, n, i + 1) / (2n + 1) of the three below it
+            uint64_t n = size / 2;
+            uint32_t first = static_cast<uint32_t>(((n - index) * one + n) / size);
+            uint32_t last = static_cast<uint32_t>(((index + 1) * one + n) / size);
+
+            return { 2 * index, 3, { first, one - first - last, last } };
+        }
+
+        // Writes row 'y' of 'dst', the level below 'src'
+        static void downsample_row(ConstImageView src, ImageView dst, size_t y, const MipOptions& options, Scratch& scratch)
+        {
+            Taps vertical = taps(src.height(), y);
+
+            const uint8_t* rows[3] = {};
+            for (size_t i = 0; i < vertical.count; i++)
+                rows[i] = src.row_unchecked(vertical.first + i).data();
+
+            uint8_t* out = dst.row_unchecked(y).data();
+
+            if (options.srgb || (options.alpha_weighted && has_alpha(src.channels())))
+            {
+                weighted_row(rows, vertical, src.width(), dst.width(), src.channels(), out, options, scratch.totals);
+                return;
+            }
+
+            std::vector<uint16_t>& sums = scratch.sums;
+            sums.resize(src.width() * src.channels());
+            accumulate_rows(rows, vertical, sums.data(), sums.size());
+
+            if (src.width() & 1)
+                filter_columns(sums.data(), src.width(), dst.width(), src.channels(), out);
+            else
+                sum_pairs(sums.data(), dst.width(), src.channels(), out);
+        }
+
+        // sRGB value of a 16 bit linear light value and the other way around
+        static uint16_t to_linear(uint8_t value) noexcept
+        {
+            return srgb_tables().linear[value];
+        }
+
+        static uint8_t to_srgb(uint32_t linear) noexcept
+        {
+            return srgb_tables().encoded[linear >> 4];
+        }
+
+    private:
+        static bool has_alpha(uint8_t channels) noexcept
+        {
+            return channels == 2 || channels == 4;
+        }
+
+        struct SrgbTables
+        {
+            uint16_t linear[256];
+            uint8_t  encoded[4096];
+
+            SrgbTables()
+            {
+                for (size_t i = 0; i < 256; i++)
+                {
+                    double value = i / 255.0;
+                    value = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+                    linear[i] = static_cast<uint16_t>(std::lround(value * 65535.0));
+                }
+
+                // the encoded value of the middle of every bucket of 16 linear values
+                for (size_t i = 0; i < 4096; i++)
+                {
+                    double value = (i * 16 + 7.5) / 65535.0;
+                    value = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+                    encoded[i] = static_cast<uint8_t>(std::lround(std::min(value, 1.0) * 255.0));
+                }
+            }
+        };
+
+        static const SrgbTables& srgb_tables()
+        {
+            static const SrgbTables tables;
+            return tables;
+        }
+
+        // acc[i] = sum of weight * rows[tap][i]
+        static void accumulate_rows(const uint8_t* const* rows, const Taps& vertical, uint16_t* acc, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #ifdef XIL_SSE2
+            const __m128i zero = _mm_setzero_si128();
+
+            for (; i + 16 <= count; i += 16)
+            {
+                __m128i lo = zero;
+                __m128i hi = zero;
+
+                for (size_t tap = 0; tap < vertical.count; tap++)
+                {
+                    __m128i weight = _mm_set1_epi16(static_cast<int16_t>(vertical.weights[tap]));
+                    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[tap] + i));
+
+                    lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(px, zero), weight));
+                    hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(px, zero), weight));
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), lo);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i + 8), hi);
+            }
+        #endif
+
+            for (; i < count; i++)
+            {
+                uint32_t sum = 0;
+
+                for (size_t tap = 0; tap < vertical.count; tap++)
+                    sum += vertical.weights[tap] * rows[tap][i];
+
+                acc[i] = static_cast<uint16_t>(sum);
+            }
+        }
+
+        // Even source widths, every pixel is the sum of two accumulated ones
+        static void sum_pairs(const uint16_t* acc, size_t width, uint8_t channels, uint8_t* out) noexcept
+        {
+            size_t i = 0;
+            size_t count = width * channels;
+
+        #ifdef XIL_SSE2
+            // 8 output bytes from 16 accumulated values per iteration
+            // (a + b) * 128 + 32768 >> 16 is (a + b + 256) >> 9, the sum is halved first so that it fits
+            // into 16 bits. That only rounds differently for odd heights, by at most 1 / 512.
+            if (channels != 3)
+            {
+                const __m128i rounding = _mm_set1_epi16(128);
+
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2 * i));
+                    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2 * i + 8));
+
+                    __m128i sums = pair_averages(lo, hi, channels);
+                    sums = _mm_srli_epi16(_mm_add_epi16(sums, rounding), 8);
+
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(sums, sums));
+                }
+            }
+        #endif
+        #ifdef XIL_SSSE3
+            // 4 RGB pixels from 24 accumulated values per iteration, the halves of two pixels are gathered
+            // into the 4 lane slots of a vector each so they can be averaged, then narrowed back to 3 bytes
+            if (channels == 3)
+            {
+                const __m128i rounding = _mm_set1_epi16(128);
+                const __m128i first_lo = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+                const __m128i first_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 4, 5, 6, 7, 8, 9, -1, -1);
+                const __m128i second_lo = _mm_setr_epi8(6, 7, 8, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+                const __m128i second_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 10, 11, 12, 13, 14, 15, -1, -1);
+                const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+                for (; i + 12 <= count; i += 12)
+                {
+                    __m128i sums[2];
+
+                    for (size_t half = 0; half < 2; half++)
+                    {
+                        const uint16_t* at = acc + 2 * i + 12 * half;
+                        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+                        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at + 4));
+
+                        __m128i first = _mm_or_si128(_mm_shuffle_epi8(lo, first_lo), _mm_shuffle_epi8(hi, first_hi));
+                        __m128i second = _mm_or_si128(_mm_shuffle_epi8(lo, second_lo), _mm_shuffle_epi8(hi, second_hi));
+
+                        sums[half] = _mm_srli_epi16(_mm_add_epi16(_mm_avg_epu16(first, second), rounding), 8);
+                    }
+
+                    __m128i pixels = _mm_shuffle_epi8(_mm_packus_epi16(sums[0], sums[1]), narrow);
+
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), pixels);
+                    uint32_t last = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(pixels, 8)));
+                    std::memcpy(out + i + 8, &last, 4);
+                }
+            }
+        #endif
+
+            for (size_t x = i / channels; x < width; x++)
+            {
+                const uint16_t* pair = acc + 2 * x * channels;
+
+                for (size_t c = 0; c < channels; c++)
+                {
+                    uint32_t sum = pair[c] + pair[channels + c];
+                    out[x * channels + c] = static_cast<uint8_t>(((sum + 1) / 2 + 128) >> 8);
+                }
+            }
+        }
+
+    #ifdef XIL_SSE2
+        // rounded up averages of the neighbouring pixels of 'lo' and 'hi', in order
+        static __m128i pair_averages(__m128i lo, __m128i hi, uint8_t channels) noexcept
+        {
+            if (channels == 1)
+            {
+                // each 32 bit lane holds a pair, gather the even 16 bit lanes
+                lo = _mm_avg_epu16(lo, _mm_srli_epi32(lo, 16));
+                hi = _mm_avg_epu16(hi, _mm_srli_epi32(hi, 16));
+
+                lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+                hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+
+                return _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+            }
+
+            if (channels == 2)
+            {
+                // each 64 bit lane holds a pair
+                lo = _mm_shuffle_epi32(_mm_avg_epu16(lo, _mm_srli_epi64(lo, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+                hi = _mm_shuffle_epi32(_mm_avg_epu16(hi, _mm_srli_epi64(hi, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+
+                return _mm_unpacklo_epi64(lo, hi);
+            }
+
+            // each vector holds a pair
+            return _mm_unpacklo_epi64(_mm_avg_epu16(lo, _mm_srli_si128(lo, 8)), _mm_avg_epu16(hi, _mm_srli_si128(hi, 8)));
+        }
+    #endif
+
+        // Odd source widths, three weighted columns per pixel
+        static void filter_columns(const uint16_t* acc, size_t src_width, size_t width, uint8_t channels, uint8_t* out) noexcept
+        {
+            for (size_t x = 0; x < width; x++)
+            {
+                Taps horizontal = taps(src_width, x);
+
+                for (size_t c = 0; c < channels; c++)
+                {
+                    uint32_t sum = 0;
+
+                    for (size_t tap = 0; tap < horizontal.count; tap++)
+                        sum += horizontal.weights[tap] * acc[(horizontal.first + tap) * channels + c];
+
+                    out[x * channels + c] = static_cast<uint8_t>((sum + one * one / 2) >> 16);
+                }
+            }
+        }
+
+        // sRGB and alpha weighted filtering, the rows are summed up first into 32 bit totals per source pixel
+        // (linear light, premultiplied by alpha when weighted) so the horizontal taps only touch one row
+        static void weighted_row(const uint8_t* const* rows, const Taps& vertical, size_t src_width, size_t width,
+                                 uint8_t channels, uint8_t* out, const MipOptions& options, std::vector<uint32_t>& totals)
+        {
+            const bool alpha = has_alpha(channels);
+            const bool weighted = alpha && options.alpha_weighted;
+            const size_t colors = alpha ? channels - 1 : channels;
+
+            // at most 256 * 255 * 65535 per color, which still fits
+            totals.assign(src_width * channels, 0);
+
+            for (size_t ty = 0; ty < vertical.count; ty++)
+            {
+                const uint8_t* row = rows[ty];
+                uint32_t* total = totals.data();
+                const uint32_t weight = vertical.weights[ty];
+
+                for (size_t x = 0; x < src_width; x++, row += channels, total += channels)
+                {
+                    const uint32_t coverage = weighted ? weight * row[colors] : weight;
+
+                    for (size_t c = 0; c < colors; c++)
+                        total[c] += coverage * (options.srgb ? to_linear(row[c]) : row[c]);
+
+                    if (alpha)
+                        total[colors] += weight * row[colors];
+                }
+            }
+
+            for (size_t x = 0; x < width; x++)
+            {
+                Taps horizontal = taps(src_width, x);
+                const uint32_t* total = totals.data() + horizontal.first * channels;
+
+                uint64_t sums[4] = {};
+
+                for (size_t tx = 0; tx < horizontal.count; tx++, total += channels)
+                {
+                    for (size_t c = 0; c < channels; c++)
+                        sums[c] += static_cast<uint64_t>(horizontal.weights[tx]) * total[c];
+                }
+
+                uint8_t* to = out + x * channels;
+                const uint64_t alpha_sum = alpha ? sums[colors] : 0;
+
+                if (weighted && !alpha_sum)
+                {
+                    // fully transparent pixels are averaged as they are
+                    plain_pixel(rows, vertical, horizontal, channels, to, options);
+                    continue;
+                }
+
+                for (size_t c = 0; c < colors; c++)
+                {
+                    uint64_t value = weighted ? (sums[c] + alpha_sum / 2) / alpha_sum : (sums[c] + one * one / 2) >> 16;
+                    to[c] = options.srgb ? to_srgb(static_cast<uint32_t>(value)) : static_cast<uint8_t>(value);
+                }
+
+                if (alpha)
+                    to[colors] = static_cast<uint8_t>((alpha_sum + one * one / 2) >> 16);
+            }
+        }
+
+        // Unweighted pixel straight from the source rows, the fallback of weighted_row
+        static void plain_pixel(const uint8_t* const* rows, const Taps& vertical, const Taps& horizontal,
+                                uint8_t channels, uint8_t* to, const MipOptions& options) noexcept
+        {
+            for (size_t c = 0; c < channels; c++)
+            {
+                const bool color = c + 1 < channels;
+                uint64_t sum = 0;
+
+                for (size_t ty = 0; ty < vertical.count; ty++)
+                {
+                    for (size_t tx = 0; tx < horizontal.count; tx++)
+                    {
+                        uint8_t value = rows[ty][(horizontal.first + tx) * channels + c];
+                        sum += static_cast<uint64_t>(vertical.weights[ty] * horizontal.weights[tx]) *
+                               (options.srgb && color ? to_linear(value) : value);
+                    }
+                }
+
+                uint64_t value = (sum + one * one / 2) >> 16;
+                to[c] = options.srgb && color ? to_srgb(static_cast<uint32_t>(value)) : static_cast<uint8_t>(value);
+            }
+        }
+    };
+
+    // Generates a chain from the rows of the base image as they become final, rows of every level
+    // are written as soon as the rows they're filtered from are ready, so the whole chain is built
+    // in a single pass over the base image while its rows are still in cache
+    class MipBuilder
+    {
+    private:
+        ConstImageView m_Base;
+        MipChain& m_Chain;
+        MipOptions m_Options;
+
+        // finished rows per level, the base image first
+        std::vector<size_t> m_Rows;
+        Mipmap::Scratch m_Scratch;
+    public:
+        MipBuilder(ConstImageView base, MipChain& chain, const MipOptions& options)
+            : m_Base(base),
+            m_Chain(chain),
+            m_Options(options),
+            m_Rows(chain.levels() + 1, 0)
+        {
+            if (chain.channels() != base.channels() || (!chain.empty() &&
+                (chain.info(0).width != MipChain::next_size(base.width()) || chain.info(0).height != MipChain::next_size(base.height()))))
+                throw std::runtime_error("The mip chain doesn't match the base image");
+        }
+
+        // Row 'y' of the base image is final, rows have to be reported top to bottom
+        void row_ready(size_t y)
+        {
+            m_Rows[0] = y + 1;
+
+            for (size_t level = 0; level < m_Chain.levels(); level++)
+            {
+                ConstImageView src = level ? ConstImageView(m_Chain.level(level - 1)) : m_Base;
+                ImageView dst = m_Chain.level(level);
+                size_t& done = m_Rows[level + 1];
+                size_t before = done;
+
+                while (done < dst.height())
+                {
+                    auto rows = Mipmap::taps(src.height(), done);
+
+                    if (rows.first + rows.count > m_Rows[level])
+                        break;
+
+                    Mipmap::downsample_row(src, dst, done++, m_Options, m_Scratch);
+                }
+
+                if (done == before)
+                    break;
+            }
+        }
+
+        // true once every level has been written
+        bool finished() const noexcept
+        {
+            return m_Rows.back() == (m_Chain.empty() ? m_Base.height() : m_Chain.info(m_Chain.levels() - 1).height);
+        }
+    };
+
+    inline MipChain Mipmap::generate(ConstImageView base, const MipOptions& options, BufferPool* pool, PixelResource* resource)
+    {
+        if (base.empty())
+            return {};
+
+        MipChain chain(base.width(), base.height(), base.channels(), options.max_levels, pool, resource);
+        MipBuilder builder(base, chain, options);
+
+        for (size_t y = 0; y < base.height(); y++)
+            builder.row_ready(y);
+
+        return chain;
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <condition_variable>
+
+#include "XILoader.h"
+
+namespace XIL {
+
+    // An image of a batch, either a file or an encoded image in memory.
+    // The memory isn't copied, it has to outlive the call loading the batch.
+    struct BatchSource
+    {
+        std::string path;
+        const void* data = nullptr;
+        size_t size = 0;
+
+        BatchSource(std::string path)
+            : path(std::move(path))
+        {
+        }
+
+        BatchSource(const char* path)
+            : path(path)
+        {
+        }
+
+        BatchSource(const void* data, size_t size)
+            : data(data), size(size)
+        {
+        }
+    };
+
+    struct BatchResult
+    {
+        Image image;
+
+        // why the image couldn't be loaded, empty if it was
+        std::string error;
+
+        bool ok() const noexcept
+        {
+            return image.ok();
+        }
+    };
+
+    // Decodes batches of images across a work stealing pool of threads that lives as long as the loader.
+    // The largest inputs are started first, so a large image picked up last doesn't leave the other
+    // threads idle while it's decoded. Several threads can load batches through the same loader.
+    class ParallelLoader
+    {
+    private:
+        WorkStealingPool m_Pool;
+    public:
+        explicit ParallelLoader(size_t threads = ThreadPool::default_thread_count())
+            : m_Pool(threads)
+        {
+        }
+
+        ParallelLoader(const ParallelLoader&) = delete;
+        ParallelLoader& operator=(const ParallelLoader&) = delete;
+
+        // number of threads decoding the images
+        size_t size() const noexcept
+        {
+            return m_Pool.size();
+        }
+
+        std::vector<BatchResult> load(const std::vector<std::string>& paths, const LoadOptions& options = {})
+        {
+            return load(std::vector<BatchSource>(paths.begin(), paths.end()), options);
+        }
+
+        // The results are in the order of 'sources', with an empty image and the error for the ones
+        // that couldn't be loaded
+        std::vector<BatchResult> load(const std::vector<BatchSource>& sources, const LoadOptions& options = {})
+        {
+            std::vector<BatchResult> results(sources.size());
+            std::vector<size_t> sizes(sources.size());
+            std::vector<size_t> order(sources.size());
+
+            for (size_t i = 0; i < sources.size(); i++)
+                sizes[i] = sources[i].path.empty() ? sources[i].size : file_size(sources[i].path);
+
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+            std::mutex mutex;
+            std::condition_variable done;
+            std::atomic<size_t> next(0);
+
+            // one task per worker taking the inputs off 'order' through a shared counter, queueing one task
+            // per input would let a worker stuck on a large image keep the next largest ones in its queue
+            size_t remaining = std::min(m_Pool.size(), sources.size());
+
+            for (size_t i = remaining; i > 0; i--)
+            {
+                m_Pool.submit(
+                    [&]()
+                    {
+                        for (size_t at; (at = next.fetch_add(1)) < order.size();)
+                            load_one(sources[order[at]], options, results[order[at]]);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+
+                        if (!--remaining)
+                            done.notify_one();
+                    });
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]() { return !remaining; });
+
+            return results;
+        }
+
+    private:
+        static void load_one(const BatchSource& source, const LoadOptions& options, BatchResult& into) noexcept
+        {
+            try {
+                if (source.path.empty())
+                    into.image = Loader::load_raw_verbose(const_cast<void*>(source.data), source.size, options);
+                else
+                    into.image = Loader::load_verbose(source.path, options);
+            }
+            catch (const std::exception& e)
+            {
+                into.image = {};
+
+                try {
+                    into.error = e.what();
+                }
+                catch (const std::exception&) // out of memory for the message
+                {
+                }
+            }
+        }
+    };
+}
@@ -5,6 +5,7 @@
 #include "image.h"
 #include "data_stream.h"
 #include "decompressor.h"
+#include "convert.h"
 
 namespace XIL {
 
@@ -40,6 +41,15 @@ namespace XIL {
             uint8_t interlace_method;
             zlib_header zheader;
 
+            // premultiply the color channels by alpha
+            bool premultiply;
+
+            // sizes in bytes, overflow checked once by compute_sizes()
+            size_t pixel_stride;  // a (possibly partial) pixel, as used by the filters
+            size_t row_bytes;     // an unfiltered row
+            size_t filtered_size; // all rows including their filter method bytes
+            size_t pixels;        // width * height
+
             bool zlib_set() const noexcept { return zheader.set; }
         };
 
@@ -57,31 +67,60 @@ namespace XIL {
         };
 
     public:
-        static void load(DataStream& file_stream, Image& image, bool force_flip)
+        static void load(DataStream& file_stream, Image& image, const LoadOptions& options)
+        {
+            load_chunks(file_stream, image, options);
+        }
+
+        // Pulls the file one chunk at a time, IDAT data is inflated as it
+        // arrives and released as soon as it has been consumed
+        static void load(StreamReader& reader, Image& image, const LoadOptions& options)
+        {
+            load_chunks(reader, image, options);
+        }
+    private:
+        template<typename Source>
+        static void load_chunks(Source& file, Image& image, const LoadOptions& options)
         {
             chunk chnk{};
             png_data idata{};
-            ChunkedBitReader bit_stream{};
+
+            idata.premultiply = options.premultiply_alpha;
+
+            BufferPool* pool = options.buffer_pool.get();
+            PixelResource* resource = options.pixel_resource();
+            image.m_Pool = options.buffer_pool;
 
             palette alpha_plt{};
             palette plt{};
 
+            // the palettes have to outlive 'chnk', which is reused for every chunk
+            DataStream alpha_plt_data;
+            DataStream plt_data;
+
+            ImageData::Container uncompressed_data;
+            bool inflated = false;
+            bool pending_chunk = false;
+
             // skip file signature
-            file_stream.skip_n(8);
+            file.skip_n(8);
 
-            // go through the entire file
-            // collect all the necessary image data
-            // and concatenate all the idat chunks
+            // go through the entire file, collect all the necessary
+            // image data and inflate the idat chunks on the first one
             for (;;)
             {
-                read_chunk(file_stream, chnk);
+                if (!pending_chunk)
+                    read_chunk(file, chnk);
+
+                pending_chunk = false;
 
                 if (is_iend(chnk)) break;
 
                 if (is_trns(chnk))
                 {
-                    alpha_plt.data = chnk.data.data_ptr();
-                    alpha_plt.size = chnk.data.bytes_left();
+                    alpha_plt_data = std::move(chnk.data);
+                    alpha_plt.data = alpha_plt_data.data_ptr();
+                    alpha_plt.size = alpha_plt_data.bytes_left();
                     alpha_plt.set_stride(1);
                 }
 
@@ -95,29 +134,72 @@ namespace XIL {
 
                 if (is_plte(chnk))
                 {
-                    plt.data = chnk.data.data_ptr();
-                    plt.size = chnk.data.bytes_left();
+                    plt_data = std::move(chnk.data);
+                    plt.data = plt_data.data_ptr();
+                    plt.size = plt_data.bytes_left();
                     plt.set_stride(3);
                 }
 
-                if (is_idat(chnk))
+                if (is_idat(chnk) && !inflated)
                 {
-                    if (!idata.zlib_set())
-                    {
-                        read_zlib_header(chnk, idata);
-                        validate_zlib_header(idata.zheader);
-                    }
+                    // a valid bit depth is never 0
+                    if (!idata.bit_depth)
+                        throw std::runtime_error("IDAT chunk before IHDR");
+
+                    read_zlib_header(chnk, idata);
+                    validate_zlib_header(idata.zheader);
+
+                    // the following idat chunks are pulled by the inflator on demand,
+                    // the first chunk that isn't one is processed by the next iteration
+                    ChunkedBitReader bit_stream(std::move(chnk.data));
+                    bit_stream.set_chunk_provider(
+                        [&](ChunkedBitReader& reader)
+                        {
+                            if (pending_chunk)
+                                return false;
+
+                            read_chunk(file, chnk);
+
+                            if (!is_idat(chnk))
+                            {
+                                pending_chunk = true;
+                                return false;
+                            }
+
+                            reader.append_chunk(std::move(chnk.data));
+                            return true;
+                        });
+
+                    if (!bit_stream.fetch_first_chunk())
+                        throw std::runtime_error("Empty image data");
 
-                    bit_stream.append_chunk(chnk.data);
+                    uncompressed_data = BufferPool::acquire(pool, idata.filtered_size, resource);
+                    Inflator::inflate(bit_stream, uncompressed_data);
+
+                    inflated = true;
                 }
             }
 
-            // decompress the data
-            ImageData::Container uncompressed_data;
-            Inflator::inflate(bit_stream, uncompressed_data);
+            if (!inflated)
+                throw std::runtime_error("No IDAT chunks");
+
+            // 8 bit RGB and RGBA rows are final as soon as they're unfiltered,
+            // so the mip chain is built from them while they're still in cache
+            MipChain mips;
+            std::unique_ptr<MipBuilder> fused_mips;
+
+            if (options.generate_mipmaps && !options.flip && !idata.interlace_method &&
+                idata.bit_depth == 8 && (idata.color_type == 2 || idata.color_type == 6))
+            {
+                uint8_t channels = idata.color_type == 6 ? 4 : 3;
+                ConstImageView rows(uncompressed_data.data(), idata.width, idata.height, idata.width * channels, channels);
+
+                mips = MipChain(idata.width, idata.height, channels, options.mipmap_options.max_levels, pool, resource);
+                fused_mips.reset(new MipBuilder(rows, mips, options.mipmap_options));
+            }
 
             // reconstruct the values by removing filters
-            unfilter_values(idata, uncompressed_data);
+            unfilter_values(idata, uncompressed_data, fused_mips.get());
 
             if (idata.interlace_method == 1)
                 deinterlace(idata, uncompressed_data);
@@ -132,9 +214,10 @@ namespace XIL {
                 image.m_Image.width = idata.width;
                 image.m_Image.height = idata.height;
 
-                grayscale_transform(idata, uncompressed_data);
+                grayscale_transform(idata, uncompressed_data, pool, resource);
 
                 image.m_Image.data = std::move(uncompressed_data);
+                image.m_Image.premultiplied = idata.premultiply && idata.color_type == 4;
                 break;
             case 2: // RGB
                 image.m_Image.channels = 3;
@@ -142,7 +225,7 @@ namespace XIL {
                 image.m_Image.height = idata.height;
 
                 if (idata.bit_depth == 16)
-                    downscale(uncompressed_data, image.channels());
+                    downscale(idata, uncompressed_data, image.channels());
 
                 image.m_Image.data = std::move(uncompressed_data);
                 break;
@@ -150,46 +233,92 @@ namespace XIL {
                 image.m_Image.channels = alpha_plt.set() ? 4 : 3;
                 image.m_Image.width = idata.width;
                 image.m_Image.height = idata.height;
-                reconstruct_from_palette(idata, uncompressed_data, plt, alpha_plt);
+                reconstruct_from_palette(idata, uncompressed_data, plt, alpha_plt, pool, resource);
 
                 image.m_Image.data = std::move(uncompressed_data);
+                image.m_Image.premultiplied = idata.premultiply && alpha_plt.set();
                 break;
             case 6: // RGBA
                 image.m_Image.channels = 4;
                 image.m_Image.width = idata.width;
                 image.m_Image.height = idata.height;
 
+                // 8 bit rows get premultiplied while unfiltering
                 if (idata.bit_depth == 16)
-                    downscale(uncompressed_data, image.channels());
+                    downscale(idata, uncompressed_data, image.channels());
 
                 image.m_Image.data = std::move(uncompressed_data);
+                image.m_Image.premultiplied = idata.premultiply;
                 break;
             }
 
-            if (force_flip)
+            spread_rows(image.m_Image, options.pitch_for(image.m_Image.row_size()));
+
+            if (options.flip)
                 image.flip();
+
+            if (fused_mips)
+                image.m_Mips = std::move(mips);
+            else if (options.generate_mipmaps)
+                image.generate_mipmaps(options.mipmap_options);
         }
-    private:
-        static void reconstruct_from_palette(png_data& idata, ImageData::Container& in_out, const palette& plt, const palette& alpha_plt)
+
+        // Moves the tightly packed rows 'pitch' bytes apart, starting
+        // from the last one so that no row is overwritten before it's moved
+        static void spread_rows(ImageData& image, size_t pitch)
+        {
+            size_t row_size = image.row_size();
+            image.pitch = pitch;
+
+            if (pitch == row_size)
+                return;
+
+            resize_uninitialized(image.data, checked_mul(pitch, image.height));
+
+            for (size_t y = image.height; y--;)
+                memmove(image.row(y), image.data_ptr() + y * row_size, row_size);
+
+            image.clear_padding();
+        }
+
+        static void reconstruct_from_palette(png_data& idata, ImageData::Container& in_out, const palette& plt, const palette& alpha_plt, BufferPool* pool, PixelResource* resource)
         {
             auto paletted_data = std::move(in_out);
             ChunkedBitReader palette_stream(paletted_data.data(), paletted_data.size());
 
-            ImageData::Container reconstructed_data;
-            reconstructed_data.reserve(idata.width * idata.height * (alpha_plt.set() ? 4 : 3));
+            size_t reconstructed_size = checked_mul(idata.pixels, alpha_plt.set() ? 4 : 3);
+            auto reconstructed_data = BufferPool::acquire(pool, reconstructed_size, resource);
+            resize_uninitialized(reconstructed_data, reconstructed_size);
+            uint8_t* out = reconstructed_data.data();
+
+            // merge PLTE and tRNS into a single RGBA table,
+            // premultiplying it here covers every pixel at once
+            uint8_t RGBA[256][4]{};
+
+            for (size_t i = 0; i < 256 && i < plt.size / 3; i++)
+            {
+                auto* RGB = plt.at_index(i);
+                RGBA[i][0] = RGB[0];
+                RGBA[i][1] = RGB[1];
+                RGBA[i][2] = RGB[2];
+                RGBA[i][3] = (i < alpha_plt.size) ? *alpha_plt.at_index(i) : 255;
+
+                if (idata.premultiply && alpha_plt.set())
+                    Convert::premultiply_rgba(RGBA[i], 1);
+            }
 
             for (size_t y = 0; y < idata.height; y++)
             {
                 for (size_t x = 0; x < idata.width; x++)
                 {
                     auto palette_index = palette_stream.get_bits_reversed(idata.bit_depth);
-                    auto* RGB = plt.at_index(palette_index);
-                    reconstructed_data.push_back(RGB[0]);
-                    reconstructed_data.push_back(RGB[1]);
-                    reconstructed_data.push_back(RGB[2]);
+                    auto* color = RGBA[palette_index];
+                    *out++ = color[0];
+                    *out++ = color[1];
+                    *out++ = color[2];
 
                     if (alpha_plt.set())
-                        reconstructed_data.push_back(*alpha_plt.at_index(palette_index));
+                        *out++ = color[3];
                 }
 
                 if (y != idata.height - 1)
@@ -197,6 +326,7 @@ namespace XIL {
             }
 
             in_out = std::move(reconstructed_data);
+            BufferPool::release(pool, std::move(paletted_data));
         }
 
         static uint8_t upscale_to_8(uint8_t value, uint8_t width)
@@ -208,14 +338,15 @@ namespace XIL {
             return upscaled;
         }
 
-        static void grayscale_transform(png_data& idata, ImageData::Container& in_out)
+        static void grayscale_transform(png_data& idata, ImageData::Container& in_out, BufferPool* pool, PixelResource* resource)
         {
             auto grayscaled_data = std::move(in_out);
-
-            ImageData::Container transformed_data;
             ChunkedBitReader data_stream(grayscaled_data.data(), grayscaled_data.size());
 
-            transformed_data.reserve(idata.width * idata.height * (idata.color_type ? 1 : 2));
+            size_t transformed_size = checked_mul(idata.pixels, idata.color_type ? 2 : 1);
+            auto transformed_data = BufferPool::acquire(pool, transformed_size, resource);
+            resize_uninitialized(transformed_data, transformed_size);
+            uint8_t* out = transformed_data.data();
 
             for (size_t y = 0; y < idata.height; y++)
             {
@@ -238,7 +369,7 @@ namespace XIL {
                         gray_value = upscale_to_8(gray_value, idata.bit_depth);
                     }
 
-                    transformed_data.push_back(gray_value);
+                    *out++ = static_cast<uint8_t>(gray_value);
 
                     if (idata.color_type == 4)
                     {
@@ -259,15 +390,19 @@ namespace XIL {
                             alpha_value = upscale_to_8(alpha_value, idata.bit_depth);
                         }
 
-                        transformed_data.push_back(alpha_value);
+                        *out++ = static_cast<uint8_t>(alpha_value);
                     }
                 }
 
+                if (idata.premultiply && idata.color_type == 4)
+                    Convert::premultiply_gray_alpha(&transformed_data[y * idata.width * 2ull], idata.width);
+
                 if (y < idata.height - 1)
                     data_stream.flush_byte_reversed();
             }
 
             in_out = std::move(transformed_data);
+            BufferPool::release(pool, std::move(grayscaled_data));
         }
 
         static void deinterlace(png_data& idata, ImageData::Container& in_out)
@@ -284,27 +419,35 @@ namespace XIL {
             #endif
         }
 
-        static void downscale(ImageData::Container& in_out, uint8_t channels)
+        // Downscales 16 bit channels to 8 bits in place, one row at a time
+        static void downscale(const png_data& idata, ImageData::Container& in_out, uint8_t channels)
         {
-            auto upscaled = std::move(in_out);
-            ImageData::Container downscaled;
-            downscaled.resize(in_out.size() / 2);
+            size_t row_size = static_cast<size_t>(idata.width) * channels;
 
-            assert(!(upscaled.size() % 2));
-            for (size_t pix = 0; pix < upscaled.size(); pix += 2)
-            {
-                uint16_t upscaled_channel = *reinterpret_cast<uint16_t*>(&upscaled[pix]);
+            assert(in_out.size() >= idata.row_bytes * idata.height);
 
-                if XIL_CONSTEXPR (host_endiannes() == byte_order::BIG)
-                        upscaled_channel = XIL_U16_SWAP(upscaled_channel);
+            uint8_t* data = in_out.data();
 
-                uint8_t downscaled_channel = downscale_16_to_8(upscaled_channel);
+            for (size_t y = 0; y < idata.height; y++)
+            {
+                uint8_t* row = data + y * row_size;
+
+                for (size_t i = 0; i < row_size; i++)
+                {
+                    // channels are stored big endian
+                    size_t pix = (y * row_size + i) * 2;
+                    uint16_t upscaled_channel = (data[pix] << 8) | data[pix + 1];
 
+                    row[i] = downscale_16_to_8(upscaled_channel);
+                }
 
-                downscaled.push_back(downscaled_channel);
+                if (idata.premultiply && (channels == 4))
+                    Convert::premultiply_rgba(row, idata.width);
             }
 
-            in_out = std::move(downscaled);
+            // only ever shrinks, growing would leave garbage (see PixelContainer)
+            assert(row_size <= idata.row_bytes);
+            in_out.resize(row_size * idata.height);
         }
 
         static uint8_t pixel_to_the_left(uint8_t* start_of_row, size_t x, size_t pixel_stride)
@@ -334,24 +477,13 @@ namespace XIL {
             return *pixel;
         }
 
-        static void unfilter_values(const png_data& idata, ImageData::Container& in_out)
+        static void unfilter_values(const png_data& idata, ImageData::Container& in_out, MipBuilder* mips)
         {
-            float channel_stride = idata.bit_depth / 8.0f;
-
-            size_t channels_per_pixel = 0;
+            size_t pixel_stride = idata.pixel_stride;
+            size_t true_byte_width = idata.row_bytes;
 
-            if (idata.color_type == 0 || idata.color_type == 3)
-                channels_per_pixel = 1;
-            else if (idata.color_type == 2)
-                channels_per_pixel = 3;
-            else if (idata.color_type == 4)
-                channels_per_pixel = 2;
-            else if (idata.color_type == 6)
-                channels_per_pixel = 4;
-
-            float true_pixel_stride = channels_per_pixel * channel_stride;
-            size_t pixel_stride = static_cast<size_t>(ceil(true_pixel_stride));
-            size_t true_byte_width = static_cast<size_t>(ceil(idata.width * true_pixel_stride));
+            if (in_out.size() < idata.filtered_size)
+                throw std::runtime_error("Not enough image data");
 
             for (size_t y = 0; y < idata.height; y++)
             {
@@ -363,21 +495,21 @@ namespace XIL {
                 switch (filter_method)
                 {
                 case 0:
-                    continue;
+                    break;
                 case 1:
                     for (size_t x = 1; x < true_byte_width + 1; x++)
                     {
                         uint8_t ptl = pixel_to_the_left(row_begin, x, pixel_stride);
                         in_out[start_of_row + x] = in_out[start_of_row + x] + ptl;
                     }
-                    continue;
+                    break;
                 case 2:
                     for (size_t x = 1; x < true_byte_width + 1; x++)
                     {
                         auto pa = pixel_above(row_begin, x, y, true_byte_width);
                         in_out[start_of_row + x] = in_out[start_of_row + x] + pa;
                     }
-                    continue;
+                    break;
                 case 3:
                     for (size_t x = 1; x < true_byte_width + 1; x++)
                     {
@@ -388,7 +520,7 @@ namespace XIL {
 
                         in_out[start_of_row + x] = in_out[start_of_row + x] + unfiltered_value;
                     }
-                    continue;
+                    break;
                 case 4:
                     for (size_t x = 1; x < true_byte_width + 1; x++)
                     {
@@ -413,32 +545,38 @@ namespace XIL {
 
                         in_out[start_of_row + x] = in_out[start_of_row + x] + value;
                     }
-                    continue;
+                    break;
                 default:
                     throw std::runtime_error("Unknown filter method (!= 4)");
                 }
+
+                // the row above is no longer needed for unfiltering,
+                // so it can be moved into its final place right away
+                if (y)
+                    compact_row(idata, in_out, y - 1, true_byte_width, mips);
             }
 
-            // remove all scanline filter method bytes
-            size_t byte_count = 0;
+            if (idata.height)
+                compact_row(idata, in_out, idata.height - 1, true_byte_width, mips);
 
-            auto is_filter_method_byte =
-                [&](uint8_t)
-                {
-                    if ((byte_count % (true_byte_width + 1)) == 0)
-                    {
-                        byte_count++;
-                        return true;
-                    }
-                    else
-                    {
-                        byte_count++;
-                        return false;
-                    }
-                };
+            // drops the filter bytes, only ever shrinks (see PixelContainer)
+            assert(true_byte_width * idata.height <= in_out.size());
+            in_out.resize(true_byte_width * idata.height);
+        }
+
+        // Removes the filter method byte in front of the row,
+        // and applies any per row post processing while it's still hot in cache
+        static void compact_row(const png_data& idata, ImageData::Container& in_out, size_t y, size_t true_byte_width, MipBuilder* mips)
+        {
+            uint8_t* row = in_out.data() + y * true_byte_width;
+
+            memmove(row, row + y + 1, true_byte_width);
 
-            auto erase_begin = std::remove_if(in_out.begin(), in_out.end(), is_filter_method_byte);
-            in_out.erase(erase_begin, in_out.end());
+            if (idata.premultiply && (idata.color_type == 6) && (idata.bit_depth == 8))
+                Convert::premultiply_rgba(row, idata.width);
+
+            if (mips)
+                mips->row_ready(y);
         }
 
         static void validate_zlib_header(const zlib_header& header)
@@ -449,11 +587,19 @@ namespace XIL {
                 throw std::runtime_error("PNG can't be compressed with preset dictionaries");
         }
 
-        static void read_chunk(DataStream& file, chunk& into)
+        template<typename Source>
+        static void read_chunk(Source& file, chunk& into)
         {
-            into.length = file.get_u32_big();
+            uint8_t header[8];
+            file.get_n(sizeof(header), header);
+
+            DataCursor fields(header, sizeof(header));
+            into.length = fields.get_u32_big();
+            fields.get_n(4, into.type);
 
-            file.get_n(4, into.type);
+            // the spec limits chunk lengths to 2^31 - 1
+            if (into.length > INT32_MAX)
+                throw std::runtime_error("Invalid PNG chunk length (> 2^31 - 1)");
             into.data = file.get_subset(into.length);
 
             into.crc = file.get_u32_big();
@@ -461,26 +607,81 @@ namespace XIL {
 
         static void read_zlib_header(chunk& from, png_data& into)
         {
+            DataCursor header = from.data.get_cursor(2);
+            uint8_t cmf = header.get_u8();
+            uint8_t flg = header.get_u8();
+
             into.zheader.set = true;
-            into.zheader.compression_method = from.data.get_bits(0, 4);
-            into.zheader.compression_info   = from.data.get_bits(4, 4);
-            from.data.next_byte();
-            into.zheader.fcheck = from.data.get_bits(0, 5);
-            into.zheader.fdict  = from.data.get_bit(5);
-            into.zheader.flevel = from.data.get_bits(6, 2);
-            from.data.next_byte();
+            into.zheader.compression_method = cmf & XIL_BITS(4);
+            into.zheader.compression_info   = cmf >> 4;
+            into.zheader.fcheck = flg & XIL_BITS(5);
+            into.zheader.fdict  = (flg >> 5) & XIL_BIT(0);
+            into.zheader.flevel = flg >> 6;
         }
 
         static void read_header(chunk& from, png_data& into)
         {
-            into.width  = from.data.get_u32_big();
-            into.height = from.data.get_u32_big();
-
-            into.bit_depth          = from.data.get_u8();
-            into.color_type         = from.data.get_u8();
-            into.compression_method = from.data.get_u8();
-            into.filter_method      = from.data.get_u8();
-            into.interlace_method   = from.data.get_u8();
+            // IHDR is always 13 bytes long
+            DataCursor fields = from.data.get_cursor(13);
+
+            into.width  = fields.get_u32_big();
+            into.height = fields.get_u32_big();
+
+            into.bit_depth          = fields.get_u8();
+            into.color_type         = fields.get_u8();
+            into.compression_method = fields.get_u8();
+            into.filter_method      = fields.get_u8();
+            into.interlace_method   = fields.get_u8();
+
+            compute_sizes(into);
+        }
+
+        static void compute_sizes(png_data& idata)
+        {
+            // the spec limits both dimensions to 2^31 - 1
+            if (idata.width > INT32_MAX || idata.height > INT32_MAX)
+                throw std::runtime_error("Invalid PNG dimensions (> 2^31 - 1)");
+
+            size_t channels_per_pixel = 0;
+            bool valid_depth = false;
+
+            switch (idata.color_type)
+            {
+            case 0: // grayscale
+                channels_per_pixel = 1;
+                valid_depth = idata.bit_depth == 1 || idata.bit_depth == 2 || idata.bit_depth == 4 ||
+                              idata.bit_depth == 8 || idata.bit_depth == 16;
+                break;
+            case 3: // palette indices
+                channels_per_pixel = 1;
+                valid_depth = idata.bit_depth == 1 || idata.bit_depth == 2 ||
+                              idata.bit_depth == 4 || idata.bit_depth == 8;
+                break;
+            case 2: // RGB
+                channels_per_pixel = 3;
+                valid_depth = idata.bit_depth == 8 || idata.bit_depth == 16;
+                break;
+            case 4: // grayscale + alpha
+                channels_per_pixel = 2;
+                valid_depth = idata.bit_depth == 8 || idata.bit_depth == 16;
+                break;
+            case 6: // RGBA
+                channels_per_pixel = 4;
+                valid_depth = idata.bit_depth == 8 || idata.bit_depth == 16;
+                break;
+            default:
+                throw std::runtime_error("Invalid color type");
+            }
+
+            if (!valid_depth)
+                throw std::runtime_error("Invalid bit depth for the color type");
+
+            size_t bits_per_pixel = channels_per_pixel * idata.bit_depth;
+
+            idata.pixel_stride  = (bits_per_pixel + 7) / 8;
+            idata.row_bytes     = checked_add(checked_mul(idata.width, bits_per_pixel), 7) / 8;
+            idata.filtered_size = checked_mul(checked_add(idata.row_bytes, 1), idata.height);
+            idata.pixels        = checked_mul(idata.width, idata.height);
         }
 
         static bool is_ancillary(const chunk& chnk)
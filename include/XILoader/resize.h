@@ -0,0 +1,600 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "utils.h"
+#include "image_view.h"
+#include "thread_pool.h"
+
+namespace XIL {
+
+    enum class ResizeFilter
+    {
+        BOX      = 0, // average of the covered pixels, nearest neighbour when enlarging
+        BILINEAR = 1, // triangle
+        MITCHELL = 2, // cubic with B = C = 1/3, a little blur and hardly any ringing
+        LANCZOS3 = 3  // windowed sinc, the sharpest, rings around hard edges
+    };
+
+    struct ResizeOptions
+    {
+        ResizeFilter filter = ResizeFilter::MITCHELL;
+
+        // weight the colors of GRAY_A and RGBA images by alpha so that transparent pixels don't bleed into
+        // the visible ones, Image::resize() skips it for images that are already premultiplied
+        bool alpha_weighted = true;
+
+        // helps the calling thread resample bands of rows, nullptr resizes on the calling thread alone
+        ThreadPool* thread_pool = nullptr;
+    };
+
+    // Separable resampling of 8 bit images. The weights of each axis are computed once, then source rows
+    // are filtered horizontally into 16 bit rows, which a ring buffer keeps around for the vertical pass.
+    class Resampler
+    {
+    public:
+        // fractional bits of the weights and of the pixels in between the passes
+        static constexpr int weight_bits = 14;
+        static constexpr int pixel_bits = 6;
+
+        // destination rows per band, see ThreadPool::parallel_rows
+        static constexpr size_t min_rows_per_thread = 16;
+
+        // Fixed point weights of the source pixels of every destination pixel along one axis.
+        // Destination pixel 'i' is filtered from count(i) pixels starting at first(i), taps falling
+        // outside of the source are folded onto its edge pixels. The weights of every pixel are padded
+        // with zeros to taps(), a multiple of 'multiple', so kernels can take several at a time.
+        class Weights
+        {
+        private:
+            std::vector<size_t> m_First;
+            std::vector<size_t> m_Count;
+            std::vector<int16_t> m_Weights;
+            size_t m_Taps;
+            size_t m_MaxCount;
+        public:
+            Weights(size_t src_size, size_t dst_size, ResizeFilter filter, size_t multiple = 1)
+                : m_First(dst_size),
+                m_Count(dst_size),
+                m_Taps(0),
+                m_MaxCount(0)
+            {
+                double scale = static_cast<double>(dst_size) / src_size;
+
+                // the filter spans more source pixels when shrinking
+                double stretch = std::max(1.0 / scale, 1.0);
+                double radius = support(filter) * stretch;
+
+                std::vector<double> window;
+                std::vector<std::vector<double>> weights(dst_size);
+
+                for (size_t i = 0; i < dst_size; i++)
+                {
+                    double center = (i + 0.5) / scale;
+                    auto lo = static_cast<int64_t>(std::floor(center - radius));
+                    auto hi = static_cast<int64_t>(std::ceil(center + radius));
+
+                    size_t first = clamp_index(lo, src_size);
+                    window.assign(clamp_index(hi, src_size) - first + 1, 0.0);
+
+                    double sum = 0.0;
+
+                    for (int64_t j = lo; j <= hi; j++)
+                    {
+                        double weight = kernel(filter, (j + 0.5 - center) / stretch);
+
+                        window[clamp_index(j, src_size) - first] += weight;
+                        sum += weight;
+                    }
+
+                    if (sum == 0.0)
+                    {
+                        // only possible for degenerate sizes, take the closest pixel
+                        first = clamp_index(static_cast<int64_t>(center), src_size);
+                        window.assign(1, sum = 1.0);
+                    }
+
+                    // weights on the edges of the window can be 0
+                    size_t begin = 0, end = window.size();
+
+                    while (end - begin > 1 && window[begin] == 0.0) begin++;
+                    while (end - begin > 1 && window[end - 1] == 0.0) end--;
+
+                    m_First[i] = first + begin;
+                    weights[i].assign(window.begin() + begin, window.begin() + end);
+
+                    for (auto& weight : weights[i])
+                        weight /= sum;
+
+                    m_MaxCount = std::max(m_MaxCount, weights[i].size());
+                }
+
+                m_Taps = (m_MaxCount + multiple - 1) / multiple * multiple;
+                m_Weights.assign(checked_mul(m_Taps, dst_size), 0);
+
+                for (size_t i = 0; i < dst_size; i++)
+                    quantize(weights[i], m_Weights.data() + i * m_Taps, m_Count[i]);
+            }
+
+            size_t first(size_t i) const noexcept
+            {
+                return m_First[i];
+            }
+
+            // weights of destination pixel 'i' that aren't padding
+            size_t count(size_t i) const noexcept
+            {
+                return m_Count[i];
+            }
+
+            const int16_t* weights(size_t i) const noexcept
+            {
+                return m_Weights.data() + i * m_Taps;
+            }
+
+            size_t taps() const noexcept
+            {
+                return m_Taps;
+            }
+
+            size_t max_count() const noexcept
+            {
+                return m_MaxCount;
+            }
+
+        private:
+            static size_t clamp_index(int64_t index, size_t size) noexcept
+            {
+                return static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(index, 0), static_cast<int64_t>(size) - 1));
+            }
+
+            // Rounds to fixed point, the rounding error goes to the largest weight so that they sum to 1 exactly
+            static void quantize(const std::vector<double>& weights, int16_t* out, size_t& count) noexcept
+            {
+                int sum = 0;
+                size_t largest = 0;
+
+                for (size_t k = 0; k < weights.size(); k++)
+                {
+                    out[k] = static_cast<int16_t>(std::lround(weights[k] * (1 << weight_bits)));
+                    sum += out[k];
+
+                    if (weights[k] > weights[largest])
+                        largest = k;
+                }
+
+                out[largest] = static_cast<int16_t>(out[largest] + (1 << weight_bits) - sum);
+                count = weights.size();
+            }
+        };
+
+        Resampler() = delete;
+
+        // Radius of the filter in pixels when it isn't stretched
+        static double support(ResizeFilter filter) noexcept
+        {
+            switch (filter)
+            {
+            case ResizeFilter::BOX:      return 0.5;
+            case ResizeFilter::BILINEAR: return 1.0;
+            case ResizeFilter::MITCHELL: return 2.0;
+            default:                     return 3.0;
+            }
+        }
+
+        static double kernel(ResizeFilter filter, double x) noexcept
+        {
+            const double pi = 3.14159265358979323846;
+
+            switch (filter)
+            {
+            case ResizeFilter::BOX:
+                // half open so that a pixel on the edge between two others is counted once
+                return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+            case ResizeFilter::BILINEAR:
+                x = std::fabs(x);
+                return x < 1.0 ? 1.0 - x : 0.0;
+            case ResizeFilter::MITCHELL:
+            {
+                const double b = 1.0 / 3.0, c = 1.0 / 3.0;
+                x = std::fabs(x);
+
+                if (x < 1.0)
+                    return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6;
+                if (x < 2.0)
+                    return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x + (8 * b + 24 * c)) / 6;
+                return 0.0;
+            }
+            default:
+                if (x == 0.0)
+                    return 1.0;
+                if (x <= -3.0 || x >= 3.0)
+                    return 0.0;
+                return 3.0 * std::sin(pi * x) * std::sin(pi * x / 3.0) / (pi * pi * x * x);
+            }
+        }
+
+        // Resamples 'src' into 'dst', which has to have as many channels
+        static void resize(ConstImageView src, ImageView dst, const ResizeOptions& options = {})
+        {
+            if (src.empty() || dst.empty())
+                throw std::runtime_error("Can't resize from or to an empty image");
+
+            if (src.channels() != dst.channels())
+                throw std::runtime_error("The source and destination of a resize need the same channels");
+
+            const uint8_t channels = src.channels();
+            const bool weighted = options.alpha_weighted && (channels == 2 || channels == 4);
+
+            // the horizontal kernels take 16 bytes worth of taps at a time
+            const Weights horizontal(src.width(), dst.width(), options.filter, channels == 1 ? 8 : (channels == 2 ? 4 : 2));
+            const Weights vertical(src.height(), dst.height(), options.filter, 2);
+
+            ThreadPool::parallel_rows(options.thread_pool, dst.height(), min_rows_per_thread,
+                [&](size_t first, size_t last) { resample_rows(src, dst, horizontal, vertical, weighted, first, last); });
+        }
+
+    private:
+        // Rows [first, last) of 'dst'. The source rows they need are filtered horizontally once each into a ring
+        // of max_count() rows, the windows of the vertical weights only ever move down.
+        static void resample_rows(ConstImageView src, ImageView dst, const Weights& horizontal, const Weights& vertical,
+                                  bool weighted, size_t first, size_t last) noexcept
+        {
+            const uint8_t channels = dst.channels();
+            const size_t lanes = dst.width() * channels;
+
+            // the kernels read and write up to a vector past the end of a row
+            const size_t stride = lanes + 8;
+            const size_t ring_rows = vertical.max_count();
+
+            std::vector<int16_t> ring(ring_rows * stride);
+            std::vector<int16_t> widened((src.width() + horizontal.taps()) * channels + 8);
+            std::vector<int16_t> filtered(stride);
+            std::vector<const int16_t*> rows(vertical.taps());
+
+            size_t next = vertical.first(first);
+
+            for (size_t y = first; y < last; y++)
+            {
+                size_t top = vertical.first(y);
+                size_t count = vertical.count(y);
+
+                for (next = std::max(next, top); next < top + count; next++)
+                {
+                    widen_row(src.row_unchecked(next).data(), widened.data(), src.width(), channels, weighted);
+                    filter_row(widened.data(), ring.data() + (next % ring_rows) * stride, horizontal, dst.width(), channels);
+                }
+
+                // padding taps have no weight, any row will do
+                for (size_t k = 0; k < rows.size(); k++)
+                    rows[k] = ring.data() + ((top + (k < count ? k : 0)) % ring_rows) * stride;
+
+                filter_column(rows.data(), vertical.weights(y), vertical.taps(), filtered.data(), lanes);
+                narrow_row(filtered.data(), dst.row_unchecked(y).data(), dst.width(), channels, weighted);
+            }
+        }
+
+        // 8 bit pixels to 16 bit ones with pixel_bits fractional bits, premultiplied by alpha if 'weighted'
+        static void widen_row(const uint8_t* src, int16_t* dst, size_t width, uint8_t channels, bool weighted) noexcept
+        {
+            size_t i = 0;
+            size_t count = width * channels;
+
+            if (!weighted)
+            {
+            #ifdef XIL_SSE2
+                const __m128i zero = _mm_setzero_si128();
+
+                for (; i + 16 <= count; i += 16)
+                {
+                    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_slli_epi16(_mm_unpacklo_epi8(px, zero), pixel_bits));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_slli_epi16(_mm_unpackhi_epi8(px, zero), pixel_bits));
+                }
+            #endif
+
+                for (; i < count; i++)
+                    dst[i] = static_cast<int16_t>(src[i] << pixel_bits);
+
+                return;
+            }
+
+        #ifdef XIL_SSE2
+            if (channels == 4)
+                i = premultiply_lanes<_MM_SHUFFLE(3, 3, 3, 3)>(src, dst, count, _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0));
+            else
+                i = premultiply_lanes<_MM_SHUFFLE(3, 3, 1, 1)>(src, dst, count, _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0));
+        #endif
+
+            for (; i < count; i += channels)
+            {
+                uint32_t alpha = src[i + channels - 1];
+
+                for (size_t c = 0; c + 1 < channels; c++)
+                    dst[i + c] = static_cast<int16_t>((src[i + c] * alpha * premultiply_factor) >> 16);
+
+                dst[i + channels - 1] = static_cast<int16_t>(alpha << pixel_bits);
+            }
+        }
+
+        // color * alpha * 2^pixel_bits / 255, rounded down
+        static constexpr uint32_t premultiply_factor = (1u << pixel_bits) * 257;
+
+    #ifdef XIL_SSE2
+        template<int AlphaShuffle>
+        static size_t premultiply_lanes(const uint8_t* src, int16_t* dst, size_t count, __m128i alpha_lanes) noexcept
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i factor = _mm_set1_epi16(static_cast<short>(premultiply_factor));
+
+            size_t i = 0;
+
+            for (; i + 16 <= count; i += 16)
+            {
+                __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i halves[2] = { _mm_unpacklo_epi8(px, zero), _mm_unpackhi_epi8(px, zero) };
+
+                for (size_t h = 0; h < 2; h++)
+                {
+                    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], AlphaShuffle), AlphaShuffle);
+                    __m128i colors = _mm_mulhi_epu16(_mm_mullo_epi16(halves[h], alpha), factor);
+                    __m128i widened = _mm_or_si128(_mm_and_si128(alpha_lanes, _mm_slli_epi16(halves[h], pixel_bits)),
+                                                   _mm_andnot_si128(alpha_lanes, colors));
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8 * h), widened);
+                }
+            }
+
+            return i;
+        }
+    #endif
+
+        static int16_t round_weighted(int32_t sum) noexcept
+        {
+            sum = (sum + (1 << (weight_bits - 1))) >> weight_bits;
+            return static_cast<int16_t>(std::min<int32_t>(std::max<int32_t>(sum, INT16_MIN), INT16_MAX));
+        }
+
+        static void filter_row(const int16_t* src, int16_t* dst, const Weights& weights, size_t width, uint8_t channels) noexcept
+        {
+        #ifdef XIL_SSE2
+            switch (channels)
+            {
+            case 1:  filter_row_gray(src, dst, weights, width);    break;
+            case 2:  filter_row_gray_alpha(src, dst, weights, width); break;
+            case 3:  filter_row_pairs<3>(src, dst, weights, width); break;
+            default: filter_row_pairs<4>(src, dst, weights, width); break;
+            }
+        #else
+            const size_t taps = weights.taps();
+
+            for (size_t x = 0; x < width; x++, dst += channels)
+            {
+                const int16_t* from = src + weights.first(x) * channels;
+                const int16_t* w = weights.weights(x);
+
+                for (size_t c = 0; c < channels; c++)
+                {
+                    int32_t sum = 0;
+
+                    for (size_t k = 0; k < taps; k++)
+                        sum += w[k] * from[k * channels + c];
+
+                    dst[c] = round_weighted(sum);
+                }
+            }
+        #endif
+        }
+
+    #ifdef XIL_SSE2
+        static __m128i round_weighted(__m128i sums) noexcept
+        {
+            return _mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(1 << (weight_bits - 1))), weight_bits);
+        }
+
+        // 8 taps per multiply
+        static void filter_row_gray(const int16_t* src, int16_t* dst, const Weights& weights, size_t width) noexcept
+        {
+            const size_t taps = weights.taps();
+
+            for (size_t x = 0; x < width; x++)
+            {
+                const int16_t* from = src + weights.first(x);
+                const int16_t* w = weights.weights(x);
+                __m128i sums = _mm_setzero_si128();
+
+                for (size_t k = 0; k < taps; k += 8)
+                    sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(from + k)),
+                                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + k))));
+
+                sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 8));
+                sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+
+                dst[x] = static_cast<int16_t>(_mm_cvtsi128_si32(_mm_packs_epi32(round_weighted(sums), sums)));
+            }
+        }
+
+        // 4 taps per multiply, the gray and alpha values of pixel pairs are gathered next to each other
+        static void filter_row_gray_alpha(const int16_t* src, int16_t* dst, const Weights& weights, size_t width) noexcept
+        {
+            const size_t taps = weights.taps();
+
+            for (size_t x = 0; x < width; x++, dst += 2)
+            {
+                const int16_t* from = src + weights.first(x) * 2;
+                const int16_t* w = weights.weights(x);
+                __m128i sums = _mm_setzero_si128();
+
+                for (size_t k = 0; k < taps; k += 4)
+                {
+                    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + k * 2));
+                    px = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+
+                    __m128i quad = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(w + k));
+                    sums = _mm_add_epi32(sums, _mm_madd_epi16(px, _mm_unpacklo_epi32(quad, quad)));
+                }
+
+                sums = round_weighted(_mm_add_epi32(sums, _mm_srli_si128(sums, 8)));
+
+                int32_t packed = _mm_cvtsi128_si32(_mm_packs_epi32(sums, sums));
+                memcpy(dst, &packed, 4);
+            }
+        }
+
+        // 2 taps per multiply, the channels of neighbouring pixels are interleaved. RGB stores a 4th
+        // value, which the next pixel overwrites (the row is padded for the last one).
+        template<size_t Channels>
+        static void filter_row_pairs(const int16_t* src, int16_t* dst, const Weights& weights, size_t width) noexcept
+        {
+            const size_t taps = weights.taps();
+
+            for (size_t x = 0; x < width; x++, dst += Channels)
+            {
+                const int16_t* from = src + weights.first(x) * Channels;
+                const int16_t* w = weights.weights(x);
+                __m128i sums = _mm_setzero_si128();
+
+                for (size_t k = 0; k < taps; k += 2)
+                {
+                    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + k * Channels));
+                    px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, Channels * 2));
+
+                    int32_t pair;
+                    memcpy(&pair, w + k, 4);
+                    sums = _mm_add_epi32(sums, _mm_madd_epi16(px, _mm_set1_epi32(pair)));
+                }
+
+                sums = round_weighted(sums);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(sums, sums));
+            }
+        }
+    #endif
+
+        // Weighted sum of 'rows' for each of 'lanes' values, 'taps' is even
+        static void filter_column(const int16_t* const* rows, const int16_t* weights, size_t taps, int16_t* dst, size_t lanes) noexcept
+        {
+        #ifdef XIL_SSE2
+            // 8 values of two rows per iteration, the rows are padded to a multiple of 8
+            for (size_t i = 0; i < lanes; i += 8)
+            {
+                __m128i lo = _mm_setzero_si128();
+                __m128i hi = _mm_setzero_si128();
+
+                for (size_t k = 0; k < taps; k += 2)
+                {
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i));
+
+                    int32_t pair;
+                    memcpy(&pair, weights + k, 4);
+                    __m128i w = _mm_set1_epi32(pair);
+
+                    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+                    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(round_weighted(lo), round_weighted(hi)));
+            }
+        #else
+            for (size_t i = 0; i < lanes; i++)
+            {
+                int32_t sum = 0;
+
+                for (size_t k = 0; k < taps; k++)
+                    sum += weights[k] * rows[k][i];
+
+                dst[i] = round_weighted(sum);
+            }
+        #endif
+        }
+
+        // Back to 8 bits, unpremultiplied if 'weighted'
+        static void narrow_row(const int16_t* src, uint8_t* dst, size_t width, uint8_t channels, bool weighted) noexcept
+        {
+            size_t i = 0;
+            size_t count = width * channels;
+
+            if (!weighted)
+            {
+            #ifdef XIL_SSE2
+                const __m128i rounding = _mm_set1_epi16(1 << (pixel_bits - 1));
+
+                for (; i + 16 <= count; i += 16)
+                {
+                    __m128i lo = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), rounding), pixel_bits);
+                    __m128i hi = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)), rounding), pixel_bits);
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+                }
+            #endif
+
+                for (; i < count; i++)
+                    dst[i] = clamp_255((std::min(src[i] + (1 << (pixel_bits - 1)), INT16_MAX)) >> pixel_bits);
+
+                return;
+            }
+
+        #ifdef XIL_SSE2
+            if (channels == 4)
+                i = unpremultiply_lanes<_MM_SHUFFLE(3, 3, 3, 3)>(src, dst, count, _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1)));
+            else
+                i = unpremultiply_lanes<_MM_SHUFFLE(3, 3, 1, 1)>(src, dst, count, _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1)));
+        #endif
+
+            // the same single precision steps as the vector code, so both round alike
+            for (; i < count; i += channels)
+            {
+                float alpha = src[i + channels - 1];
+                float scale = alpha > 0.0f ? 255.0f / alpha : 0.0f;
+
+                for (size_t c = 0; c + 1 < channels; c++)
+                    dst[i + c] = clamp_255(static_cast<int32_t>(std::lrint(src[i + c] * scale)));
+
+                dst[i + channels - 1] = clamp_255(static_cast<int32_t>(std::lrint(alpha * (1.0f / (1 << pixel_bits)))));
+            }
+        }
+
+        static uint8_t clamp_255(int32_t value) noexcept
+        {
+            return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+        }
+
+    #ifdef XIL_SSE2
+        template<int AlphaShuffle>
+        static size_t unpremultiply_lanes(const int16_t* src, uint8_t* dst, size_t count, __m128 alpha_lanes) noexcept
+        {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 max = _mm_set1_ps(255.0f);
+            const __m128 unscale = _mm_set1_ps(1.0f / (1 << pixel_bits));
+
+            size_t i = 0;
+
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i sign = _mm_srai_epi16(values, 15);
+                __m128i halves[2] = { _mm_unpacklo_epi16(values, sign), _mm_unpackhi_epi16(values, sign) };
+
+                for (size_t h = 0; h < 2; h++)
+                {
+                    __m128 px = _mm_cvtepi32_ps(halves[h]);
+                    __m128 alpha = _mm_shuffle_ps(px, px, AlphaShuffle);
+                    __m128 scale = _mm_and_ps(_mm_cmpgt_ps(alpha, zero), _mm_div_ps(max, alpha));
+
+                    px = _mm_or_ps(_mm_and_ps(alpha_lanes, _mm_mul_ps(px, unscale)), _mm_andnot_ps(alpha_lanes, _mm_mul_ps(px, scale)));
+                    halves[h] = _mm_cvtps_epi32(px);
+                }
+
+                __m128i narrowed = _mm_packs_epi32(halves[0], halves[1]);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(narrowed, narrowed));
+            }
+
+            return i;
+        }
+    #endif
+    };
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iterator>
+#include <condition_variable>
+
+#include "XILoader.h"
+
+namespace XIL {
+
+    // Loads an ordered list of files one at a time while a background thread reads the next ones,
+    // so the I/O of the upcoming files overlaps with decoding the current one
+    class SequenceLoader
+    {
+    public:
+        class iterator
+        {
+        private:
+            SequenceLoader* m_Loader;
+            Image m_Current;
+            size_t m_Index;
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type        = Image;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = Image*;
+            using reference         = Image&;
+
+            iterator() noexcept
+                : m_Loader(nullptr),
+                m_Index(0)
+            {
+            }
+
+            explicit iterator(SequenceLoader* loader)
+                : m_Loader(loader),
+                m_Index(0)
+            {
+                advance();
+            }
+
+            // The image can be moved out, it's replaced by the next one on increment
+            Image& operator*() noexcept { return m_Current; }
+            Image* operator->() noexcept { return &m_Current; }
+
+            // position of the current image in the list of paths
+            size_t index() const noexcept { return m_Index; }
+
+            iterator& operator++()
+            {
+                advance();
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const noexcept { return m_Loader == other.m_Loader; }
+            bool operator!=(const iterator& other) const noexcept { return m_Loader != other.m_Loader; }
+
+        private:
+            void advance()
+            {
+                if (!m_Loader)
+                    return;
+
+                m_Index = m_Loader->m_Delivered;
+
+                if (!m_Loader->next(m_Current))
+                    m_Loader = nullptr;
+            }
+        };
+
+    private:
+        std::vector<std::string> m_Paths;
+        LoadOptions m_Options;
+        size_t m_Prefetch;
+        size_t m_MemoryBudget;
+        size_t m_Delivered;
+
+        // files read ahead in order, guarded by m_Mutex
+        std::deque<DataStream> m_Ready;
+        size_t m_ReadyBytes;
+        bool m_Stopping;
+
+        std::mutex m_Mutex;
+        std::condition_variable m_Changed;
+        std::thread m_Reader;
+    public:
+        // Keeps at most 'prefetch' files read ahead, and stops reading ahead while they take
+        // 'memory_budget' bytes or more, so the budget can be exceeded by at most one file.
+        explicit SequenceLoader(std::vector<std::string> paths, size_t prefetch = 4,
+                                size_t memory_budget = 256 * 1024 * 1024, const LoadOptions& options = {})
+            : m_Paths(std::move(paths)),
+            m_Options(options),
+            m_Prefetch(prefetch ? prefetch : 1),
+            m_MemoryBudget(memory_budget),
+            m_Delivered(0),
+            m_ReadyBytes(0),
+            m_Stopping(false)
+        {
+            m_Reader = std::thread([this]() { read_ahead(); });
+        }
+
+        SequenceLoader(const SequenceLoader&) = delete;
+        SequenceLoader& operator=(const SequenceLoader&) = delete;
+
+        size_t size() const noexcept
+        {
+            return m_Paths.size();
+        }
+
+        // Decodes the next image in order on the calling thread, images that couldn't
+        // be loaded are empty. Returns false once every image has been delivered.
+        bool next(Image& into)
+        {
+            if (m_Delivered == m_Paths.size())
+                return false;
+
+            DataStream file;
+
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Changed.wait(lock, [this]() { return !m_Ready.empty(); });
+
+                file = std::move(m_Ready.front());
+                m_Ready.pop_front();
+                m_ReadyBytes -= file.bytes_left();
+            }
+
+            m_Changed.notify_all();
+            m_Delivered++;
+
+            if (file.bytes_left())
+                into = Loader::load_raw(file.data_ptr(), file.bytes_left(), m_Options);
+            else
+                into = {};
+
+            return true;
+        }
+
+        iterator begin() { return iterator(this); }
+        iterator end() noexcept { return iterator(); }
+
+        ~SequenceLoader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stopping = true;
+            }
+
+            m_Changed.notify_all();
+            m_Reader.join();
+        }
+
+    private:
+        void read_ahead()
+        {
+            for (const auto& path : m_Paths)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_Changed.wait(lock,
+                        [this]()
+                        {
+                            return m_Stopping || (m_Ready.size() < m_Prefetch && m_ReadyBytes < m_MemoryBudget);
+                        });
+
+                    if (m_Stopping)
+                        return;
+                }
+
+                DataStream file;
+
+                try {
+                    pread_file(path, file);
+                }
+                catch (const std::exception&) // delivered as an empty image
+                {
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_ReadyBytes += file.bytes_left();
+                    m_Ready.push_back(std::move(file));
+                }
+
+                m_Changed.notify_all();
+            }
+        }
+    };
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "image.h"
+
+namespace XIL {
+
+    // Reference counted handle to a decoded image, copies share the pixels instead of copying them.
+    // The image is read only through the handle, so any number of threads can read it at once,
+    // mutate() gives a handle its own copy first if the pixels are shared (copy-on-write).
+    // Like std::shared_ptr, a single handle must not be used from several threads without locking,
+    // separate handles to the same image can.
+    class SharedImage
+    {
+    private:
+        std::shared_ptr<Image> m_Image;
+    public:
+        SharedImage() = default;
+
+        // Takes over the pixels of 'image' without copying them
+        SharedImage(Image&& image)
+            : m_Image(image ? std::make_shared<Image>(std::move(image)) : nullptr)
+        {
+        }
+
+        // An empty image if the handle is empty
+        const Image& get() const noexcept
+        {
+            static const Image empty;
+            return m_Image ? *m_Image : empty;
+        }
+
+        const Image& operator*()  const noexcept { return get(); }
+        const Image* operator->() const noexcept { return &get(); }
+
+        ConstImageView view() const noexcept
+        {
+            return get().view();
+        }
+
+        bool ok() const noexcept
+        {
+            return get().ok();
+        }
+
+        operator bool() const noexcept
+        {
+            return ok();
+        }
+
+        // number of handles sharing the image, only a hint while other threads copy or drop handles
+        long use_count() const noexcept
+        {
+            return m_Image.use_count();
+        }
+
+        // true if no other handle references the image
+        bool unique() const noexcept
+        {
+            if (m_Image.use_count() != 1)
+                return false;
+
+            // pairs with the release of the other handles, so their reads happen before our writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+
+        // The image for writing, cloned first if other handles share it so they keep seeing the old pixels.
+        // The reference is valid until the handle is copied to, assigned or destroyed.
+        Image& mutate()
+        {
+            if (!m_Image)
+                m_Image = std::make_shared<Image>();
+            else if (!unique())
+                m_Image = std::make_shared<Image>(m_Image->clone());
+
+            return *m_Image;
+        }
+
+        // Moves the image out of the handle, cloning it if other handles share it, and leaves the handle empty
+        Image release()
+        {
+            if (!m_Image)
+                return Image();
+
+            Image image = unique() ? std::move(*m_Image) : m_Image->clone();
+            m_Image.reset();
+
+            return image;
+        }
+
+        void reset() noexcept
+        {
+            m_Image.reset();
+        }
+    };
+}
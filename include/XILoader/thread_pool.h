@@ -0,0 +1,338 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+namespace XIL {
+
+    // Fixed size pool of worker threads executing tasks in submission order,
+    // tasks must not throw
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> m_Workers;
+        std::deque<std::function<void()>> m_Tasks;
+        std::mutex m_Mutex;
+        std::condition_variable m_TaskAvailable;
+        std::condition_variable m_Idle;
+        size_t m_Busy;
+        bool m_Stopping;
+    public:
+        explicit ThreadPool(size_t threads = default_thread_count())
+            : m_Busy(0),
+            m_Stopping(false)
+        {
+            if (!threads)
+                threads = 1;
+
+            m_Workers.reserve(threads);
+
+            for (size_t i = 0; i < threads; i++)
+                m_Workers.emplace_back([this]() { work(); });
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        static size_t default_thread_count() noexcept
+        {
+            auto count = std::thread::hardware_concurrency();
+
+            return count ? count : 1;
+        }
+
+        size_t size() const noexcept
+        {
+            return m_Workers.size();
+        }
+
+        void submit(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Tasks.push_back(std::move(task));
+            }
+
+            m_TaskAvailable.notify_one();
+        }
+
+        // Blocks until every submitted task has finished
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Idle.wait(lock, [this]() { return m_Tasks.empty() && !m_Busy; });
+        }
+
+        // Runs fn(0) to fn(count - 1) on the calling thread and on up to count - 1 workers of 'pool',
+        // only on the calling thread without a pool. Returns once they've all run, without waiting for
+        // the other tasks of the pool, so it can be shared and even called from one of its tasks.
+        // The calling thread keeps taking indices as well, so busy workers only mean less help. 'fn' must not throw.
+        template<typename Fn>
+        static void parallel_for(ThreadPool* pool, size_t count, const Fn& fn)
+        {
+            if (!pool || count < 2)
+            {
+                for (size_t i = 0; i < count; i++)
+                    fn(i);
+
+                return;
+            }
+
+            struct shared_state
+            {
+                std::atomic<size_t> next{ 0 };
+                std::mutex mutex;
+                std::condition_variable finished;
+                size_t done = 0;
+            };
+
+            // workers getting to their task after every index was taken only touch the state
+            auto state = std::make_shared<shared_state>();
+
+            auto run = [state, count, &fn]()
+            {
+                for (size_t i; (i = state->next.fetch_add(1)) < count;)
+                {
+                    fn(i);
+
+                    std::lock_guard<std::mutex> lock(state->mutex);
+
+                    if (++state->done == count)
+                        state->finished.notify_all();
+                }
+            };
+
+            for (size_t i = 1; i < std::min(count, pool->size() + 1); i++)
+                pool->submit(run);
+
+            run();
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->finished.wait(lock, [&]() { return state->done == count; });
+        }
+
+        // Splits rows [0, rows) into a band per thread, of 'min_rows' rows at least since smaller bands aren't
+        // worth waking threads for, and runs fn(first, last) on each through parallel_for. Meant for a pool kept
+        // around and shared with other work rather than one per call.
+        template<typename Fn>
+        static void parallel_rows(ThreadPool* pool, size_t rows, size_t min_rows, const Fn& fn)
+        {
+            size_t threads = pool ? pool->size() + 1 : 1;
+            size_t bands = std::max<size_t>(std::min(threads, rows / std::max<size_t>(min_rows, 1)), 1);
+
+            parallel_for(pool, bands, [&](size_t band) { fn(rows * band / bands, rows * (band + 1) / bands); });
+        }
+
+        // Finishes the queued tasks before joining
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stopping = true;
+            }
+
+            m_TaskAvailable.notify_all();
+
+            for (auto& worker : m_Workers)
+                worker.join();
+        }
+
+    private:
+        void work()
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_TaskAvailable.wait(lock, [this]() { return m_Stopping || !m_Tasks.empty(); });
+
+                    if (m_Tasks.empty())
+                        return;
+
+                    task = std::move(m_Tasks.front());
+                    m_Tasks.pop_front();
+                    m_Busy++;
+                }
+
+                task();
+
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_Busy--;
+
+                    if (m_Tasks.empty() && !m_Busy)
+                        m_Idle.notify_all();
+                }
+            }
+        }
+    };
+
+    // Fixed size pool of worker threads with a queue each. Tasks are spread over the queues round robin,
+    // a worker runs the tasks of its own queue in submission order and once it runs out takes the
+    // last task of another queue, so no worker idles while others still have tasks queued.
+    // Tasks must not throw.
+    class WorkStealingPool
+    {
+    private:
+        struct TaskQueue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> m_Queues;
+        std::vector<std::thread> m_Workers;
+
+        // tasks sitting in the queues and tasks not finished yet, a task is counted before it's queued
+        std::atomic<size_t> m_Queued;
+        std::atomic<size_t> m_Pending;
+        std::atomic<size_t> m_NextQueue;
+        std::atomic<size_t> m_Steals;
+
+        std::mutex m_Mutex;
+        std::condition_variable m_TaskAvailable;
+        std::condition_variable m_Idle;
+        bool m_Stopping;
+    public:
+        explicit WorkStealingPool(size_t threads = ThreadPool::default_thread_count())
+            : m_Queued(0),
+            m_Pending(0),
+            m_NextQueue(0),
+            m_Steals(0),
+            m_Stopping(false)
+        {
+            if (!threads)
+                threads = 1;
+
+            m_Queues.reserve(threads);
+            m_Workers.reserve(threads);
+
+            for (size_t i = 0; i < threads; i++)
+                m_Queues.emplace_back(new TaskQueue());
+
+            for (size_t i = 0; i < threads; i++)
+                m_Workers.emplace_back([this, i]() { work(i); });
+        }
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        size_t size() const noexcept
+        {
+            return m_Workers.size();
+        }
+
+        // tasks taken from the queue of another worker so far
+        size_t steals() const noexcept
+        {
+            return m_Steals.load(std::memory_order_relaxed);
+        }
+
+        void submit(std::function<void()> task)
+        {
+            auto& queue = *m_Queues[m_NextQueue.fetch_add(1, std::memory_order_relaxed) % m_Queues.size()];
+
+            m_Pending.fetch_add(1);
+            m_Queued.fetch_add(1);
+
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+
+            // a worker that saw no queued tasks is either asleep already or holds m_Mutex
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_TaskAvailable.notify_one();
+        }
+
+        // Blocks until every submitted task has finished
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Idle.wait(lock, [this]() { return !m_Pending.load(); });
+        }
+
+        // Finishes the queued tasks before joining
+        ~WorkStealingPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stopping = true;
+            }
+
+            m_TaskAvailable.notify_all();
+
+            for (auto& worker : m_Workers)
+                worker.join();
+        }
+
+    private:
+        bool take(size_t worker, std::function<void()>& task)
+        {
+            for (size_t i = 0; i < m_Queues.size(); i++)
+            {
+                auto& queue = *m_Queues[(worker + i) % m_Queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+
+                if (queue.tasks.empty())
+                    continue;
+
+                // the owner takes the oldest task, thieves the newest one
+                if (!i)
+                {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                else
+                {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                    m_Steals.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                m_Queued.fetch_sub(1);
+                return true;
+            }
+
+            return false;
+        }
+
+        void work(size_t worker)
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+
+                if (!take(worker, task))
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_TaskAvailable.wait(lock, [this]() { return m_Stopping || m_Queued.load(); });
+
+                    if (!m_Queued.load())
+                        return;
+
+                    // counted but possibly not queued yet
+                    continue;
+                }
+
+                task();
+                task = nullptr;
+
+                if (m_Pending.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_Idle.notify_all();
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+
+#include "utils.h"
+#include "image_view.h"
+
+namespace XIL {
+
+    // Geometric transforms between two views of the same number of channels,
+    // 'dst' must not overlap 'src'. Rotations are clockwise.
+    class Transform
+    {
+    private:
+        // pixels per side of the square tiles the transposing transforms work in,
+        // a source and a destination tile fit into L1 together
+        static constexpr size_t tile_size = 32;
+    public:
+        Transform() = delete;
+
+        static void flip_horizontal(ConstImageView src, ImageView dst)
+        {
+            validate(src, dst, false);
+
+            for (size_t y = 0; y < src.height(); y++)
+                reverse_row(dst.row_unchecked(y).data(), src.row_unchecked(y).data(), src.width(), src.channels());
+        }
+
+        static void rotate_180(ConstImageView src, ImageView dst)
+        {
+            validate(src, dst, false);
+
+            for (size_t y = 0; y < src.height(); y++)
+                reverse_row(dst.row_unchecked(src.height() - y - 1).data(), src.row_unchecked(y).data(), src.width(), src.channels());
+        }
+
+        // 'dst' has to be src.height() x src.width()
+        static void transpose(ConstImageView src, ImageView dst)
+        {
+            validate(src, dst, true);
+
+            // src(x, y) goes to dst(y, x)
+            transpose_tiles(src, dst.data(), dst.pitch(), 1);
+        }
+
+        static void rotate_90(ConstImageView src, ImageView dst)
+        {
+            validate(src, dst, true);
+
+            // src(x, y) goes to dst(height - y - 1, x)
+            transpose_tiles(src, dst.row_unchecked(0)[dst.width() - 1], dst.pitch(), -1);
+        }
+
+        static void rotate_270(ConstImageView src, ImageView dst)
+        {
+            validate(src, dst, true);
+
+            // src(x, y) goes to dst(y, width - x - 1)
+            transpose_tiles(src, dst.row_unchecked(dst.height() - 1).data(), -static_cast<ptrdiff_t>(dst.pitch()), 1);
+        }
+
+        // Writes the 'count' pixels of 'src' to 'dst' in reverse order
+        static void reverse_row(uint8_t* dst, const uint8_t* src, size_t count, uint8_t channels) noexcept
+        {
+            switch (channels)
+            {
+            case 1:
+                reverse_pixels<1>(dst, src, count);
+                break;
+            case 2:
+                reverse_pixels<2>(dst, src, count);
+                break;
+            case 3:
+                reverse_pixels<3>(dst, src, count);
+                break;
+            case 4:
+                reverse_pixels<4>(dst, src, count);
+                break;
+            }
+        }
+
+    private:
+        static void validate(const ConstImageView& src, const ImageView& dst, bool transposed)
+        {
+            if (src.channels() != dst.channels() || !src.channels() || src.channels() > 4)
+                throw std::runtime_error("Both views have to have the same number of channels");
+
+            size_t width = transposed ? src.height() : src.width();
+            size_t height = transposed ? src.width() : src.height();
+
+            if (dst.width() != width || dst.height() != height)
+                throw std::runtime_error("The destination view has the wrong dimensions");
+        }
+
+        template<size_t C>
+        static void copy_pixel(uint8_t* dst, const uint8_t* src) noexcept
+        {
+            for (size_t c = 0; c < C; c++)
+                dst[c] = src[c];
+        }
+
+        template<size_t C>
+        static void reverse_pixels(uint8_t* dst, const uint8_t* src, size_t count) noexcept
+        {
+            size_t i = 0;
+
+        #ifdef XIL_SSE2
+            // 16 bytes of 'dst' per iteration, loaded from the mirrored end of 'src'
+            if (C != 3)
+            {
+                const size_t per_vector = 16 / C;
+
+                for (; i + per_vector <= count; i += per_vector)
+                {
+                    auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (count - i - per_vector) * C));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * C), reverse_vector<C>(px));
+                }
+            }
+        #endif
+
+        #ifdef XIL_SSSE3
+            // 5 pixels per iteration, loaded one byte early so that the load never crosses the end
+            // of the row, the 16th byte stored is rewritten by the next iteration
+            if (C == 3)
+            {
+                const __m128i reverse = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, 0);
+
+                for (; i + 6 <= count; i += 5)
+                {
+                    auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (count - i - 5) * 3 - 1));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(px, reverse));
+                }
+            }
+        #endif
+
+            // 'from' walks down from the end of the pixels left while 'dst' walks up, which bounds the loop for the compiler
+            const uint8_t* from = src + (count - i) * C;
+
+            for (dst += i * C; from != src; dst += C)
+            {
+                from -= C;
+                copy_pixel<C>(dst, from);
+            }
+        }
+
+    #ifdef XIL_SSE2
+        template<size_t C>
+        static __m128i reverse_vector(__m128i px) noexcept
+        {
+        #ifdef XIL_SSSE3
+            if (C == 1)
+                return _mm_shuffle_epi8(px, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+        #endif
+
+            // reverse the 32 bit lanes, then the 16 bit lanes within them and the bytes within those
+            px = _mm_shuffle_epi32(px, _MM_SHUFFLE(0, 1, 2, 3));
+
+            if (C == 4)
+                return px;
+
+            px = _mm_shufflelo_epi16(px, _MM_SHUFFLE(2, 3, 0, 1));
+            px = _mm_shufflehi_epi16(px, _MM_SHUFFLE(2, 3, 0, 1));
+
+            if (C == 2)
+                return px;
+
+            return _mm_or_si128(_mm_slli_epi16(px, 8), _mm_srli_epi16(px, 8));
+        }
+    #endif
+
+        // Copies src(x, y) to 'origin' + x * 'row_step' + y * 'column_step' * channels, walking
+        // the source in square tiles so that both sides stay in cache. 'column_step' is 1 or -1.
+        static void transpose_tiles(const ConstImageView& src, uint8_t* origin, ptrdiff_t row_step, ptrdiff_t column_step)
+        {
+            switch (src.channels())
+            {
+            case 1:
+                transpose_tiles<1>(src, origin, row_step, column_step);
+                break;
+            case 2:
+                transpose_tiles<2>(src, origin, row_step, column_step);
+                break;
+            case 3:
+                transpose_tiles<3>(src, origin, row_step, column_step);
+                break;
+            case 4:
+                transpose_tiles<4>(src, origin, row_step, column_step);
+                break;
+            }
+        }
+
+        template<size_t C>
+        static void transpose_tiles(const ConstImageView& src, uint8_t* origin, ptrdiff_t row_step, ptrdiff_t column_step)
+        {
+            // pixels per side of the blocks transposed in registers
+            const size_t block = C == 1 ? 8 : 4;
+            const bool simd = block_transposable<C>();
+
+            auto destination = [&](size_t x, size_t y)
+            {
+                return origin + static_cast<ptrdiff_t>(x) * row_step + static_cast<ptrdiff_t>(y * C) * column_step;
+            };
+
+            for (size_t tile_y = 0; tile_y < src.height(); tile_y += tile_size)
+            {
+                size_t end_y = std::min(tile_y + tile_size, src.height());
+
+                for (size_t tile_x = 0; tile_x < src.width(); tile_x += tile_size)
+                {
+                    size_t end_x = std::min(tile_x + tile_size, src.width());
+                    size_t y = tile_y;
+
+                    for (; simd && y + block <= end_y; y += block)
+                    {
+                        size_t x = tile_x;
+
+                        // rows are loaded in the order they end up in memory
+                        const uint8_t* rows[8];
+                        for (size_t i = 0; i < block; i++)
+                            rows[i] = src.row_unchecked(column_step > 0 ? y + i : y + block - i - 1).data();
+
+                        for (; x + block <= end_x; x += block)
+                            transpose_block<C>(rows, x, destination(x, column_step > 0 ? y : y + block - 1), row_step);
+
+                        for (; x < end_x; x++)
+                            for (size_t i = y; i < y + block; i++)
+                                copy_pixel<C>(destination(x, i), src.pixel_unchecked(x, i));
+                    }
+
+                    for (; y < end_y; y++)
+                    {
+                        const uint8_t* row = src.row_unchecked(y).data();
+
+                        for (size_t x = tile_x; x < end_x; x++)
+                            copy_pixel<C>(destination(x, y), row + x * C);
+                    }
+                }
+            }
+        }
+
+        template<size_t C>
+        static constexpr bool block_transposable() noexcept
+        {
+        #if defined(XIL_SSSE3)
+            return true;
+        #elif defined(XIL_SSE2)
+            return C != 3;
+        #else
+            return false;
+        #endif
+        }
+
+        // Transposes the block of pixels at column 'x' of 'rows', column i of the block is stored
+        // as one contiguous run at 'to' + i * 'row_step'. 3 channels need SSSE3.
+        template<size_t C>
+        static void transpose_block(const uint8_t* const* rows, size_t x, uint8_t* to, ptrdiff_t row_step) noexcept
+        {
+        #ifdef XIL_SSE2
+            if (C == 4)
+            {
+                // 4x4 32 bit pixels
+                __m128i columns[4];
+                transpose_4x4(columns,
+                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + x * 4)),
+                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + x * 4)),
+                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + x * 4)),
+                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[3] + x * 4)));
+
+                for (size_t i = 0; i < 4; i++)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(to + static_cast<ptrdiff_t>(i) * row_step), columns[i]);
+            }
+        #ifdef XIL_SSSE3
+            else if (C == 3)
+            {
+                // 4x4 24 bit pixels widened to 32 bits and narrowed back, 12 bytes at a time
+                const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+                const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+                __m128i columns[4];
+                transpose_4x4(columns,
+                              _mm_shuffle_epi8(load_12(rows[0] + x * 3), widen),
+                              _mm_shuffle_epi8(load_12(rows[1] + x * 3), widen),
+                              _mm_shuffle_epi8(load_12(rows[2] + x * 3), widen),
+                              _mm_shuffle_epi8(load_12(rows[3] + x * 3), widen));
+
+                for (size_t i = 0; i < 4; i++)
+                {
+                    __m128i column = _mm_shuffle_epi8(columns[i], narrow);
+                    uint8_t* at = to + static_cast<ptrdiff_t>(i) * row_step;
+                    int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(column, 8));
+
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(at), column);
+                    memcpy(at + 8, &tail, sizeof(tail));
+                }
+            }
+        #endif
+            else if (C == 2)
+            {
+                // 4x4 16 bit pixels
+                __m128i r0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[0] + x * 2));
+                __m128i r1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[1] + x * 2));
+                __m128i r2 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[2] + x * 2));
+                __m128i r3 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[3] + x * 2));
+
+                __m128i t0 = _mm_unpacklo_epi16(r0, r1);
+                __m128i t1 = _mm_unpacklo_epi16(r2, r3);
+
+                store_halves(to, row_step, _mm_unpacklo_epi32(t0, t1));
+                store_halves(to + 2 * row_step, row_step, _mm_unpackhi_epi32(t0, t1));
+            }
+            else if (C == 1)
+            {
+                // 8x8 bytes
+                __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[0] + x)),
+                                               _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[1] + x)));
+                __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[2] + x)),
+                                               _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[3] + x)));
+                __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[4] + x)),
+                                               _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[5] + x)));
+                __m128i a3 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[6] + x)),
+                                               _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[7] + x)));
+
+                __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+                __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+                __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+                __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+                store_halves(to, row_step, _mm_unpacklo_epi32(b0, b2));
+                store_halves(to + 2 * row_step, row_step, _mm_unpackhi_epi32(b0, b2));
+                store_halves(to + 4 * row_step, row_step, _mm_unpacklo_epi32(b1, b3));
+                store_halves(to + 6 * row_step, row_step, _mm_unpackhi_epi32(b1, b3));
+            }
+        #else
+            XIL_UNUSED(rows);
+            XIL_UNUSED(x);
+            XIL_UNUSED(to);
+            XIL_UNUSED(row_step);
+        #endif
+        }
+
+    #ifdef XIL_SSE2
+        static void transpose_4x4(__m128i* columns, __m128i r0, __m128i r1, __m128i r2, __m128i r3) noexcept
+        {
+            __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+            __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+            __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+            __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+            columns[0] = _mm_unpacklo_epi64(t0, t1);
+            columns[1] = _mm_unpackhi_epi64(t0, t1);
+            columns[2] = _mm_unpacklo_epi64(t2, t3);
+            columns[3] = _mm_unpackhi_epi64(t2, t3);
+        }
+
+        // exactly 12 bytes, so the load never crosses the end of the row
+        static __m128i load_12(const uint8_t* from) noexcept
+        {
+            int32_t tail;
+            memcpy(&tail, from + 8, sizeof(tail));
+
+            return _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(from)), _mm_cvtsi32_si128(tail));
+        }
+
+        // the low 8 bytes go to 'to', the high ones a row further
+        static void store_halves(uint8_t* to, ptrdiff_t row_step, __m128i columns) noexcept
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(to), columns);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(to + row_step), _mm_unpackhi_epi64(columns, columns));
+        }
+    #endif
+    };
+}
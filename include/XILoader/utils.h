@@ -34,6 +34,29 @@
 
 #define XIL_READ_EXACTLY(bytes, dst, dst_size, file) (bytes == XIL_READ(bytes, dst, dst_size, file))
 
+#if defined(__unix__) || defined(__APPLE__)
+    #define XIL_POSIX
+#endif
+
+// Define XIL_NO_MMAP to always read files into memory instead of mapping them
+#if !defined(XIL_NO_MMAP) && defined(XIL_POSIX)
+    #define XIL_MMAP
+#endif
+
+// Define XIL_NO_IO_URING to always use the thread pool for batch reads
+#if !defined(XIL_NO_IO_URING) && defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define XIL_IO_URING
+    #endif
+#endif
+
+// Define XIL_NO_PMR to store pixels in a plain std::vector, without std::pmr support
+#if !defined(XIL_NO_PMR) && (_MSVC_LANG >= 201703L || __cplusplus >= 201703L) && defined(__has_include)
+    #if __has_include(<memory_resource>)
+        #define XIL_PMR
+    #endif
+#endif
+
 // the only valid pre c++20 compile time endianness detection?
 #define XIL_IS_LITTLE_ENDIAN ('ABCD' == 0x41424344UL)
 #define XIL_IS_BIG_ENDIAN    ('ABCD' == 0x44434241UL)
@@ -48,6 +71,18 @@
     #define XIL_CONSTEXPR
 #endif
 
+// Define XIL_NO_SIMD to force the scalar code paths
+#if !defined(XIL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define XIL_SSE2
+    #include <emmintrin.h>
+#endif
+
+// MSVC doesn't have a dedicated SSSE3 switch, AVX implies it
+#if defined(XIL_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+    #define XIL_SSSE3
+    #include <tmmintrin.h>
+#endif
+
 namespace XIL {
 
     enum class byte_order
@@ -82,4 +117,22 @@ namespace XIL {
     {
         return static_cast<uint8_t>(std::bitset<32>(x).count());
     }
+
+    // a * b for sizes that come from untrusted headers, throws instead of overflowing
+    inline static size_t checked_mul(size_t a, size_t b)
+    {
+        if (a && (b > SIZE_MAX / a))
+            throw std::runtime_error("Image size overflow");
+
+        return a * b;
+    }
+
+    // a + b for sizes that come from untrusted headers, throws instead of overflowing
+    inline static size_t checked_add(size_t a, size_t b)
+    {
+        if (b > SIZE_MAX - a)
+            throw std::runtime_error("Image size overflow");
+
+        return a + b;
+    }
 }
@@ -0,0 +1,921 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <random>
+
+#include <XILoader/XILoader.h>
+
+#include "bmp_writer.h"
+
+#ifdef XIL_POSIX
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+#else
+    #include <direct.h>
+#endif
+
+#define PATH_TO(image) XIL_TEST_PATH image
+
+#define PRINT_TITLE(str) \
+    std::cout << "================================= " \
+              << str \
+              << " =================================" \
+              << std::endl
+
+#define PRINT_END(str) PRINT_TITLE(str) << std::endl
+
+// Decodes an in-memory copy of the file so only the decoding itself is measured
+#define BENCHMARK_LOAD(subject, path_to_image, iterations) \
+    benchmark_load(subject, read_whole_file(path_to_image), iterations)
+
+#define BENCHMARK_LOAD_RLE(subject, path_to_image, iterations) \
+    benchmark_load(subject, bmp_writer::to_rle(read_whole_file(path_to_image)), iterations)
+
+// Bottom to top 24bpp BMP filled with a repeating pattern
+static std::vector<uint8_t> make_synthetic_bmp(int32_t width, int32_t height)
+{
+    size_t row_padded = (width * 3ull + 3) & ~3ull;
+    std::vector<uint8_t> pixel_array(row_padded * height);
+
+    for (size_t i = 0; i < pixel_array.size(); i++)
+        pixel_array[i] = static_cast<uint8_t>(i * 31);
+
+    return bmp_writer::make_bmp(width, height, 24, 0, {}, pixel_array);
+}
+
+static std::vector<uint8_t> read_whole_file(const std::string& path)
+{
+    XIL::DataStream file;
+    XIL::read_file(path, file);
+
+    return std::vector<uint8_t>(file.data_ptr(), file.data_ptr() + file.bytes_left());
+}
+
+// Best of 'iterations' runs in milliseconds
+template<typename Fn>
+static double time_best_ms(size_t iterations, Fn&& fn)
+{
+    double best = 0.0;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+
+        double elapsed = std::chrono::duration<double, std::milli>(end - begin).count();
+
+        if (!i || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+// Best of 'iterations' runs in milliseconds, 'setup' runs before each one and isn't timed
+template<typename Setup, typename Fn>
+static double time_best_ms(size_t iterations, Setup&& setup, Fn&& fn)
+{
+    double best = 0.0;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        setup();
+        double elapsed = time_best_ms(1, fn);
+
+        if (!i || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+// Drops the file's pages from the page cache so that the next load has to go to the disk
+static bool evict_from_page_cache(const std::string& path)
+{
+#if defined(XIL_POSIX) && defined(POSIX_FADV_DONTNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    fdatasync(fd);
+    bool evicted = !posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    return evicted;
+#else
+    XIL_UNUSED(path);
+    return false;
+#endif
+}
+
+static void report(const char* subject, double ms, size_t pixels, size_t input_bytes = 0)
+{
+    std::cout << subject << "... " << ms << " ms"
+              << " (" << (pixels / 1000.0) / ms << " MPix/s";
+
+    if (input_bytes)
+        std::cout << ", " << input_bytes / 1024 << " KiB input";
+
+    std::cout << ")" << std::endl;
+}
+
+static void benchmark_load(const char* subject, std::vector<uint8_t> file, size_t iterations, const XIL::LoadOptions& options = {})
+{
+    XImage image = XILoader::load_raw(file.data(), file.size(), options);
+
+    if (!image)
+    {
+        std::cout << subject << "... Failed! --> Couldn't load the image" << std::endl;
+        return;
+    }
+
+    double ms = time_best_ms(iterations,
+        [&]()
+        {
+            image = XILoader::load_raw(file.data(), file.size(), options);
+        });
+
+    report(subject, ms, image.width() * image.height(), file.size());
+}
+
+// Loads the image by path with and without memory mapping, with a cold and a warm page cache
+static void benchmark_file_load(const char* subject, const std::string& path, size_t iterations)
+{
+    XImage image = XILoader::load(path);
+
+    if (!image)
+    {
+        std::cout << subject << "... Failed! --> Couldn't load the image" << std::endl;
+        return;
+    }
+
+    size_t pixels = image.width() * image.height();
+    size_t input_bytes = read_whole_file(path).size();
+
+    for (bool memory_map : { true, false })
+    {
+        XIL::LoadOptions options;
+        options.memory_map = memory_map;
+        options.memory_map_min_size = 0;
+
+        auto load = [&]() { image = XILoader::load(path, options); };
+        bool cold_cache = evict_from_page_cache(path);
+
+        std::string mode = std::string(subject) + (memory_map ? " mmap" : " read");
+
+        if (cold_cache)
+            report((mode + " cold").c_str(), time_best_ms(iterations, [&]() { evict_from_page_cache(path); }, load), pixels, input_bytes);
+        else
+            std::cout << mode << " cold... skipped, page cache eviction is not supported" << std::endl;
+
+        load();
+        report((mode + " warm").c_str(), time_best_ms(iterations, load), pixels, input_bytes);
+    }
+}
+
+// Decodes the in-memory copy of the file through a StreamReader, handing out at most 64 KiB per read
+static void benchmark_streamed_load(const char* subject, std::vector<uint8_t> file, size_t iterations)
+{
+    XImage image;
+
+    double ms = time_best_ms(iterations,
+        [&]()
+        {
+            size_t offset = 0;
+            XIL::StreamReader reader(
+                [&](void* to, size_t size) -> size_t
+                {
+                    size = std::min<size_t>({ size, 64 * 1024, file.size() - offset });
+                    memcpy(to, file.data() + offset, size);
+                    offset += size;
+
+                    return size;
+                });
+
+            image = XILoader::load(reader);
+        });
+
+    if (!image)
+    {
+        std::cout << subject << "... Failed! --> Couldn't load the image" << std::endl;
+        return;
+    }
+
+    report(subject, ms, image.width() * image.height(), file.size());
+}
+
+static void make_directory(const std::string& path)
+{
+#ifdef XIL_POSIX
+    mkdir(path.c_str(), 0755);
+#else
+    _mkdir(path.c_str());
+#endif
+}
+
+// Loads every file of 'paths' with each of the approaches, with a cold and a warm page cache
+static void benchmark_batch_load(const std::vector<std::string>& paths, size_t iterations)
+{
+    size_t input_bytes = 0;
+    for (const auto& path : paths)
+        input_bytes += read_whole_file(path).size();
+
+    struct approach
+    {
+        const char* name;
+        std::function<size_t()> load; // returns the number of loaded images
+    };
+
+    approach approaches[] = {
+        // keeps the images as well, so that both sides pay for the same amount of memory
+        { "sequential Loader::load",
+            [&]()
+            {
+                std::vector<XImage> images;
+                for (const auto& path : paths)
+                    images.push_back(XILoader::load(path));
+                return static_cast<size_t>(std::count_if(images.begin(), images.end(), [](const XImage& image) { return static_cast<bool>(image); }));
+            } },
+        { "load_batch io_uring",
+            [&]()
+            {
+                auto images = XILoader::load_batch(paths, {}, XIL::BatchBackend::IO_URING);
+                return static_cast<size_t>(std::count_if(images.begin(), images.end(), [](const XImage& image) { return static_cast<bool>(image); }));
+            } },
+        { "load_batch thread pool",
+            [&]()
+            {
+                auto images = XILoader::load_batch(paths, {}, XIL::BatchBackend::THREAD_POOL);
+                return static_cast<size_t>(std::count_if(images.begin(), images.end(), [](const XImage& image) { return static_cast<bool>(image); }));
+            } },
+    };
+
+    for (auto& a : approaches)
+    {
+        size_t loaded = 0;
+        auto load = [&]() { loaded = a.load(); };
+        auto evict_all = [&]() { for (const auto& path : paths) evict_from_page_cache(path); };
+
+        for (bool cold_cache : { true, false })
+        {
+            double ms = cold_cache ? time_best_ms(iterations, evict_all, load) : time_best_ms(iterations, load);
+
+            std::cout << a.name << (cold_cache ? " cold" : " warm") << "... " << ms << " ms ("
+                      << paths.size() / (ms / 1000.0) << " files/s, "
+                      << (input_bytes / (1024.0 * 1024.0)) / (ms / 1000.0) << " MiB/s)";
+
+            if (loaded != paths.size())
+                std::cout << " --> only " << loaded << " of " << paths.size() << " loaded";
+
+            std::cout << std::endl;
+        }
+    }
+}
+
+// Decodes the frames one at a time in order, once with a Loader::load loop and once through a SequenceLoader
+static void benchmark_sequence_load(const std::vector<std::string>& paths, size_t iterations)
+{
+    size_t input_bytes = 0;
+    for (const auto& path : paths)
+        input_bytes += read_whole_file(path).size();
+
+    struct approach
+    {
+        const char* name;
+        std::function<size_t()> load; // returns the number of loaded images
+    };
+
+    approach approaches[] = {
+        { "Loader::load loop",
+            [&]()
+            {
+                size_t loaded = 0;
+                for (const auto& path : paths)
+                    loaded += static_cast<bool>(XILoader::load(path));
+                return loaded;
+            } },
+        { "SequenceLoader prefetch 4",
+            [&]()
+            {
+                size_t loaded = 0;
+                XIL::SequenceLoader sequence(paths, 4);
+                for (auto& image : sequence)
+                    loaded += static_cast<bool>(image);
+                return loaded;
+            } },
+    };
+
+    for (auto& a : approaches)
+    {
+        size_t loaded = 0;
+        auto load = [&]() { loaded = a.load(); };
+        auto evict_all = [&]() { for (const auto& path : paths) evict_from_page_cache(path); };
+
+        for (bool cold_cache : { true, false })
+        {
+            double ms = cold_cache ? time_best_ms(iterations, evict_all, load) : time_best_ms(iterations, load);
+
+            std::cout << a.name << (cold_cache ? " cold" : " warm") << "... " << ms << " ms ("
+                      << paths.size() / (ms / 1000.0) << " frames/s, "
+                      << (input_bytes / (1024.0 * 1024.0)) / (ms / 1000.0) << " MiB/s)";
+
+            if (loaded != paths.size())
+                std::cout << " --> only " << loaded << " of " << paths.size() << " loaded";
+
+            std::cout << std::endl;
+        }
+    }
+}
+
+void BENCH_BMP()
+{
+    PRINT_TITLE("BMP DECODING BENCHMARK STARTS");
+    BENCHMARK_LOAD("16bpp bitfields 1419x1001", PATH_TO("16bpp_1419x1001.bmp"), 20);
+    BENCHMARK_LOAD("8bpp 1419x1001", PATH_TO("8bpp_1419x1001.bmp"), 20);
+    BENCHMARK_LOAD_RLE("RLE8 8bpp 1419x1001", PATH_TO("8bpp_1419x1001.bmp"), 20);
+    BENCHMARK_LOAD("4bpp 1419x1001", PATH_TO("4bpp_1419x1001.bmp"), 20);
+    BENCHMARK_LOAD_RLE("RLE4 4bpp 1419x1001", PATH_TO("4bpp_1419x1001.bmp"), 20);
+    PRINT_END("BMP DECODING BENCHMARK DONE");
+}
+
+void BENCH_LARGE()
+{
+    PRINT_TITLE("LARGE DIMENSIONS BENCHMARK STARTS");
+    benchmark_load("synthetic 24bpp 1419x1001", make_synthetic_bmp(1419, 1001), 20);
+    benchmark_load("synthetic 24bpp 70000x2000", make_synthetic_bmp(70000, 2000), 3);
+    PRINT_END("LARGE DIMENSIONS BENCHMARK DONE");
+}
+
+void BENCH_BATCH()
+{
+    PRINT_TITLE("BATCH LOADING BENCHMARK STARTS");
+
+    // the small test images replicated x1000, the asset server case where per file
+    // overhead matters more than decoding. load_batch keeps all the decoded images
+    // alive, larger ones would just measure swapping
+    const char* images[] = {
+        "1bpp_8x8.bmp", "1bpp_9x9.bmp", "16bpp_4x4.bmp", "8bpc_rgba_4x4.png",
+        "1bpp_260x401.bmp", "1bpp_260x401_flipped.bmp"
+    };
+    const size_t copies = 1000;
+    const std::string directory = "xil_benchmark_batch/";
+
+    make_directory(directory);
+
+    std::vector<std::string> paths;
+    for (const char* image : images)
+    {
+        auto contents = read_whole_file(std::string(XIL_TEST_PATH) + image);
+
+        for (size_t i = 0; i < copies; i++)
+        {
+            paths.push_back(directory + std::to_string(i) + "_" + image);
+            std::ofstream(paths.back(), std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        }
+    }
+
+    std::cout << paths.size() << " files" << std::endl;
+    benchmark_batch_load(paths, 3);
+
+    for (const auto& path : paths)
+        std::remove(path.c_str());
+
+    std::remove(directory.c_str());
+    PRINT_END("BATCH LOADING BENCHMARK DONE");
+}
+
+// Images per second of a ParallelLoader from 1 thread up to every core, against a Loader::load loop
+static void benchmark_parallel_load(const std::vector<std::string>& paths, size_t iterations)
+{
+    auto count_loaded = [](const std::vector<XIL::BatchResult>& results)
+    {
+        return static_cast<size_t>(std::count_if(results.begin(), results.end(), [](const XIL::BatchResult& result) { return result.ok(); }));
+    };
+
+    // keeps the images as well, so that both sides pay for the same amount of memory
+    double sequential = time_best_ms(iterations,
+        [&]()
+        {
+            std::vector<XImage> images;
+            for (const auto& path : paths)
+                images.push_back(XILoader::load(path));
+        });
+    std::cout << "Loader::load loop... " << sequential << " ms (" << paths.size() / (sequential / 1000.0) << " images/s)" << std::endl;
+
+    size_t cores = XIL::ThreadPool::default_thread_count();
+    std::vector<size_t> thread_counts;
+
+    for (size_t threads = 1; threads < cores; threads *= 2)
+        thread_counts.push_back(threads);
+
+    thread_counts.push_back(cores);
+
+    double single = 0.0;
+
+    for (size_t threads : thread_counts)
+    {
+        XIL::ParallelLoader loader(threads);
+        size_t loaded = 0;
+
+        double ms = time_best_ms(iterations, [&]() { loaded = count_loaded(loader.load(paths)); });
+
+        if (threads == 1)
+            single = ms;
+
+        std::cout << "ParallelLoader " << loader.size() << (threads == 1 ? " thread" : " threads") << "... " << ms << " ms ("
+                  << paths.size() / (ms / 1000.0) << " images/s, x" << single / ms << " over 1 thread)";
+
+        if (loaded != paths.size())
+            std::cout << " --> only " << loaded << " of " << paths.size() << " loaded";
+
+        std::cout << std::endl;
+    }
+}
+
+void BENCH_PARALLEL()
+{
+    PRINT_TITLE("PARALLEL LOADING BENCHMARK STARTS");
+
+    // mixed BMPs and PNGs from 4x4 to 1473x1854, their decoding times differ by orders of magnitude
+    const char* images[] = {
+        "8bpc_rgba_1473x1854.png", "8bpc_rgb_1419x1001.png", "8bpc_rgb_grayscale_1419x1001.png", "8pbc_rgb_400x268.png",
+        "8bpc_rgba_4x4.png", "16bpp_1419x1001.bmp", "8bpp_1419x1001.bmp", "4bpp_1419x1001.bmp", "1bpp_1419x1001.bmp",
+        "1bpp_260x401.bmp", "16bpp_4x4.bmp"
+    };
+
+    std::vector<std::string> paths;
+    for (size_t copy = 0; copy < 4; copy++)
+        for (const char* image : images)
+            paths.push_back(std::string(XIL_TEST_PATH) + image);
+
+    std::cout << paths.size() << " files, " << XIL::ThreadPool::default_thread_count() << " cores" << std::endl;
+    benchmark_parallel_load(paths, 3);
+    PRINT_END("PARALLEL LOADING BENCHMARK DONE");
+}
+
+void BENCH_SEQUENCE()
+{
+    PRINT_TITLE("SEQUENCE LOADING BENCHMARK STARTS");
+
+    // a frame sequence of the larger test images, only one decoded frame is alive at a time
+    const char* images[] = { "16bpp_1419x1001.bmp", "8bpp_1419x1001.bmp", "8bpc_rgba_1473x1854.png" };
+    const size_t copies = 20;
+    const std::string directory = "xil_benchmark_sequence/";
+
+    make_directory(directory);
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < copies; i++)
+    {
+        for (const char* image : images)
+        {
+            auto contents = read_whole_file(std::string(XIL_TEST_PATH) + image);
+
+            paths.push_back(directory + std::to_string(i) + "_" + image);
+            std::ofstream(paths.back(), std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        }
+    }
+
+    std::cout << paths.size() << " frames" << std::endl;
+    benchmark_sequence_load(paths, 3);
+
+    for (const auto& path : paths)
+        std::remove(path.c_str());
+
+    std::remove(directory.c_str());
+    PRINT_END("SEQUENCE LOADING BENCHMARK DONE");
+}
+
+// Decodes the same frame over and over, with every image allocating its own storage and with a pool
+static void benchmark_pooled_load(const char* subject, const std::vector<uint8_t>& file, size_t iterations)
+{
+    XIL::LoadOptions options;
+    options.buffer_pool = std::make_shared<XIL::BufferPool>();
+
+    std::string name = subject;
+    benchmark_load((name + " allocated").c_str(), file, iterations);
+    benchmark_load((name + " pooled").c_str(), file, iterations, options);
+}
+
+void BENCH_BUFFER_POOL()
+{
+    PRINT_TITLE("BUFFER POOL BENCHMARK STARTS");
+    benchmark_pooled_load("16bpp bitfields 1419x1001", read_whole_file(PATH_TO("16bpp_1419x1001.bmp")), 20);
+    benchmark_pooled_load("8bpc RGBA PALETTED 1473x1854", read_whole_file(PATH_TO("8bpc_rgba_paletted_1473x1854.png")), 10);
+    benchmark_pooled_load("synthetic 24bpp 8192x4096", make_synthetic_bmp(8192, 4096), 5);
+    PRINT_END("BUFFER POOL BENCHMARK DONE");
+}
+
+#ifdef XIL_PMR
+static void benchmark_resource_load(const char* subject, const std::vector<uint8_t>& file, size_t iterations)
+{
+    XIL::LoadOptions options;
+    std::string name = subject;
+
+    benchmark_load((name + " default resource").c_str(), file, iterations);
+
+    options.memory_resource = XIL::aligned_resource();
+    benchmark_load((name + " 64 byte aligned").c_str(), file, iterations, options);
+
+    options.memory_resource = XIL::huge_page_resource();
+    benchmark_load((name + " huge pages").c_str(), file, iterations, options);
+}
+
+void BENCH_MEMORY_RESOURCE()
+{
+    PRINT_TITLE("MEMORY RESOURCE BENCHMARK STARTS");
+    benchmark_resource_load("16bpp bitfields 1419x1001", read_whole_file(PATH_TO("16bpp_1419x1001.bmp")), 20);
+    benchmark_resource_load("synthetic 24bpp 8192x4096", make_synthetic_bmp(8192, 4096), 5);
+    PRINT_END("MEMORY RESOURCE BENCHMARK DONE");
+}
+#endif
+
+// Cost of growing an already allocated frame sized buffer, zeroing it like std::vector does and without
+template<typename Container, typename Resize>
+static void benchmark_resize(const char* subject, size_t size, size_t iterations, Resize&& resize)
+{
+    Container buffer;
+    buffer.reserve(size);
+
+    double ms = time_best_ms(iterations,
+        [&]()
+        {
+            buffer.clear();
+            resize(buffer, size);
+        });
+
+    std::cout << subject << "... " << ms << " ms (" << (size / (1024.0 * 1024.0)) / (ms / 1000.0) << " MiB/s)" << std::endl;
+}
+
+void BENCH_UNINITIALIZED()
+{
+    PRINT_TITLE("UNINITIALIZED STORAGE BENCHMARK STARTS");
+
+    const size_t frame_size = 2816ull * 3088 * 4;
+    benchmark_resize<std::vector<uint8_t>>("zeroing resize 2816x3088 RGBA", frame_size, 20,
+        [](std::vector<uint8_t>& buffer, size_t size) { buffer.resize(size); });
+    benchmark_resize<XIL::PixelContainer>("resize_uninitialized 2816x3088 RGBA", frame_size, 20,
+        [](XIL::PixelContainer& buffer, size_t size) { XIL::resize_uninitialized(buffer, size); });
+
+    BENCHMARK_LOAD("8bpc RGBA 2816x3088", PATH_TO("8pbc_rgba_2816x3088.png"), 5);
+    benchmark_load("synthetic 24bpp 8192x4096", make_synthetic_bmp(8192, 4096), 5);
+    PRINT_END("UNINITIALIZED STORAGE BENCHMARK DONE");
+}
+
+// The straightforward per pixel loop over the source, writing wherever 'destination' maps each pixel to
+template<typename Destination>
+static void naive_transform(XIL::ConstImageView src, XIL::ImageView dst, Destination&& destination)
+{
+    for (size_t y = 0; y < src.height(); y++)
+    {
+        for (size_t x = 0; x < src.width(); x++)
+        {
+            auto to = destination(x, y, src.width(), src.height());
+            memcpy(dst.pixel_unchecked(to.first, to.second), src.pixel_unchecked(x, y), src.channels());
+        }
+    }
+}
+
+// Every transform out of place, once as a naive per pixel loop and once through XIL::Transform
+static void benchmark_transforms(const char* subject, const char* path_to_image, size_t iterations)
+{
+    using Destination = std::pair<size_t, size_t>(*)(size_t, size_t, size_t, size_t);
+
+    struct Case
+    {
+        const char* name;
+        void (*transform)(XIL::ConstImageView, XIL::ImageView);
+        bool transposed;
+        Destination destination;
+    };
+
+    static const Case cases[] =
+    {
+        { "flip horizontal", &XIL::Transform::flip_horizontal, false,
+          [](size_t x, size_t y, size_t w, size_t) { return std::make_pair(w - x - 1, y); } },
+        { "rotate 180", &XIL::Transform::rotate_180, false,
+          [](size_t x, size_t y, size_t w, size_t h) { return std::make_pair(w - x - 1, h - y - 1); } },
+        { "rotate 90", &XIL::Transform::rotate_90, true,
+          [](size_t x, size_t y, size_t, size_t h) { return std::make_pair(h - y - 1, x); } },
+        { "rotate 270", &XIL::Transform::rotate_270, true,
+          [](size_t x, size_t y, size_t w, size_t) { return std::make_pair(y, w - x - 1); } },
+        { "transpose", &XIL::Transform::transpose, true,
+          [](size_t x, size_t y, size_t, size_t) { return std::make_pair(y, x); } },
+    };
+
+    XImage image = XILoader::load(path_to_image);
+    if (!image)
+    {
+        std::cout << subject << "... couldn't load the image" << std::endl;
+        return;
+    }
+
+    std::vector<uint8_t> pixels(image.width() * image.height() * image.channels());
+    size_t count = image.width() * image.height();
+
+    for (const auto& c : cases)
+    {
+        size_t width = c.transposed ? image.height() : image.width();
+        XIL::ImageView out(pixels.data(), width, count / width, width * image.channels(), image.channels());
+        std::string name = std::string(subject) + " " + c.name;
+
+        report((name + " naive").c_str(), time_best_ms(iterations, [&]() { naive_transform(image.view(), out, c.destination); }), count);
+        report((name + " blocked").c_str(), time_best_ms(iterations, [&]() { c.transform(image.view(), out); }), count);
+    }
+}
+
+void BENCH_TRANSFORMS()
+{
+    PRINT_TITLE("GEOMETRIC TRANSFORMS BENCHMARK STARTS");
+    benchmark_transforms("8bpc GRAY 1419x1001", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"), 10);
+    benchmark_transforms("8bpc GRAY_A 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"), 10);
+    benchmark_transforms("8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"), 10);
+    benchmark_transforms("8bpc RGBA 2816x3088", PATH_TO("8pbc_rgba_2816x3088.png"), 5);
+    PRINT_END("GEOMETRIC TRANSFORMS BENCHMARK DONE");
+}
+
+// Decoding alone next to decoding with a mip chain, built while decoding where the format allows it,
+// and the chain built from an already decoded image in each of the filtering modes
+static void benchmark_mipmaps(const char* subject, const std::vector<uint8_t>& file, size_t iterations)
+{
+    XIL::LoadOptions options;
+    options.generate_mipmaps = true;
+
+    std::string name = subject;
+    benchmark_load((name + " decode").c_str(), file, iterations);
+    benchmark_load((name + " decode with mipmaps").c_str(), file, iterations, options);
+
+    XImage image = XILoader::load_raw(const_cast<uint8_t*>(file.data()), file.size());
+    size_t pixels = image.width() * image.height();
+
+    XIL::MipOptions srgb;
+    srgb.srgb = true;
+
+    XIL::MipOptions weighted;
+    weighted.alpha_weighted = true;
+
+    report((name + " box filter").c_str(), time_best_ms(iterations, [&]() { XIL::Mipmap::generate(image.view()); }), pixels);
+    report((name + " sRGB").c_str(), time_best_ms(iterations, [&]() { XIL::Mipmap::generate(image.view(), srgb); }), pixels);
+
+    if (image.channels() == XIL::Image::GRAY_A || image.channels() == XIL::Image::RGBA)
+        report((name + " alpha weighted").c_str(), time_best_ms(iterations, [&]() { XIL::Mipmap::generate(image.view(), weighted); }), pixels);
+}
+
+void BENCH_MIPMAPS()
+{
+    PRINT_TITLE("MIPMAP BENCHMARK STARTS");
+    benchmark_mipmaps("8bpc GRAY 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_grayscale_1419x1001.png")), 10);
+    benchmark_mipmaps("8bpc GRAY_A 1473x1854", read_whole_file(PATH_TO("8bpc_rgba_grayscale_1473x1854.png")), 10);
+    benchmark_mipmaps("8bpc RGB 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_1419x1001.png")), 10);
+    benchmark_mipmaps("8bpc RGBA 2816x3088", read_whole_file(PATH_TO("8pbc_rgba_2816x3088.png")), 5);
+    benchmark_mipmaps("synthetic 24bpp 4096x4096", make_synthetic_bmp(4096, 4096), 5);
+    PRINT_END("MIPMAP BENCHMARK DONE");
+}
+
+// Root mean square error of the decompressed image over the channels the format encodes,
+// BC1 and BC3 compare RGB(A) images and BC4 and BC5 the first one or two channels
+static double block_rmse(XIL::ConstImageView src, const XIL::CompressedImage& compressed)
+{
+    uint8_t channels = XIL::BlockCompressor::decompressed_channels(compressed.format());
+    size_t compared = compressed.format() == XIL::BlockFormat::BC1 ? 3 : channels;
+    std::vector<uint8_t> pixels(src.width() * src.height() * channels);
+
+    XIL::ImageView dst(pixels.data(), src.width(), src.height(), src.width() * channels, channels);
+    XIL::BlockCompressor::decompress(compressed, dst);
+
+    double sum = 0.0;
+
+    for (size_t y = 0; y < src.height(); y++)
+    {
+        for (size_t x = 0; x < src.width(); x++)
+        {
+            for (size_t c = 0; c < compared; c++)
+            {
+                double d = dst.pixel_unchecked(x, y)[c] - src.pixel_unchecked(x, y)[c];
+                sum += d * d;
+            }
+        }
+    }
+
+    return std::sqrt(sum / (src.width() * src.height() * compared));
+}
+
+// Every quality on one thread and on all of them, the format is picked by the channels of the image
+static void benchmark_block_compression(const char* subject, const std::vector<uint8_t>& file, size_t iterations)
+{
+    static const char* qualities[] = { "FAST", "NORMAL", "HIGH" };
+
+    XImage image = XILoader::load_raw(const_cast<uint8_t*>(file.data()), file.size());
+    size_t pixels = image.width() * image.height();
+
+    // one pool for every texture, the calling thread takes the last core (at least 1 worker)
+    XIL::ThreadPool workers(XIL::ThreadPool::default_thread_count() - 1);
+    XIL::BlockOptions options;
+
+    switch (image.channels())
+    {
+    case XIL::Image::GRAY:   options.format = XIL::BlockFormat::BC4; break;
+    case XIL::Image::GRAY_A: options.format = XIL::BlockFormat::BC5; break;
+    case XIL::Image::RGB:    options.format = XIL::BlockFormat::BC1; break;
+    default:                 options.format = XIL::BlockFormat::BC3; break;
+    }
+
+    for (int quality = 0; quality < 3; quality++)
+    {
+        options.quality = static_cast<XIL::BlockQuality>(quality);
+        std::string name = std::string(subject) + " BC" + std::to_string(static_cast<int>(options.format)) + " " + qualities[quality];
+
+        options.thread_pool = nullptr;
+        report((name + " 1 thread").c_str(), time_best_ms(iterations, [&]() { XIL::BlockCompressor::compress(image.view(), options); }), pixels);
+
+        options.thread_pool = &workers;
+        report((name + " and " + std::to_string(workers.size()) + " pool workers").c_str(),
+               time_best_ms(iterations, [&]() { XIL::BlockCompressor::compress(image.view(), options); }), pixels);
+
+        std::cout << name << " RMSE " << block_rmse(image.view(), XIL::BlockCompressor::compress(image.view(), options)) << std::endl;
+    }
+}
+
+void BENCH_BLOCK_COMPRESSION()
+{
+    PRINT_TITLE("BLOCK COMPRESSION BENCHMARK STARTS");
+    benchmark_block_compression("8bpc GRAY 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_grayscale_1419x1001.png")), 5);
+    benchmark_block_compression("8bpc GRAY_A 1473x1854", read_whole_file(PATH_TO("8bpc_rgba_grayscale_1473x1854.png")), 5);
+    benchmark_block_compression("8bpc RGB 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_1419x1001.png")), 5);
+    benchmark_block_compression("8bpc RGBA 1473x1854", read_whole_file(PATH_TO("8bpc_rgba_1473x1854.png")), 5);
+    benchmark_block_compression("8bpc RGBA 2816x3088", read_whole_file(PATH_TO("8pbc_rgba_2816x3088.png")), 3);
+    PRINT_END("BLOCK COMPRESSION BENCHMARK DONE");
+}
+
+static void benchmark_resize(const char* subject, const std::vector<uint8_t>& file, size_t iterations)
+{
+    static const char* filters[] = { "BOX", "BILINEAR", "MITCHELL", "LANCZOS3" };
+
+    XImage image = XILoader::load_raw(const_cast<uint8_t*>(file.data()), file.size());
+    size_t sizes[][2] = { { image.width() / 2, image.height() / 2 }, { image.width() * 3 / 2, image.height() * 3 / 2 } };
+
+    // one pool for every resize, the calling thread takes the last core (at least 1 worker)
+    XIL::ThreadPool workers(XIL::ThreadPool::default_thread_count() - 1);
+
+    for (auto& size : sizes)
+    {
+        std::vector<uint8_t> pixels(size[0] * size[1] * image.channels());
+        XIL::ImageView dst(pixels.data(), size[0], size[1], size[0] * image.channels(), image.channels());
+
+        for (int filter = 0; filter < 4; filter++)
+        {
+            XIL::ResizeOptions options;
+            options.filter = static_cast<XIL::ResizeFilter>(filter);
+            std::string name = std::string(subject) + " to " + std::to_string(size[0]) + "x" + std::to_string(size[1]) + " " + filters[filter];
+
+            // measured against the larger of the two images, which bounds the work of both passes
+            size_t work = std::max(image.width() * image.height(), size[0] * size[1]);
+
+            options.thread_pool = nullptr;
+            report((name + " 1 thread").c_str(), time_best_ms(iterations, [&]() { XIL::Resampler::resize(image.view(), dst, options); }), work);
+
+            options.thread_pool = &workers;
+            report((name + " and " + std::to_string(workers.size()) + " pool workers").c_str(),
+                   time_best_ms(iterations, [&]() { XIL::Resampler::resize(image.view(), dst, options); }), work);
+        }
+    }
+}
+
+void BENCH_RESIZE()
+{
+    PRINT_TITLE("RESIZE BENCHMARK STARTS");
+
+    // small enough for a per call cost to show
+    benchmark_resize("8bpc RGB 400x268", read_whole_file(PATH_TO("8pbc_rgb_400x268.png")), 20);
+    benchmark_resize("8bpc GRAY 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_grayscale_1419x1001.png")), 5);
+    benchmark_resize("8bpc RGB 1419x1001", read_whole_file(PATH_TO("8bpc_rgb_1419x1001.png")), 5);
+    benchmark_resize("8bpc RGBA 2816x3088", read_whole_file(PATH_TO("8pbc_rgba_2816x3088.png")), 3);
+    PRINT_END("RESIZE BENCHMARK DONE");
+}
+
+// Serves 'requests' lookups skewed towards the first paths (path i is asked for about 1/(i+1) as often)
+// through a cache holding about three quarters of the decoded bytes, spread over 'threads' threads
+static void benchmark_cache_workload(const std::vector<std::string>& paths, size_t budget, size_t requests, size_t threads)
+{
+    std::vector<size_t> picks;
+    for (size_t i = 0; picks.size() < requests; i = (i + 1) % paths.size())
+        for (size_t j = 0; j < paths.size() / (i + 1) && picks.size() < requests; j++)
+            picks.push_back(i);
+
+    std::shuffle(picks.begin(), picks.end(), std::mt19937(7));
+
+    XIL::CacheStats stats{};
+    // every run starts from an empty cache, one is enough
+    double ms = time_best_ms(1,
+        [&]()
+        {
+            XIL::ImageCache cache(budget);
+            std::vector<std::thread> workers;
+
+            for (size_t t = 0; t < threads; t++)
+                workers.emplace_back([&, t]()
+                    {
+                        for (size_t i = t; i < picks.size(); i += threads)
+                            cache.load(paths[picks[i]]);
+                    });
+
+            for (auto& worker : workers)
+                worker.join();
+
+            stats = cache.stats();
+        });
+
+    std::cout << requests << " skewed requests " << threads << (threads == 1 ? " thread" : " threads") << "... " << ms << " ms ("
+              << requests / (ms / 1000.0) << " requests/s, " << 100.0 * stats.hits / requests << "% hits, "
+              << stats.misses << " decoded, " << stats.coalesced << " coalesced, " << stats.evictions << " evicted)" << std::endl;
+}
+
+void BENCH_IMAGE_CACHE()
+{
+    PRINT_TITLE("IMAGE CACHE BENCHMARK STARTS");
+
+    std::string path = PATH_TO("8bpc_rgba_1473x1854.png");
+    auto file = read_whole_file(path);
+    XIL::ImageCache cache(256 * 1024 * 1024);
+    cache.load(path);
+    cache.load_raw(file.data(), file.size());
+
+    report("8bpc RGBA 1473x1854 Loader::load", time_best_ms(10, [&]() { XILoader::load(path); }), 1473 * 1854);
+    report("8bpc RGBA 1473x1854 cache hit by path", time_best_ms(10, [&]() { cache.load(path); }), 1473 * 1854);
+    report("8bpc RGBA 1473x1854 cache hit by content hash", time_best_ms(10, [&]() { cache.load_raw(file.data(), file.size()); }), 1473 * 1854, file.size());
+
+    const char* images[] = {
+        "8bpc_rgba_1473x1854.png", "8bpc_rgb_1419x1001.png", "16bpp_1419x1001.bmp", "8bpc_rgb_grayscale_1419x1001.png",
+        "8bpp_1419x1001.bmp", "4bpp_rgb_paletted_1419x1001.png", "8pbc_rgb_400x268.png", "1bpp_260x401.bmp"
+    };
+
+    std::vector<std::string> paths;
+    size_t decoded_bytes = 0;
+
+    for (const char* image : images)
+    {
+        paths.push_back(std::string(XIL_TEST_PATH) + image);
+        decoded_bytes += XILoader::load(paths.back()).size();
+    }
+
+    benchmark_cache_workload(paths, decoded_bytes * 3 / 4, 400, 1);
+    benchmark_cache_workload(paths, decoded_bytes * 3 / 4, 400, XIL::ThreadPool::default_thread_count() * 2);
+    PRINT_END("IMAGE CACHE BENCHMARK DONE");
+}
+
+void BENCH_STREAMED()
+{
+    PRINT_TITLE("STREAMED PNG BENCHMARK STARTS");
+    BENCHMARK_LOAD("in memory 8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"), 5);
+    benchmark_streamed_load("streamed 8bpc RGBA 1473x1854", read_whole_file(PATH_TO("8bpc_rgba_1473x1854.png")), 5);
+    PRINT_END("STREAMED PNG BENCHMARK DONE");
+}
+
+void BENCH_FILE_INPUT()
+{
+    PRINT_TITLE("FILE INPUT BENCHMARK STARTS");
+    benchmark_file_load("16bpp bitfields 1419x1001", PATH_TO("16bpp_1419x1001.bmp"), 10);
+    benchmark_file_load("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"), 10);
+
+    // large enough for the I/O to dominate the decoding
+    const char* large_path = "xil_benchmark_input.bmp";
+    auto large = make_synthetic_bmp(8192, 4096);
+    std::ofstream(large_path, std::ios::binary).write(reinterpret_cast<const char*>(large.data()), large.size());
+    large = {};
+
+    benchmark_file_load("synthetic 24bpp 8192x4096", large_path, 5);
+    std::remove(large_path);
+    PRINT_END("FILE INPUT BENCHMARK DONE");
+}
+
+int main(int argc, char** argv)
+{
+    BENCH_BMP();
+    BENCH_LARGE();
+    BENCH_FILE_INPUT();
+    BENCH_STREAMED();
+    BENCH_BATCH();
+    BENCH_PARALLEL();
+    BENCH_SEQUENCE();
+    BENCH_BUFFER_POOL();
+#ifdef XIL_PMR
+    BENCH_MEMORY_RESOURCE();
+#endif
+    BENCH_UNINITIALIZED();
+    BENCH_TRANSFORMS();
+    BENCH_MIPMAPS();
+    BENCH_BLOCK_COMPRESSION();
+    BENCH_RESIZE();
+    BENCH_IMAGE_CACHE();
+
+    return 0;
+}
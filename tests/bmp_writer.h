@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// Helpers for building synthetic BMP files in memory
+namespace bmp_writer {
+
+    inline void put_u16(std::vector<uint8_t>& to, uint16_t value)
+    {
+        to.push_back(value & 0xff);
+        to.push_back(value >> 8);
+    }
+
+    inline void put_u32(std::vector<uint8_t>& to, uint32_t value)
+    {
+        put_u16(to, value & 0xffff);
+        put_u16(to, value >> 16);
+    }
+
+    inline uint32_t get_u32(const std::vector<uint8_t>& from, size_t at)
+    {
+        return from[at] | (from[at + 1] << 8) | (from[at + 2] << 16) | (static_cast<uint32_t>(from[at + 3]) << 24);
+    }
+
+    inline uint16_t get_u16(const std::vector<uint8_t>& from, size_t at)
+    {
+        return from[at] | (from[at + 1] << 8);
+    }
+
+    // BITMAPINFOHEADER based file, 'palette' is BGRX, 'pixel_array' is stored as is.
+    // A negative height means top to bottom row order.
+    inline std::vector<uint8_t> make_bmp(
+        int32_t width, int32_t height,
+        uint16_t bpp, uint32_t compression,
+        const std::vector<uint8_t>& palette,
+        const std::vector<uint8_t>& pixel_array)
+    {
+        std::vector<uint8_t> file;
+
+        uint32_t pixel_array_offset = static_cast<uint32_t>(14 + 40 + palette.size());
+
+        file.push_back('B');
+        file.push_back('M');
+        put_u32(file, static_cast<uint32_t>(pixel_array_offset + pixel_array.size()));
+        put_u32(file, 0);
+        put_u32(file, pixel_array_offset);
+
+        put_u32(file, 40);
+        put_u32(file, static_cast<uint32_t>(width));
+        put_u32(file, static_cast<uint32_t>(height));
+        put_u16(file, 1);
+        put_u16(file, bpp);
+        put_u32(file, compression);
+        put_u32(file, static_cast<uint32_t>(pixel_array.size()));
+        put_u32(file, 2835);
+        put_u32(file, 2835);
+        put_u32(file, static_cast<uint32_t>(palette.size() / 4));
+        put_u32(file, 0);
+
+        file.insert(file.end(), palette.begin(), palette.end());
+        file.insert(file.end(), pixel_array.begin(), pixel_array.end());
+
+        return file;
+    }
+
+    // Re-encodes an uncompressed 4 or 8 bpp BITMAPINFOHEADER BMP as RLE4 or RLE8
+    inline std::vector<uint8_t> to_rle(const std::vector<uint8_t>& bmp)
+    {
+        uint32_t pixel_array_offset = get_u32(bmp, 10);
+        uint32_t dib_size = get_u32(bmp, 14);
+        int32_t width = static_cast<int32_t>(get_u32(bmp, 18));
+        int32_t height = static_cast<int32_t>(get_u32(bmp, 22));
+        uint16_t bpp = get_u16(bmp, 28);
+
+        if ((bpp != 4 && bpp != 8) || height < 0)
+            throw std::runtime_error("Only bottom to top 4/8 bpp BMPs can be RLE encoded");
+
+        std::vector<uint8_t> palette(bmp.begin() + 14 + dib_size, bmp.begin() + pixel_array_offset);
+
+        size_t row_padded = ((width * bpp + 31ull) / 32) * 4;
+        std::vector<uint8_t> encoded;
+        std::vector<uint8_t> indices(width);
+
+        for (int32_t y = 0; y < height; y++)
+        {
+            const uint8_t* row = bmp.data() + pixel_array_offset + y * row_padded;
+
+            for (int32_t x = 0; x < width; x++)
+                indices[x] = bpp == 8 ? row[x] : (row[x / 2] >> ((x & 1) ? 0 : 4)) & 0xf;
+
+            int32_t x = 0;
+            while (x < width)
+            {
+                int32_t run = 1;
+                while (x + run < width && run < 255 && indices[x + run] == indices[x])
+                    run++;
+
+                if (run >= 3 || width - x < 3)
+                {
+                    encoded.push_back(static_cast<uint8_t>(run));
+                    encoded.push_back(bpp == 8 ? indices[x] : static_cast<uint8_t>((indices[x] << 4) | indices[x]));
+                    x += run;
+                    continue;
+                }
+
+                // absolute mode until the next run of 3 or more
+                int32_t literal = 0;
+                while (x + literal < width && literal < 255)
+                {
+                    int32_t at = x + literal;
+                    if (at + 2 < width && indices[at] == indices[at + 1] && indices[at] == indices[at + 2])
+                        break;
+                    literal++;
+                }
+
+                if (literal < 3)
+                {
+                    for (int32_t i = 0; i < literal; i++)
+                    {
+                        encoded.push_back(1);
+                        encoded.push_back(bpp == 8 ? indices[x + i] : static_cast<uint8_t>(indices[x + i] << 4));
+                    }
+                    x += literal;
+                    continue;
+                }
+
+                encoded.push_back(0);
+                encoded.push_back(static_cast<uint8_t>(literal));
+
+                size_t start = encoded.size();
+                for (int32_t i = 0; i < literal; i++)
+                {
+                    if (bpp == 8)
+                        encoded.push_back(indices[x + i]);
+                    else if (i & 1)
+                        encoded.back() |= indices[x + i];
+                    else
+                        encoded.push_back(static_cast<uint8_t>(indices[x + i] << 4));
+                }
+
+                if ((encoded.size() - start) & 1)
+                    encoded.push_back(0);
+
+                x += literal;
+            }
+
+            // end of line
+            encoded.push_back(0);
+            encoded.push_back(0);
+        }
+
+        // end of bitmap
+        encoded.push_back(0);
+        encoded.push_back(1);
+
+        return make_bmp(width, height, bpp, bpp == 8 ? 1 : 2, palette, encoded);
+    }
+}
@@ -1,10 +1,19 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <functional>
 
 #include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <thread>
+#include <atomic>
 #include <XILoader/XILoader.h>
 
+#include "bmp_writer.h"
+
 // variables for stbi to write
 // image size data to
 static int x, y, z;
@@ -49,6 +58,35 @@ static uint16_t failed = 0;
     ASSERT_LOADED(UNIQUE_VAR(xil_image)); \
     compare_each(UNIQUE_VAR(xil_image).data(), UNIQUE_VAR(stbi_image), static_cast<size_t>(x)* y* z)
 
+#define LOAD_AND_COMPARE_PREMULTIPLIED(subject, path_to_image) \
+    std::cout << subject "... "; \
+    XIL::LoadOptions UNIQUE_VAR(options); \
+    UNIQUE_VAR(options).premultiply_alpha = true; \
+    auto UNIQUE_VAR(xil_image) = XILoader::load(path_to_image, UNIQUE_VAR(options)); \
+    auto UNIQUE_VAR(stbi_image) = stbi_load(path_to_image, &x, &y, &z, 0); \
+    ASSERT_LOADED(UNIQUE_VAR(xil_image)); \
+    premultiply(UNIQUE_VAR(stbi_image), static_cast<size_t>(x) * y, z); \
+    compare_each(UNIQUE_VAR(xil_image).data(), UNIQUE_VAR(stbi_image), static_cast<size_t>(x)* y* z)
+
+#define LOAD_MAPPED_AND_COMPARE(subject, path_to_image) \
+    std::cout << subject "... "; \
+    XIL::LoadOptions UNIQUE_VAR(options); \
+    UNIQUE_VAR(options).memory_map = true; \
+    UNIQUE_VAR(options).memory_map_min_size = 0; \
+    auto UNIQUE_VAR(xil_image) = XILoader::load(path_to_image, UNIQUE_VAR(options)); \
+    auto UNIQUE_VAR(stbi_image) = stbi_load(path_to_image, &x, &y, &z, 0); \
+    ASSERT_LOADED(UNIQUE_VAR(xil_image)); \
+    compare_each(UNIQUE_VAR(xil_image).data(), UNIQUE_VAR(stbi_image), static_cast<size_t>(x)* y* z)
+
+#define LOAD_RLE_AND_COMPARE(subject, path_to_image) \
+    std::cout << subject "... "; \
+    auto UNIQUE_VAR(bmp) = read_whole_file(path_to_image); \
+    auto UNIQUE_VAR(rle) = bmp_writer::to_rle(UNIQUE_VAR(bmp)); \
+    auto UNIQUE_VAR(xil_image) = XILoader::load_raw(UNIQUE_VAR(rle).data(), UNIQUE_VAR(rle).size()); \
+    auto UNIQUE_VAR(reference) = XILoader::load_raw(UNIQUE_VAR(bmp).data(), UNIQUE_VAR(bmp).size()); \
+    ASSERT_LOADED(UNIQUE_VAR(xil_image)); \
+    compare_each(UNIQUE_VAR(xil_image).data(), UNIQUE_VAR(reference).data(), UNIQUE_VAR(reference).size())
+
 #define PRINT_TEST_RESULTS(passed_count, failed_count) \
     std::cout << "\n\nTEST RESULTS: " \
               << "passed: " << passed_count \
@@ -87,6 +125,25 @@ void compare_each(uint8_t* l, uint8_t* r, size_t size)
     std::cout << "PASSED" << std::endl;
 }
 
+// reference premultiplication, round(color * alpha / 255)
+void premultiply(uint8_t* pixels, size_t count, int channels)
+{
+    if (channels != 2 && channels != 4)
+        return;
+
+    for (size_t i = 0; i < count * channels; i += channels)
+    {
+        for (int c = 0; c < channels - 1; c++)
+            pixels[i + c] = static_cast<uint8_t>((pixels[i + c] * pixels[i + channels - 1] + 127) / 255);
+    }
+}
+
+std::vector<uint8_t> read_whole_file(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
 
 void TEST_BMP()
 {
@@ -140,10 +197,1580 @@ void TEST_PNG()
     PRINT_END("PNG LOADING TEST DONE");
 }
 
+void TEST_RLE()
+{
+    PRINT_TITLE("RLE BMP LOADING TEST STARTS");
+    LOAD_RLE_AND_COMPARE("RLE8 1419x1001", PATH_TO("8bpp_1419x1001.bmp"));
+    LOAD_RLE_AND_COMPARE("RLE4 1419x1001", PATH_TO("4bpp_1419x1001.bmp"));
+
+    // 4x3, bottom row first: a run, a delta, a single pixel,
+    // an end of line, an absolute run and an end of bitmap
+    std::cout << "RLE8 escapes 4x3... ";
+    std::vector<uint8_t> palette = { 0, 0, 0, 0,  0x10, 0x20, 0x30, 0,  0xff, 0xff, 0xff, 0 };
+    std::vector<uint8_t> encoded = { 2, 1,  0, 2, 1, 1,  1, 2,  0, 0,  0, 3, 2, 1, 2, 0,  0, 1 };
+    auto rle = bmp_writer::make_bmp(4, 3, 8, 1, palette, encoded);
+    auto image = XILoader::load_raw(rle.data(), rle.size());
+    uint8_t expected[] = {
+        0xff, 0xff, 0xff,  0x30, 0x20, 0x10,  0xff, 0xff, 0xff,  0, 0, 0,
+        0, 0, 0,           0, 0, 0,           0, 0, 0,           0xff, 0xff, 0xff,
+        0x30, 0x20, 0x10,  0x30, 0x20, 0x10,  0, 0, 0,           0, 0, 0
+    };
+    ASSERT_LOADED(image);
+    compare_each(image.data(), expected, sizeof(expected));
+
+    // every truncation point has to be rejected, the command stream is only validated as a whole
+    std::cout << "RLE8 truncated 4x3... ";
+    size_t loaded_truncated = 0;
+    for (size_t size = 54 + palette.size(); size < rle.size(); size++)
+        loaded_truncated += static_cast<bool>(XILoader::load_raw(rle.data(), size));
+
+    if (loaded_truncated)
+    {
+        std::cout << "FAILED --> " << loaded_truncated << " truncated files were loaded" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    PRINT_END("RLE BMP LOADING TEST DONE");
+}
+
+void TEST_VIEW()
+{
+    PRINT_TITLE("BMP VIEW TEST STARTS");
+
+    std::vector<uint8_t> pixels(37 * 19 * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = static_cast<uint8_t>(i * 7);
+
+    std::cout << "32bpp top to bottom 37x19... ";
+    auto top_to_bottom = bmp_writer::make_bmp(37, -19, 32, 0, {}, pixels);
+    auto view = XILoader::view_raw(top_to_bottom.data(), top_to_bottom.size());
+    ASSERT_LOADED(view);
+    if (view && (view.data() != top_to_bottom.data() + 54 || view.order() != XIL::BorrowedImage::Order::BGRA))
+    {
+        std::cout << "FAILED --> the view doesn't reference the file as BGRA" << std::endl;
+        failed++;
+    }
+    else
+        compare_each(const_cast<uint8_t*>(view.data()), pixels.data(), pixels.size());
+
+    std::cout << "32bpp bitfields against load... ";
+    {
+        const std::vector<uint8_t> bgrx = { 0, 0, 0xff, 0, 0, 0xff, 0, 0, 0xff, 0, 0, 0 };
+        auto bgra = bgrx;
+        bgra.insert(bgra.end(), { 0, 0, 0, 0xff });
+
+        // the unused byte of BGRX is 0, loading makes the image opaque so a view can't expose it as alpha
+        auto no_alpha = bmp_writer::make_bmp(37, -19, 32, 3, bgrx, pixels);
+        auto opaque = XILoader::load_raw(no_alpha.data(), no_alpha.size());
+        size_t mismatches = static_cast<bool>(XILoader::view_raw(no_alpha.data(), no_alpha.size())) || !opaque;
+
+        for (size_t i = 0; opaque && i < opaque.size(); i += 4)
+            mismatches += opaque.data()[i + 3] != 255;
+
+        auto with_alpha = bmp_writer::make_bmp(37, -19, 32, 6, bgra, pixels);
+        auto alpha_view = XILoader::view_raw(with_alpha.data(), with_alpha.size());
+        auto loaded = XILoader::load_raw(with_alpha.data(), with_alpha.size());
+        mismatches += !alpha_view || !loaded || loaded.size() != pixels.size();
+
+        for (size_t i = 0; !mismatches && i < pixels.size(); i += 4)
+            mismatches += alpha_view.data()[i] != loaded.data()[i + 2] || alpha_view.data()[i + 1] != loaded.data()[i + 1] ||
+                          alpha_view.data()[i + 2] != loaded.data()[i] || alpha_view.data()[i + 3] != loaded.data()[i + 3];
+
+        std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+        mismatches ? failed++ : passed++;
+    }
+
+    std::cout << "32bpp bottom to top 37x19... ";
+    auto bottom_to_top = bmp_writer::make_bmp(37, 19, 32, 0, {}, pixels);
+    if (XILoader::view_raw(bottom_to_top.data(), bottom_to_top.size()))
+    {
+        std::cout << "FAILED --> bottom to top BMPs can't be viewed without a copy" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    PRINT_END("BMP VIEW TEST DONE");
+}
+
+// Builds a bottom to top 24bpp BMP with a known pattern and compares the decoded RGB values
+void load_and_compare_synthetic(const char* subject, int32_t width, int32_t height)
+{
+    std::cout << subject << "... ";
+
+    size_t row_padded = (width * 3ull + 3) & ~3ull;
+    std::vector<uint8_t> pixel_array(row_padded * height);
+    std::vector<uint8_t> expected(width * 3ull * height);
+
+    for (size_t y = 0; y < static_cast<size_t>(height); y++)
+    {
+        uint8_t* row = &expected[(height - y - 1) * width * 3ull];
+
+        for (size_t x = 0; x < static_cast<size_t>(width); x++)
+        {
+            for (size_t c = 0; c < 3; c++)
+            {
+                uint8_t value = static_cast<uint8_t>(x * 3 + c + y * 7);
+                pixel_array[y * row_padded + x * 3 + c] = value;
+                row[x * 3 + (2 - c)] = value;
+            }
+        }
+    }
+
+    auto bmp = bmp_writer::make_bmp(width, height, 24, 0, {}, pixel_array);
+    auto image = XILoader::load_raw(bmp.data(), bmp.size());
+    ASSERT_LOADED(image);
+
+    if (image && (image.width() != static_cast<size_t>(width) || image.height() != static_cast<size_t>(height)))
+    {
+        std::cout << "FAILED --> got " << image.width() << "x" << image.height() << std::endl;
+        failed++;
+        return;
+    }
+
+    compare_each(image.data(), expected.data(), expected.size());
+}
+
+void TEST_DIMENSIONS()
+{
+    PRINT_TITLE("LARGE DIMENSIONS TEST STARTS");
+    load_and_compare_synthetic("24bpp 70000x4", 70000, 4);
+    load_and_compare_synthetic("24bpp 5x70000", 5, 70000);
+    PRINT_END("LARGE DIMENSIONS TEST DONE");
+}
+
+// Wraps a PNG into a BI_PNG BMP and compares it with the PNG itself
+void load_embedded_and_compare(const char* subject, const char* path_to_image)
+{
+    std::cout << subject << "... ";
+
+    auto png = read_whole_file(path_to_image);
+    auto bmp = bmp_writer::make_bmp(0, 0, 0, 5, {}, png);
+
+    auto image = XILoader::load_raw(bmp.data(), bmp.size());
+    auto reference = XILoader::load_raw(png.data(), png.size());
+    ASSERT_LOADED(image);
+
+    compare_each(image.data(), reference.data(), reference.size());
+}
+
+void TEST_EMBEDDED()
+{
+    PRINT_TITLE("EMBEDDED PNG BMP LOADING TEST STARTS");
+    load_embedded_and_compare("BI_PNG 8bpc RGB 400x268", PATH_TO("8pbc_rgb_400x268.png"));
+    load_embedded_and_compare("BI_PNG 8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+    PRINT_END("EMBEDDED PNG BMP LOADING TEST DONE");
+}
+
+void TEST_MAPPED()
+{
+    PRINT_TITLE("MEMORY MAPPED LOADING TEST STARTS");
+    LOAD_MAPPED_AND_COMPARE("16bpp 1419x1001", PATH_TO("16bpp_1419x1001.bmp"));
+    LOAD_MAPPED_AND_COMPARE("8bpc RGB 400x268", PATH_TO("8pbc_rgb_400x268.png"));
+    LOAD_MAPPED_AND_COMPARE("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+
+    std::cout << "mapped file matches the file contents... ";
+    XIL::MappedFile mapping;
+    auto contents = read_whole_file(PATH_TO("8bpp_1419x1001.bmp"));
+    if (!mapping.map(PATH_TO("8bpp_1419x1001.bmp")))
+        std::cout << "SKIPPED --> memory mapping is not supported" << std::endl;
+    else if (mapping.size() != contents.size())
+        std::cout << "Failed! --> mapping size " << mapping.size() << " vs " << contents.size() << std::endl;
+    else
+        compare_each(const_cast<uint8_t*>(mapping.data()), contents.data(), contents.size());
+
+    PRINT_END("MEMORY MAPPED LOADING TEST DONE");
+}
+
+// Feeds the file to the loader in small uneven pieces, like a slow network source would
+void load_streamed_and_compare(const char* subject, const char* path_to_image)
+{
+    std::cout << subject << "... ";
+
+    std::ifstream file(path_to_image, std::ios::binary);
+    XIL::StreamReader reader(
+        [&file](void* to, size_t size) -> size_t
+        {
+            file.read(static_cast<char*>(to), std::min<size_t>(size, 1021));
+            return static_cast<size_t>(file.gcount());
+        });
+
+    auto xil_image = XILoader::load(reader);
+    auto stbi_image = stbi_load(path_to_image, &x, &y, &z, 0);
+    ASSERT_LOADED(xil_image);
+
+    compare_each(xil_image.data(), stbi_image, static_cast<size_t>(x) * y * z);
+}
+
+void TEST_STREAMED()
+{
+    PRINT_TITLE("STREAMED LOADING TEST STARTS");
+    load_streamed_and_compare("8bpp 1419x1001", PATH_TO("8bpp_1419x1001.bmp"));
+    load_streamed_and_compare("8bpc RGB 400x268", PATH_TO("8pbc_rgb_400x268.png"));
+    load_streamed_and_compare("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+    load_streamed_and_compare("8bpc RGBA PALETTED 1473x1854", PATH_TO("8bpc_rgba_paletted_1473x1854.png"));
+
+    std::cout << "std::istream 16bpc RGBA 1473x1854... ";
+    std::ifstream file(PATH_TO("16bpc_rgba_1473x1854.png"), std::ios::binary);
+    XIL::StreamReader reader(file);
+    auto xil_image = XILoader::load(reader);
+    auto stbi_image = stbi_load(PATH_TO("16bpc_rgba_1473x1854.png"), &x, &y, &z, 0);
+    ASSERT_LOADED(xil_image);
+    compare_each(xil_image.data(), stbi_image, static_cast<size_t>(x) * y * z);
+
+    PRINT_END("STREAMED LOADING TEST DONE");
+}
+
+// Every image of the batch has to match stbi, the missing file has to come back empty
+void load_batch_and_compare(const char* subject, XIL::BatchBackend backend)
+{
+    std::cout << subject << "... ";
+
+    std::vector<std::string> paths = {
+        PATH_TO("1bpp_8x8.bmp"), PATH_TO("8bpp_1419x1001.bmp"), PATH_TO("8pbc_rgb_400x268.png"),
+        PATH_TO("does_not_exist.png"), PATH_TO("16bpp_4x4.bmp"), PATH_TO("8bpc_rgba_4x4.png")
+    };
+
+    // more files than can be in flight at once
+    for (size_t i = 0; paths.size() < XIL::BatchReader::max_in_flight * 2; i++)
+        paths.push_back(paths[i]);
+
+    auto images = XILoader::load_batch(paths, {}, backend);
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        auto stbi_image = stbi_load(paths[i].c_str(), &x, &y, &z, 0);
+
+        if (!stbi_image || !images[i])
+            mismatches += static_cast<bool>(stbi_image) != static_cast<bool>(images[i]);
+        else
+            mismatches += images[i].size() != static_cast<size_t>(x) * y * z ||
+                          memcmp(images[i].data(), stbi_image, images[i].size());
+
+        stbi_image_free(stbi_image);
+    }
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " of " << paths.size() << " images didn't match" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+// Paths and buffers decoded in parallel have to match stbi, the missing file and the garbage buffer
+// have to come back empty with an error
+void load_parallel_and_compare(const char* subject, size_t threads)
+{
+    std::cout << subject << "... ";
+
+    std::vector<std::string> paths = {
+        PATH_TO("1bpp_8x8.bmp"), PATH_TO("8bpp_1419x1001.bmp"), PATH_TO("8pbc_rgb_400x268.png"),
+        PATH_TO("does_not_exist.png"), PATH_TO("16bpp_4x4.bmp"), PATH_TO("8bpc_rgba_1473x1854.png")
+    };
+
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<XIL::BatchSource> sources;
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        sources.push_back(paths[i]);
+
+        std::ifstream file(paths[i], std::ios::binary);
+        buffers.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    for (auto& buffer : buffers)
+        sources.push_back(XIL::BatchSource(buffer.data(), buffer.size()));
+
+    const char garbage[] = "not an image";
+    sources.push_back(XIL::BatchSource(garbage, sizeof(garbage)));
+
+    XIL::ParallelLoader loader(threads);
+    auto results = loader.load(sources);
+    size_t mismatches = loader.size() != threads || results.size() != sources.size() || results.back().ok() || results.back().error.empty();
+
+    for (size_t i = 0; i + 1 < results.size() && results.size() == sources.size(); i++)
+    {
+        auto stbi_image = stbi_load(paths[i % paths.size()].c_str(), &x, &y, &z, 0);
+
+        if (!stbi_image || !results[i].ok())
+            mismatches += static_cast<bool>(stbi_image) != results[i].ok() || results[i].ok() == !results[i].error.empty();
+        else
+            mismatches += !results[i].error.empty() || results[i].image.size() != static_cast<size_t>(x) * y * z ||
+                          memcmp(results[i].image.data(), stbi_image, results[i].image.size());
+
+        stbi_image_free(stbi_image);
+    }
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " of " << sources.size() << " images didn't match" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+void TEST_BATCH()
+{
+    PRINT_TITLE("BATCH LOADING TEST STARTS");
+    load_batch_and_compare("io_uring", XIL::BatchBackend::IO_URING);
+    load_batch_and_compare("thread pool", XIL::BatchBackend::THREAD_POOL);
+
+#ifdef XIL_IO_URING
+    std::cout << "io_uring without the opcodes it needs... ";
+    {
+        // 255 isn't an opcode of any kernel, the probe has to turn the ring down
+        XIL::BatchReader::IoUring missing;
+        XIL::BatchReader::IoUring needed;
+        bool usable = needed.init(XIL::BatchReader::max_in_flight, { IORING_OP_OPENAT, IORING_OP_READ });
+
+        std::vector<std::string> paths = { PATH_TO("8pbc_rgb_400x268.png") };
+        size_t read_size = 0;
+        auto backend = XIL::BatchReader::read(paths, [&](size_t, XIL::DataStream& file) { read_size = file.bytes_left(); }, XIL::BatchBackend::IO_URING);
+
+        size_t mismatches = missing.init(8, { IORING_OP_READ, 255 }) || read_size != read_whole_file(paths[0]).size() ||
+                            backend != (usable ? XIL::BatchBackend::IO_URING : XIL::BatchBackend::THREAD_POOL);
+        std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+        mismatches ? failed++ : passed++;
+    }
+#endif
+    load_parallel_and_compare("parallel 1 thread", 1);
+    load_parallel_and_compare("parallel 4 threads", 4);
+
+    std::cout << "work stealing pool... ";
+    std::atomic<size_t> sum(0);
+    {
+        // tasks submitted from inside other tasks, and the pool destroyed right after waiting
+        XIL::WorkStealingPool pool(3);
+
+        for (size_t i = 1; i <= 100; i++)
+            pool.submit([&, i]() { sum += i; pool.submit([&]() { sum += 1000; }); });
+
+        pool.wait();
+    }
+    bool all_ran = sum == 5050 + 100 * 1000;
+    std::cout << (all_ran ? "PASSED" : "FAILED") << std::endl;
+    all_ran ? passed++ : failed++;
+    PRINT_END("BATCH LOADING TEST DONE");
+}
+
+// The images have to come out in order and match stbi, the missing file has to come back empty
+void load_sequence_and_compare(const char* subject, size_t prefetch, size_t memory_budget)
+{
+    std::cout << subject << "... ";
+
+    std::vector<std::string> paths = {
+        PATH_TO("8bpp_1419x1001.bmp"), PATH_TO("1bpp_8x8.bmp"), PATH_TO("does_not_exist.png"),
+        PATH_TO("8pbc_rgb_400x268.png"), PATH_TO("4bpp_1419x1001.bmp"), PATH_TO("8bpc_rgba_4x4.png")
+    };
+
+    XIL::SequenceLoader sequence(paths, prefetch, memory_budget);
+    size_t mismatches = 0;
+    size_t delivered = 0;
+
+    for (auto it = sequence.begin(); it != sequence.end(); ++it, delivered++)
+    {
+        auto stbi_image = stbi_load(paths[it.index()].c_str(), &x, &y, &z, 0);
+
+        if (it.index() != delivered)
+            mismatches++;
+        else if (!stbi_image || !*it)
+            mismatches += static_cast<bool>(stbi_image) != static_cast<bool>(*it);
+        else
+            mismatches += it->size() != static_cast<size_t>(x) * y * z ||
+                          memcmp(it->data(), stbi_image, it->size());
+
+        stbi_image_free(stbi_image);
+    }
+
+    if (mismatches || delivered != paths.size())
+    {
+        std::cout << "FAILED --> " << mismatches << " mismatches, "
+                  << delivered << " of " << paths.size() << " images delivered" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+void TEST_SEQUENCE()
+{
+    PRINT_TITLE("SEQUENCE LOADING TEST STARTS");
+    load_sequence_and_compare("prefetch 2", 2, 256 * 1024 * 1024);
+    load_sequence_and_compare("prefetch 8, 1 byte budget", 8, 1);
+    PRINT_END("SEQUENCE LOADING TEST DONE");
+}
+
+// Loads the image twice through a pool, the second load has to be served by the storage of the first
+void load_pooled_and_compare(const char* subject, const char* path_to_image)
+{
+    std::cout << subject << "... ";
+
+    XIL::LoadOptions options;
+    options.buffer_pool = std::make_shared<XIL::BufferPool>();
+
+    XILoader::load(path_to_image, options);
+    size_t retained = options.buffer_pool->retained();
+
+    auto xil_image = XILoader::load(path_to_image, options);
+    auto stbi_image = stbi_load(path_to_image, &x, &y, &z, 0);
+
+    if (!retained || !options.buffer_pool->hits())
+    {
+        std::cout << "FAILED --> The storage wasn't reused" << std::endl;
+        failed++;
+    }
+    else
+    {
+        ASSERT_LOADED(xil_image);
+        compare_each(xil_image.data(), stbi_image, static_cast<size_t>(x) * y * z);
+    }
+
+    stbi_image_free(stbi_image);
+}
+
+void TEST_BUFFER_POOL()
+{
+    PRINT_TITLE("BUFFER POOL TEST STARTS");
+    load_pooled_and_compare("8bpp 1419x1001", PATH_TO("8bpp_1419x1001.bmp"));
+    load_pooled_and_compare("8bpc RGB 400x268", PATH_TO("8pbc_rgb_400x268.png"));
+    load_pooled_and_compare("8bpc RGBA GRAYSCALE 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"));
+    load_pooled_and_compare("8bpc RGBA PALETTED 1473x1854", PATH_TO("8bpc_rgba_paletted_1473x1854.png"));
+
+    std::cout << "retained memory cap... ";
+    XIL::LoadOptions options;
+    options.buffer_pool = std::make_shared<XIL::BufferPool>(1024 * 1024);
+    {
+        auto first = XILoader::load(PATH_TO("8bpp_1419x1001.bmp"), options);
+        auto second = XILoader::load(PATH_TO("8pbc_rgb_400x268.png"), options);
+    }
+
+    if (options.buffer_pool->retained() > options.buffer_pool->max_retained())
+    {
+        std::cout << "FAILED --> " << options.buffer_pool->retained() << " bytes retained" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    PRINT_END("BUFFER POOL TEST DONE");
+}
+
+#ifdef XIL_PMR
+// Forwards to the default resource, keeping track of the bytes that are currently allocated
+class CountingResource : public XIL::PixelResource
+{
+public:
+    size_t allocated = 0;
+    size_t allocations = 0;
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        allocated += bytes;
+        allocations++;
+        return std::pmr::get_default_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+    {
+        allocated -= bytes;
+        std::pmr::get_default_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const XIL::PixelResource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// The pixels have to come from 'resource' and be aligned to 'alignment'
+void load_from_resource_and_compare(const char* subject, const char* path_to_image, XIL::PixelResource* resource, size_t alignment)
+{
+    std::cout << subject << "... ";
+
+    XIL::LoadOptions options;
+    options.memory_resource = resource;
+
+    auto xil_image = XILoader::load(path_to_image, options);
+    auto stbi_image = stbi_load(path_to_image, &x, &y, &z, 0);
+
+    if (xil_image && reinterpret_cast<uintptr_t>(xil_image.data()) % alignment)
+    {
+        std::cout << "FAILED --> The pixels aren't aligned to " << alignment << " bytes" << std::endl;
+        failed++;
+    }
+    else
+    {
+        ASSERT_LOADED(xil_image);
+        compare_each(xil_image.data(), stbi_image, static_cast<size_t>(x) * y * z);
+    }
+
+    stbi_image_free(stbi_image);
+}
+
+void TEST_MEMORY_RESOURCE()
+{
+    PRINT_TITLE("MEMORY RESOURCE TEST STARTS");
+    load_from_resource_and_compare("64 byte aligned 4bpp 1419x1001", PATH_TO("4bpp_1419x1001.bmp"), XIL::aligned_resource(), 64);
+    load_from_resource_and_compare("64 byte aligned 8bpc RGBA PALETTED 1473x1854", PATH_TO("8bpc_rgba_paletted_1473x1854.png"), XIL::aligned_resource(), 64);
+    load_from_resource_and_compare("huge pages 16bpp 1419x1001", PATH_TO("16bpp_1419x1001.bmp"), XIL::huge_page_resource(), XIL::HugePageResource::huge_page_size);
+    load_from_resource_and_compare("huge pages 8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"), XIL::huge_page_resource(), XIL::HugePageResource::huge_page_size);
+
+    // the storage has to stay with the resource through moves and pooling
+    std::cout << "user supplied resource... ";
+    CountingResource counting;
+    size_t leftover = 0;
+    size_t moved = 0;
+    {
+        XIL::LoadOptions options;
+        options.memory_resource = &counting;
+        options.buffer_pool = std::make_shared<XIL::BufferPool>();
+
+        XImage image;
+        image = XILoader::load(PATH_TO("8bpp_1419x1001.bmp"), options);
+        image = XILoader::load(PATH_TO("8pbc_rgb_400x268.png"), options);
+
+        XImage other = std::move(image);
+        moved = counting.allocations;
+        image = XILoader::load(PATH_TO("1bpp_260x401.bmp"));
+        moved = counting.allocations - moved;
+    }
+    leftover = counting.allocated;
+
+    if (!counting.allocations || leftover || moved)
+    {
+        std::cout << "FAILED --> " << counting.allocations << " allocations, "
+                  << leftover << " bytes leaked, " << moved << " allocations after loading" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    PRINT_END("MEMORY RESOURCE TEST DONE");
+}
+#endif
+
+// Every row has to start at a multiple of 'alignment', match stbi and be followed by zeroed padding
+void load_aligned_and_compare(const char* subject, const char* path_to_image, size_t alignment, bool flip = false)
+{
+    std::cout << subject << "... ";
+
+    XIL::LoadOptions options;
+    options.row_alignment = alignment;
+    options.flip = flip;
+#ifdef XIL_PMR
+    options.memory_resource = XIL::aligned_resource();
+#endif
+
+    auto xil_image = XILoader::load(path_to_image, options);
+    stbi_set_flip_vertically_on_load(flip);
+    auto stbi_image = stbi_load(path_to_image, &x, &y, &z, 0);
+    stbi_set_flip_vertically_on_load(false);
+
+    size_t row_size = static_cast<size_t>(x) * z;
+    size_t mismatches = 0;
+
+    if (!xil_image || !stbi_image || xil_image.pitch() % alignment || xil_image.pitch() < row_size)
+    {
+        std::cout << "FAILED --> Couldn't load the image with a " << alignment << " byte row alignment" << std::endl;
+        failed++;
+        stbi_image_free(stbi_image);
+        return;
+    }
+
+    for (size_t row = 0; row < static_cast<size_t>(y); row++)
+    {
+        const uint8_t* pixels = xil_image.row(row).data();
+
+        mismatches += memcmp(pixels, stbi_image + row * row_size, row_size) != 0;
+        mismatches += std::any_of(pixels + row_size, pixels + xil_image.pitch(), [](uint8_t value) { return value; });
+    #ifdef XIL_PMR
+        mismatches += reinterpret_cast<uintptr_t>(pixels) % alignment != 0;
+    #endif
+    }
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " mismatches" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    stbi_image_free(stbi_image);
+}
+
+void TEST_ROW_ALIGNMENT()
+{
+    PRINT_TITLE("ROW ALIGNMENT TEST STARTS");
+    load_aligned_and_compare("4 byte rows 1bpp 9x9", PATH_TO("1bpp_9x9.bmp"), 4);
+    load_aligned_and_compare("4 byte rows 16bpp 1419x1001", PATH_TO("16bpp_1419x1001.bmp"), 4);
+    load_aligned_and_compare("16 byte rows 4bpp 1419x1001", PATH_TO("4bpp_1419x1001.bmp"), 16);
+    load_aligned_and_compare("64 byte rows 8bpp 1419x1001 flipped", PATH_TO("8bpp_1419x1001.bmp"), 64, true);
+    load_aligned_and_compare("4 byte rows 8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"), 4);
+    load_aligned_and_compare("16 byte rows 16bpc RGB 1419x1001", PATH_TO("16bpc_rgb_1419x1001.png"), 16);
+    load_aligned_and_compare("64 byte rows 4bpp RGB PALETTED 1419x1001", PATH_TO("4bpp_rgb_paletted_1419x1001.png"), 64);
+    load_aligned_and_compare("64 byte rows 8bpc RGB GRAYSCALE 1419x1001 flipped", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"), 64, true);
+
+    std::cout << "RLE8 with 16 byte rows... ";
+    auto bmp = read_whole_file(PATH_TO("8bpp_1419x1001.bmp"));
+    auto rle = bmp_writer::to_rle(bmp);
+    XIL::LoadOptions options;
+    options.row_alignment = 16;
+    auto packed = XILoader::load_raw(bmp.data(), bmp.size());
+    auto aligned = XILoader::load_raw(rle.data(), rle.size(), options);
+    size_t mismatches = !packed || !aligned;
+
+    for (size_t row = 0; !mismatches && row < packed.height(); row++)
+        mismatches += memcmp(packed.row(row).data(), aligned.row(row).data(), packed.pitch()) ||
+                      std::any_of(aligned.row(row).data() + packed.pitch(), aligned.row(row).data() + aligned.pitch(), [](uint8_t value) { return value; });
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " mismatches" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+
+    PRINT_END("ROW ALIGNMENT TEST DONE");
+}
+
+// Compares every pixel of 'view' against the stbi image it was cut out of at 'at_x', 'at_y'
+size_t count_view_mismatches(XIL::ConstImageView view, const uint8_t* stbi_image, size_t at_x, size_t at_y)
+{
+    size_t mismatches = 0;
+    size_t y = at_y;
+
+    for (auto row : view)
+    {
+        size_t x = at_x;
+
+        for (const uint8_t* pixel : row)
+            mismatches += memcmp(pixel, stbi_image + (y * AS_INT(::x) + x++) * view.channels(), view.channels()) != 0;
+
+        y++;
+    }
+
+    return mismatches + (y - at_y != view.height());
+}
+
+template<typename Fn>
+bool throws(Fn&& fn)
+{
+    try {
+        fn();
+    }
+    catch (const std::exception&)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+void TEST_PIXEL_VIEWS()
+{
+    PRINT_TITLE("PIXEL VIEWS TEST STARTS");
+
+    auto xil_image = XILoader::load(PATH_TO("8pbc_rgb_400x268.png"));
+    auto stbi_image = stbi_load(PATH_TO("8pbc_rgb_400x268.png"), &x, &y, &z, 0);
+
+    std::cout << "image[x][y]... ";
+    ASSERT_LOADED(xil_image);
+    compare_each(xil_image[5][3], stbi_image + (3 * x + 5) * z, z);
+
+    std::cout << "rows and pixel iterators... ";
+    size_t mismatches = count_view_mismatches(xil_image.view(), stbi_image, 0, 0);
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "sub-views... ";
+    auto sprite = xil_image.view(100, 50, 64, 32);
+    auto nested = sprite.view(10, 20, 8, 12);
+    mismatches = count_view_mismatches(sprite, stbi_image, 100, 50) + count_view_mismatches(nested, stbi_image, 110, 70);
+    mismatches += sprite.data() != xil_image.row(50)[100] || nested.pitch() != xil_image.pitch();
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "checked access... ";
+    mismatches = !throws([&]() { xil_image.row(xil_image.height()); }) +
+                 !throws([&]() { xil_image.row(0).at(xil_image.width()); }) +
+                 !throws([&]() { xil_image.view(xil_image.width() - 1, 0, 2, 1); }) +
+                 !throws([&]() { sprite.view(0, 30, 1, 3); }) +
+                 !throws([&]() { sprite.at(64, 0); }) +
+                 throws([&]() { sprite.view(64, 32, 0, 0); });
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+    stbi_image_free(stbi_image);
+
+    // a single column used to be left as is
+    std::cout << "flip 1x3... ";
+    std::vector<uint8_t> pixel_array = { 1, 2, 3, 0, 4, 5, 6, 0, 7, 8, 9, 0 };
+    auto bmp = bmp_writer::make_bmp(1, 3, 24, 0, {}, pixel_array);
+    auto column = XILoader::load_raw(bmp.data(), bmp.size());
+    uint8_t flipped[] = { 3, 2, 1, 6, 5, 4, 9, 8, 7 };
+    column.flip();
+    compare_each(column.data(), flipped, sizeof(flipped));
+
+    PRINT_END("PIXEL VIEWS TEST DONE");
+}
+
+// Where a pixel of the transformed image comes from in the 'width' x 'height' source
+using SourceOf = std::function<std::pair<size_t, size_t>(size_t x, size_t y, size_t width, size_t height)>;
+
+struct GeometricTransform
+{
+    const char* name;
+    void (XIL::Image::*apply)();
+    void (*apply_to_view)(XIL::ConstImageView, XIL::ImageView);
+    bool transposed;
+    SourceOf source_of;
+};
+
+static const GeometricTransform geometric_transforms[] =
+{
+    { "flip horizontal", &XIL::Image::flip_horizontal, &XIL::Transform::flip_horizontal, false,
+      [](size_t x, size_t y, size_t w, size_t) { return std::make_pair(w - x - 1, y); } },
+    { "rotate 180", &XIL::Image::rotate_180, &XIL::Transform::rotate_180, false,
+      [](size_t x, size_t y, size_t w, size_t h) { return std::make_pair(w - x - 1, h - y - 1); } },
+    { "rotate 90", &XIL::Image::rotate_90, &XIL::Transform::rotate_90, true,
+      [](size_t x, size_t y, size_t, size_t h) { return std::make_pair(y, h - x - 1); } },
+    { "rotate 270", &XIL::Image::rotate_270, &XIL::Transform::rotate_270, true,
+      [](size_t x, size_t y, size_t w, size_t) { return std::make_pair(w - y - 1, x); } },
+    { "transpose", &XIL::Image::transpose, &XIL::Transform::transpose, true,
+      [](size_t x, size_t y, size_t, size_t) { return std::make_pair(y, x); } },
+};
+
+// Compares every pixel of 'view' against the 'width' x 'height' rectangle of the stbi image at 'at_x', 'at_y'
+size_t count_transform_mismatches(XIL::ConstImageView view, const GeometricTransform& transform,
+                                  const uint8_t* stbi_image, size_t at_x, size_t at_y, size_t width, size_t height)
+{
+    size_t mismatches = 0;
+
+    for (size_t y = 0; y < view.height(); y++)
+    {
+        for (size_t x = 0; x < view.width(); x++)
+        {
+            auto source = transform.source_of(x, y, width, height);
+            auto* expected = stbi_image + ((at_y + source.second) * AS_INT(::x) + at_x + source.first) * view.channels();
+
+            mismatches += memcmp(view.pixel_unchecked(x, y), expected, view.channels()) != 0;
+        }
+    }
+
+    return mismatches;
+}
+
+void transform_and_compare(const char* subject, const char* path_to_image)
+{
+    auto stbi_image = stbi_load(path_to_image, &x, &y, &z, 0);
+
+    // rows with padding, the transformed images are tightly packed
+    XIL::LoadOptions options;
+    options.row_alignment = 16;
+
+    for (const auto& transform : geometric_transforms)
+    {
+        std::cout << subject << " " << transform.name << "... ";
+
+        auto image = XILoader::load(path_to_image, options);
+        ASSERT_LOADED(image);
+        (image.*transform.apply)();
+
+        size_t width = transform.transposed ? y : x;
+        size_t mismatches = image.width() != width || image.height() != AS_INT(x) * AS_INT(y) / width;
+
+        if (!mismatches)
+            mismatches = count_transform_mismatches(image.view(), transform, stbi_image, 0, 0, x, y);
+
+        // odd sized rectangles leave partial tiles and blocks on every side
+        size_t out_width = transform.transposed ? 45 : 77;
+        size_t out_height = transform.transposed ? 77 : 45;
+        std::vector<uint8_t> pixels(out_width * out_height * z);
+        XIL::ImageView out(pixels.data(), out_width, out_height, out_width * z, static_cast<uint8_t>(z));
+
+        auto loaded = XILoader::load(path_to_image);
+        transform.apply_to_view(loaded.view(3, 5, 77, 45), out);
+        mismatches += count_transform_mismatches(out, transform, stbi_image, 3, 5, 77, 45);
+
+        if (mismatches)
+        {
+            std::cout << "FAILED --> " << mismatches << " mismatches" << std::endl;
+            failed++;
+        }
+        else
+        {
+            std::cout << "PASSED" << std::endl;
+            passed++;
+        }
+    }
+
+    stbi_image_free(stbi_image);
+}
+
+void TEST_TRANSFORMS()
+{
+    PRINT_TITLE("GEOMETRIC TRANSFORMS TEST STARTS");
+    transform_and_compare("8bpc RGB GRAYSCALE 1419x1001", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"));
+    transform_and_compare("8bpc RGBA GRAYSCALE 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"));
+    transform_and_compare("8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"));
+    transform_and_compare("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+
+    std::cout << "mismatched views... ";
+    std::vector<uint8_t> pixels(12 * 8 * 4);
+    XIL::ImageView wide(pixels.data(), 12, 8, 48, 4);
+    XIL::ImageView tall(pixels.data(), 8, 12, 32, 4);
+    size_t mismatches = !throws([&]() { XIL::Transform::rotate_90(wide, wide); }) +
+                        !throws([&]() { XIL::Transform::flip_horizontal(wide, tall); }) +
+                        !throws([&]() { XIL::Transform::transpose(wide, XIL::ImageView(pixels.data(), 8, 12, 24, 3)); });
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("GEOMETRIC TRANSFORMS TEST DONE");
+}
+
+// Adds up every byte of the pixels, rows padding excluded
+size_t checksum(XIL::ConstImageView view)
+{
+    size_t sum = 0;
+
+    for (auto row : view)
+        sum = std::accumulate(row.data(), row.data() + row.size(), sum);
+
+    return sum;
+}
+
+void TEST_SHARED_IMAGE()
+{
+    PRINT_TITLE("SHARED IMAGE TEST STARTS");
+
+    XIL::LoadOptions options;
+    options.buffer_pool = std::make_shared<XIL::BufferPool>();
+    options.row_alignment = 16;
+
+    auto image = XILoader::load(PATH_TO("8bpc_rgba_1473x1854.png"), options);
+    auto stbi_image = stbi_load(PATH_TO("8bpc_rgba_1473x1854.png"), &x, &y, &z, 0);
+
+    std::cout << "clone... ";
+    ASSERT_LOADED(image);
+    auto copy = image.clone();
+    size_t mismatches = copy.data() == image.data() || copy.pitch() != image.pitch() ||
+                        count_view_mismatches(copy.view(), stbi_image, 0, 0);
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "sharing without copying... ";
+    const uint8_t* pixels = image.data();
+    XIL::SharedImage shared = std::move(image);
+    XIL::SharedImage other = shared;
+    mismatches = shared->data() != pixels || other->data() != pixels || shared.use_count() != 2 || image.ok();
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "concurrent reads... ";
+    size_t expected = checksum(copy.view());
+    std::vector<std::thread> readers;
+    std::atomic<size_t> wrong(0);
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        readers.emplace_back([shared, expected, &wrong]()
+            {
+                wrong += checksum(shared.view()) != expected;
+            });
+    }
+
+    for (auto& reader : readers)
+        reader.join();
+
+    mismatches = wrong + (shared.use_count() != 2);
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "copy on write... ";
+    auto& written = other.mutate();
+    written.row(0)[0][0] ^= 0xff;
+    mismatches = other->data() == pixels || shared->data() != pixels || !other.unique() || !shared.unique() ||
+                 count_view_mismatches(shared.view(), stbi_image, 0, 0) ||
+                 count_view_mismatches(other.view(), stbi_image, 0, 0) != 1;
+
+    // a unique handle is written in place
+    mismatches += &shared.mutate() != &*shared || shared->data() != pixels;
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "release... ";
+    other = shared;
+    auto released = shared.release();
+    auto last = other.release();
+    mismatches = released.data() == pixels || last.data() != pixels || shared.ok() || other.ok() ||
+                 count_view_mismatches(released.view(), stbi_image, 0, 0);
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    stbi_image_free(stbi_image);
+    PRINT_END("SHARED IMAGE TEST DONE");
+}
+
+// Share of source pixel 'i' in destination pixel 'd' when 'size' pixels are reduced to 'reduced' ones
+double box_coverage(size_t i, size_t d, size_t size, size_t reduced)
+{
+    double from = static_cast<double>(d) * size / reduced;
+    double to = static_cast<double>(d + 1) * size / reduced;
+
+    return std::max(0.0, std::min<double>(i + 1, to) - std::max<double>(i, from)) / (to - from);
+}
+
+// Counts the pixels of 'dst' further than 'tolerance' from the exact box filtered 'src'
+size_t count_mip_mismatches(XIL::ConstImageView src, XIL::ConstImageView dst, int tolerance)
+{
+    size_t mismatches = 0;
+
+    for (size_t y = 0; y < dst.height(); y++)
+    {
+        for (size_t x = 0; x < dst.width(); x++)
+        {
+            for (size_t c = 0; c < dst.channels(); c++)
+            {
+                double sum = 0.0;
+
+                for (size_t sy = 2 * y; sy < std::min(2 * y + 3, src.height()); sy++)
+                    for (size_t sx = 2 * x; sx < std::min(2 * x + 3, src.width()); sx++)
+                        sum += src.pixel_unchecked(sx, sy)[c] * box_coverage(sx, x, src.width(), dst.width()) *
+                                                                box_coverage(sy, y, src.height(), dst.height());
+
+                mismatches += std::abs(static_cast<int>(sum + 0.5) - dst.pixel_unchecked(x, y)[c]) > tolerance;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+void mipmap_and_compare(const char* subject, const char* path_to_image)
+{
+    std::cout << subject << "... ";
+
+    XIL::LoadOptions options;
+    options.generate_mipmaps = true;
+
+    auto image = XILoader::load(path_to_image, options);
+    ASSERT_LOADED(image);
+
+    const auto& mips = image.mipmaps();
+    size_t mismatches = mips.levels() != 1 + static_cast<size_t>(std::log2(std::max(image.width(), image.height())) - 1);
+    XIL::ConstImageView above = image.view();
+
+    for (size_t level = 0; !mismatches && level < mips.levels(); level++)
+    {
+        auto below = mips.level(level);
+
+        mismatches += below.width() != std::max<size_t>(above.width() / 2, 1) || below.height() != std::max<size_t>(above.height() / 2, 1) ||
+                      (below.data() - mips.data()) % 16 || below.data() + below.pitch() * below.height() > mips.data() + mips.size();
+
+        // odd sizes use 8 bit weights
+        bool exact = !(above.width() & 1) && !(above.height() & 1);
+        mismatches += count_mip_mismatches(above, below, exact ? 0 : 1);
+
+        above = below;
+    }
+
+    mismatches += above.width() != 1 || above.height() != 1;
+
+    // built while decoding or afterwards, the chain has to be the same
+    auto plain = XILoader::load(path_to_image);
+    auto separate = XIL::Mipmap::generate(plain.view());
+    mismatches += separate.size() != mips.size() || memcmp(separate.data(), mips.data(), mips.size());
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " mismatches" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+void TEST_MIPMAPS()
+{
+    PRINT_TITLE("MIPMAP TEST STARTS");
+    mipmap_and_compare("8bpc RGB GRAYSCALE 1419x1001", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"));
+    mipmap_and_compare("8bpc RGBA GRAYSCALE 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"));
+    mipmap_and_compare("8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"));
+    mipmap_and_compare("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+    mipmap_and_compare("8bpc RGBA 2816x3088", PATH_TO("8pbc_rgba_2816x3088.png"));
+    mipmap_and_compare("8bpp 1419x1001", PATH_TO("8bpp_1419x1001.bmp"));
+    mipmap_and_compare("1bpp 9x9", PATH_TO("1bpp_9x9.bmp"));
+
+    std::cout << "sRGB round trip... ";
+    XIL::MipOptions srgb;
+    srgb.srgb = true;
+    size_t mismatches = 0;
+
+    for (int value = 0; value < 256; value++)
+    {
+        uint8_t pixels[3 * 3 * 3];
+        std::fill(std::begin(pixels), std::end(pixels), static_cast<uint8_t>(value));
+        auto chain = XIL::Mipmap::generate(XIL::ConstImageView(pixels, 3, 3, 9, 3), srgb);
+        mismatches += chain.level(0).pixel_unchecked(0, 0)[0] != value || chain.level(0).pixel_unchecked(0, 0)[2] != value;
+    }
+
+    // black and white average to half the light, not half the encoded value
+    uint8_t checker[] = { 0, 255, 255, 0 };
+    mismatches += XIL::Mipmap::generate(XIL::ConstImageView(checker, 2, 2, 2, 1), srgb).level(0).pixel_unchecked(0, 0)[0] != 188 ||
+                  XIL::Mipmap::generate(XIL::ConstImageView(checker, 2, 2, 2, 1)).level(0).pixel_unchecked(0, 0)[0] != 128;
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "alpha weighted... ";
+    XIL::MipOptions weighted;
+    weighted.alpha_weighted = true;
+
+    // a single opaque red pixel among transparent green ones
+    uint8_t sprite[] = { 255, 0, 0, 255,  0, 255, 0, 0,
+                         0, 255, 0, 0,    0, 255, 0, 0 };
+    XIL::ConstImageView sprite_view(sprite, 2, 2, 8, 4);
+    uint8_t expected_weighted[] = { 255, 0, 0, 64 };
+    uint8_t expected_plain[] = { 64, 191, 0, 64 };
+    mismatches = memcmp(XIL::Mipmap::generate(sprite_view, weighted).level(0).pixel_unchecked(0, 0), expected_weighted, 4) != 0 ||
+                 memcmp(XIL::Mipmap::generate(sprite_view).level(0).pixel_unchecked(0, 0), expected_plain, 4) != 0;
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "flipped and rotated images... ";
+    XIL::LoadOptions options;
+    options.generate_mipmaps = true;
+    options.flip = true;
+    options.mipmap_options.max_levels = 3;
+    auto flipped = XILoader::load(PATH_TO("8bpc_rgb_1419x1001.png"), options);
+    mismatches = flipped.mipmaps().levels() != 3 || count_mip_mismatches(flipped.view(), flipped.mipmaps().level(0), 1);
+    flipped.rotate_90();
+    mismatches += !flipped.mipmaps().empty();
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("MIPMAP TEST DONE");
+}
+
+// Source channel a decompressed channel comes from, -1 for the opaque alpha of images without one
+int block_source_channel(XIL::BlockFormat format, uint8_t channels, size_t channel)
+{
+    switch (format)
+    {
+    case XIL::BlockFormat::BC4:
+        return 0;
+    case XIL::BlockFormat::BC5:
+        return channel && channels > 1 ? 1 : 0;
+    default:
+        if (channel == 3)
+            return channels == 2 || channels == 4 ? channels - 1 : -1;
+        return channels < 3 ? 0 : static_cast<int>(channel);
+    }
+}
+
+// Root mean square error of the decompressed image over the channels the format encodes
+double block_rmse(XIL::ConstImageView src, const XIL::CompressedImage& compressed)
+{
+    uint8_t channels = XIL::BlockCompressor::decompressed_channels(compressed.format());
+    size_t compared = compressed.format() == XIL::BlockFormat::BC1 ? 3 : channels;
+    std::vector<uint8_t> pixels(src.width() * src.height() * channels);
+
+    XIL::ImageView dst(pixels.data(), src.width(), src.height(), src.width() * channels, channels);
+    XIL::BlockCompressor::decompress(compressed, dst);
+
+    double sum = 0.0;
+
+    for (size_t y = 0; y < src.height(); y++)
+    {
+        for (size_t x = 0; x < src.width(); x++)
+        {
+            for (size_t c = 0; c < compared; c++)
+            {
+                int from = block_source_channel(compressed.format(), src.channels(), c);
+                double d = dst.pixel_unchecked(x, y)[c] - (from < 0 ? 255 : src.pixel_unchecked(x, y)[from]);
+                sum += d * d;
+            }
+        }
+    }
+
+    return std::sqrt(sum / (src.width() * src.height() * compared));
+}
+
+void compress_and_compare(const char* subject, const char* path_to_image, XIL::BlockFormat format, double max_rmse)
+{
+    std::cout << subject << "... ";
+
+    auto image = XILoader::load(path_to_image);
+    ASSERT_LOADED(image);
+
+    XIL::BlockOptions options;
+    options.format = format;
+
+    double rmse[3];
+    XIL::CompressedImage single_threaded;
+
+    for (int quality = 0; quality < 3; quality++)
+    {
+        options.quality = static_cast<XIL::BlockQuality>(quality);
+        auto compressed = XIL::BlockCompressor::compress(image.view(), options);
+        rmse[quality] = block_rmse(image.view(), compressed);
+
+        if (options.quality == XIL::BlockQuality::NORMAL)
+            single_threaded = std::move(compressed);
+    }
+
+    // rows of blocks split between threads compress the same
+    XIL::ThreadPool workers(3);
+    options.quality = XIL::BlockQuality::NORMAL;
+    options.thread_pool = &workers;
+    auto threaded = XIL::BlockCompressor::compress(image.view(), options);
+
+    bool mismatch = threaded.size() != single_threaded.size() || memcmp(threaded.data(), single_threaded.data(), threaded.size()) ||
+                    rmse[1] > max_rmse || rmse[2] > rmse[1] || rmse[1] > rmse[0];
+
+    if (mismatch)
+    {
+        std::cout << "FAILED --> RMSE " << rmse[0] << " / " << rmse[1] << " / " << rmse[2] << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+void TEST_BLOCK_COMPRESSION()
+{
+    PRINT_TITLE("BLOCK COMPRESSION TEST STARTS");
+    compress_and_compare("BC1 8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"), XIL::BlockFormat::BC1, 3.2);
+    compress_and_compare("BC1 8bpc RGB GRAYSCALE 1419x1001", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"), XIL::BlockFormat::BC1, 2.1);
+    compress_and_compare("BC3 8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"), XIL::BlockFormat::BC3, 1.7);
+    compress_and_compare("BC3 8bpc RGBA 2816x3088", PATH_TO("8pbc_rgba_2816x3088.png"), XIL::BlockFormat::BC3, 1.0);
+    compress_and_compare("BC4 8bpc RGB 1419x1001", PATH_TO("8bpc_rgb_1419x1001.png"), XIL::BlockFormat::BC4, 0.8);
+    compress_and_compare("BC5 8bpc RGBA GRAYSCALE 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"), XIL::BlockFormat::BC5, 0.65);
+    compress_and_compare("BC5 1bpp 9x9", PATH_TO("1bpp_9x9.bmp"), XIL::BlockFormat::BC5, 0.0);
+
+    std::cout << "solid and two color blocks... ";
+    size_t mismatches = 0;
+
+    for (int value = 0; value < 256; value++)
+    {
+        // a 5x3 image pads its second column of blocks and the rows
+        uint8_t pixels[5 * 3 * 3];
+        std::fill(std::begin(pixels), std::end(pixels), static_cast<uint8_t>(value));
+        XIL::ConstImageView solid(pixels, 5, 3, 15, 3);
+
+        XIL::BlockOptions options;
+        options.format = XIL::BlockFormat::BC1;
+        auto bc1 = XIL::BlockCompressor::compress(solid, options);
+        options.format = XIL::BlockFormat::BC4;
+        auto bc4 = XIL::BlockCompressor::compress(solid, options);
+
+        mismatches += bc1.size() != 16 || block_rmse(solid, bc1) > 1.0 || block_rmse(solid, bc4) != 0.0;
+    }
+
+    // black and white pixels are the endpoints themselves, except for the inset bounding box of FAST
+    uint8_t checker[4 * 4 * 4];
+    for (size_t i = 0; i < 16; i++)
+        std::fill(checker + i * 4, checker + i * 4 + 4, static_cast<uint8_t>((i + i / 4) % 2 ? 255 : 0));
+
+    for (int quality = 1; quality < 3; quality++)
+    {
+        XIL::BlockOptions options;
+        options.quality = static_cast<XIL::BlockQuality>(quality);
+
+        for (auto format : { XIL::BlockFormat::BC1, XIL::BlockFormat::BC3, XIL::BlockFormat::BC4, XIL::BlockFormat::BC5 })
+        {
+            options.format = format;
+            mismatches += block_rmse(XIL::ConstImageView(checker, 4, 4, 16, 4), XIL::BlockCompressor::compress(XIL::ConstImageView(checker, 4, 4, 16, 4), options)) != 0.0;
+        }
+    }
+
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("BLOCK COMPRESSION TEST DONE");
+}
+
+// Counts the values of 'dst' further than 1 from resampling 'src' in double precision with the same weights,
+// the colors of nearly transparent pixels aren't compared since they come from a handful of bits
+size_t count_resize_mismatches(XIL::ConstImageView src, XIL::ConstImageView dst, XIL::ResizeFilter filter)
+{
+    XIL::Resampler::Weights horizontal(src.width(), dst.width(), filter);
+    XIL::Resampler::Weights vertical(src.height(), dst.height(), filter);
+
+    size_t channels = src.channels();
+    bool alpha = channels == 2 || channels == 4;
+    std::vector<double> rows(src.height() * dst.width() * channels);
+
+    for (size_t y = 0; y < src.height(); y++)
+        for (size_t x = 0; x < dst.width(); x++)
+            for (size_t k = 0; k < horizontal.count(x); k++)
+            {
+                const uint8_t* px = src.pixel_unchecked(horizontal.first(x) + k, y);
+
+                for (size_t c = 0; c < channels; c++)
+                    rows[(y * dst.width() + x) * channels + c] += horizontal.weights(x)[k] / 16384.0 *
+                                                                  (alpha && c + 1 < channels ? px[c] * px[channels - 1] / 255.0 : px[c]);
+            }
+
+    size_t mismatches = 0;
+
+    for (size_t y = 0; y < dst.height(); y++)
+    {
+        for (size_t x = 0; x < dst.width(); x++)
+        {
+            double px[4] = {};
+
+            for (size_t k = 0; k < vertical.count(y); k++)
+                for (size_t c = 0; c < channels; c++)
+                    px[c] += vertical.weights(y)[k] / 16384.0 * rows[((vertical.first(y) + k) * dst.width() + x) * channels + c];
+
+            for (size_t c = 0; c < channels; c++)
+            {
+                double value = px[c];
+
+                if (alpha && c + 1 < channels)
+                {
+                    if (px[channels - 1] < 8.0)
+                        continue;
+
+                    value = value * 255.0 / px[channels - 1];
+                }
+
+                value = std::min(std::max(value, 0.0), 255.0);
+                mismatches += std::abs(static_cast<int>(std::lround(value)) - dst.pixel_unchecked(x, y)[c]) > 1;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+void resize_and_compare(const char* subject, const char* path_to_image, size_t width, size_t height)
+{
+    std::cout << subject << "... ";
+
+    auto image = XILoader::load(path_to_image);
+    ASSERT_LOADED(image);
+
+    size_t mismatches = 0;
+    XIL::ThreadPool workers(3);
+
+    for (int filter = 0; filter < 4; filter++)
+    {
+        XIL::ResizeOptions options;
+        options.filter = static_cast<XIL::ResizeFilter>(filter);
+
+        auto resized = image.clone();
+        resized.resize(width, height, options);
+
+        mismatches += resized.width() != width || resized.height() != height || resized.pitch() != width * resized.channels() ||
+                      count_resize_mismatches(image.view(), resized.view(), options.filter);
+
+        // bands of rows resampled by different threads come out the same
+        options.thread_pool = &workers;
+        auto threaded = image.clone();
+        threaded.resize(width, height, options);
+
+        mismatches += memcmp(threaded.data(), resized.data(), resized.size()) != 0;
+    }
+
+    if (mismatches)
+    {
+        std::cout << "FAILED --> " << mismatches << " mismatches" << std::endl;
+        failed++;
+    }
+    else
+    {
+        std::cout << "PASSED" << std::endl;
+        passed++;
+    }
+}
+
+void TEST_RESIZE()
+{
+    PRINT_TITLE("RESIZE TEST STARTS");
+    resize_and_compare("8bpc RGB 1419x1001 to 709x500", PATH_TO("8bpc_rgb_1419x1001.png"), 709, 500);
+    resize_and_compare("8bpc RGB GRAYSCALE 1419x1001 to 2000x1500", PATH_TO("8bpc_rgb_grayscale_1419x1001.png"), 2000, 1500);
+    resize_and_compare("8bpc RGBA 1473x1854 to 1000x777", PATH_TO("8bpc_rgba_1473x1854.png"), 1000, 777);
+    resize_and_compare("8bpc RGBA GRAYSCALE 1473x1854 to 300x301", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"), 300, 301);
+    resize_and_compare("1bpp 9x9 to 31x2", PATH_TO("1bpp_9x9.bmp"), 31, 2);
+
+    std::cout << "identity and box filter... ";
+    auto image = XILoader::load(PATH_TO("8pbc_rgb_400x268.png"));
+    size_t mismatches = !image;
+
+    // filters that are 0 on the other pixels copy the image when the size doesn't change
+    for (auto filter : { XIL::ResizeFilter::BOX, XIL::ResizeFilter::BILINEAR, XIL::ResizeFilter::LANCZOS3 })
+    {
+        XIL::ResizeOptions options;
+        options.filter = filter;
+
+        auto same = image.clone();
+        same.resize(image.width(), image.height(), options);
+        mismatches += memcmp(same.data(), image.data(), image.size()) != 0;
+    }
+
+    // halving with a box filter is what the mip chain does
+    XIL::ResizeOptions box;
+    box.filter = XIL::ResizeFilter::BOX;
+    image.generate_mipmaps();
+    auto level = image.mipmaps().level(0);
+    std::vector<uint8_t> half(level.data(), level.data() + level.height() * level.pitch());
+    image.resize(image.width() / 2, image.height() / 2, box);
+    mismatches += image.mipmaps().levels() != 0 || image.size() != half.size();
+
+    for (size_t i = 0; i < half.size() && i < image.size(); i++)
+        mismatches += std::abs(half[i] - image.data()[i]) > 1;
+
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "resize from a task of its own pool... ";
+    {
+        // the only worker is busy running the resize, the calling thread resamples every band
+        XIL::ThreadPool workers(1);
+        XIL::ResizeOptions options;
+        options.thread_pool = &workers;
+
+        auto nested = XILoader::load(PATH_TO("8pbc_rgb_400x268.png"));
+        auto reference = nested.clone();
+        reference.resize(300, 200);
+
+        workers.submit([&]() { nested.resize(300, 200, options); });
+        workers.wait();
+
+        mismatches = nested.size() != reference.size() || memcmp(nested.data(), reference.data(), reference.size());
+    }
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "alpha weighted... ";
+
+    // a single opaque red pixel among transparent green ones
+    uint8_t sprite[] = { 255, 0, 0, 255,  0, 255, 0, 0,
+                         0, 255, 0, 0,    0, 255, 0, 0 };
+    uint8_t expected_weighted[] = { 255, 0, 0, 64 };
+    uint8_t expected_plain[] = { 64, 191, 0, 64 };
+    uint8_t pixel[4];
+
+    XIL::ResizeOptions weighted;
+    weighted.filter = XIL::ResizeFilter::BOX;
+    XIL::Resampler::resize(XIL::ConstImageView(sprite, 2, 2, 8, 4), XIL::ImageView(pixel, 1, 1, 4, 4), weighted);
+    mismatches = memcmp(pixel, expected_weighted, 4) != 0;
+
+    XIL::ResizeOptions plain = weighted;
+    plain.alpha_weighted = false;
+    XIL::Resampler::resize(XIL::ConstImageView(sprite, 2, 2, 8, 4), XIL::ImageView(pixel, 1, 1, 4, 4), plain);
+    mismatches += memcmp(pixel, expected_plain, 4) != 0;
+
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("RESIZE TEST DONE");
+}
+
+std::vector<uint8_t> read_test_file(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void TEST_IMAGE_CACHE()
+{
+    PRINT_TITLE("IMAGE CACHE TEST STARTS");
+
+    auto small = read_test_file(PATH_TO("8pbc_rgb_400x268.png"));
+    auto tiny = read_test_file(PATH_TO("8bpc_rgba_4x4.png"));
+    size_t small_bytes = 400 * 268 * 3;
+
+    std::cout << "hits share the pixels... ";
+    XIL::ImageCache cache(small_bytes * 5 / 2);
+    auto first = cache.load(PATH_TO("8pbc_rgb_400x268.png"));
+    auto second = cache.load(PATH_TO("8pbc_rgb_400x268.png"));
+    auto from_memory = cache.load_raw(small.data(), small.size());
+    auto again_from_memory = cache.load_raw(small.data(), small.size());
+    auto stats = cache.stats();
+    size_t mismatches = !first || first->data() != second->data() || from_memory->data() != again_from_memory->data() ||
+                        from_memory->data() == first->data() || memcmp(from_memory->data(), first->data(), first->size()) ||
+                        stats.hits != 2 || stats.misses != 2 || stats.entries != 2 || stats.bytes != small_bytes * 2 + small.size(); // with the copy of the encoded bytes
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "least recently used evicted... ";
+    first = cache.load(PATH_TO("8pbc_rgb_400x268.png"));
+    auto flipped = small;
+    flipped.push_back(0); // same image, different bytes
+    cache.load_raw(flipped.data(), flipped.size());
+    stats = cache.stats();
+    mismatches = stats.evictions != 1 || stats.entries != 2 || stats.bytes > cache.budget() ||
+                 cache.load(PATH_TO("8pbc_rgb_400x268.png"))->data() != first->data() || // still cached
+                 cache.load_raw(small.data(), small.size())->data() == from_memory->data(); // decoded again
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "changed files and failures... ";
+    const char* path = "xil_cache_test.png";
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(small.data()), small.size());
+    mismatches = cache.load(path)->width() != 400;
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(tiny.data()), tiny.size());
+    mismatches += cache.load(path)->width() != 4;
+    std::remove(path);
+
+    stats = cache.stats();
+    mismatches += cache.load(PATH_TO("does_not_exist.png")).ok() || cache.load_raw(small.data(), 10).ok() ||
+                  !throws([&]() { cache.load_raw_verbose(small.data(), 10); }) ||
+                  cache.stats().entries != stats.entries || cache.stats().misses != stats.misses + 3;
+    cache.clear();
+    mismatches += cache.stats().entries || cache.stats().bytes;
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "concurrent misses decoded once... ";
+    XIL::ImageCache shared_cache(64 * 1024 * 1024);
+    std::vector<XIL::SharedImage> handles(8);
+    std::vector<std::thread> loaders;
+    std::atomic<bool> go(false);
+
+    for (size_t i = 0; i < handles.size(); i++)
+    {
+        loaders.emplace_back([&, i]()
+            {
+                while (!go)
+                    std::this_thread::yield();
+
+                handles[i] = shared_cache.load(PATH_TO("8bpc_rgba_1473x1854.png"));
+            });
+    }
+
+    go = true;
+
+    for (auto& loader : loaders)
+        loader.join();
+
+    stats = shared_cache.stats();
+    mismatches = !handles[0] || stats.misses != 1 || stats.hits + stats.coalesced != handles.size() - 1;
+
+    for (const auto& handle : handles)
+        mismatches += handle->data() != handles[0]->data();
+
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("IMAGE CACHE TEST DONE");
+}
+
+void TEST_PREMULTIPLIED()
+{
+    PRINT_TITLE("PREMULTIPLIED LOADING TEST STARTS");
+    LOAD_AND_COMPARE_PREMULTIPLIED("16bpp 1419x1001", PATH_TO("16bpp_1419x1001.bmp"));
+    LOAD_AND_COMPARE_PREMULTIPLIED("8bpc RGBA 1473x1854", PATH_TO("8bpc_rgba_1473x1854.png"));
+    LOAD_AND_COMPARE_PREMULTIPLIED("16bpc RGBA 1473x1854", PATH_TO("16bpc_rgba_1473x1854.png"));
+    LOAD_AND_COMPARE_PREMULTIPLIED("8bpc RGBA GRAYSCALE 1473x1854", PATH_TO("8bpc_rgba_grayscale_1473x1854.png"));
+    LOAD_AND_COMPARE_PREMULTIPLIED("8bpc RGBA PALETTED 1473x1854", PATH_TO("8bpc_rgba_paletted_1473x1854.png"));
+
+    // BGRA pixels, the 4th byte is alpha only with the alpha mask of BI_ALPHABITFIELDS
+    std::vector<uint8_t> pixels = { 200, 100, 50, 128,  10, 20, 30, 0,  255, 255, 255, 255 };
+
+    std::vector<uint8_t> masks;
+    for (uint32_t mask : { 0x00ff0000u, 0x0000ff00u, 0x000000ffu, 0xff000000u })
+        bmp_writer::put_u32(masks, mask);
+
+    XIL::LoadOptions options;
+    options.premultiply_alpha = true;
+
+    std::cout << "32bpp BI_RGB... ";
+    auto rgb = bmp_writer::make_bmp(3, 1, 32, 0, {}, pixels);
+    auto unused_byte = XILoader::load_raw(rgb.data(), rgb.size(), options);
+    auto plain = XILoader::load_raw(rgb.data(), rgb.size());
+    size_t mismatches = !unused_byte || unused_byte.premultiplied() || !plain || unused_byte.size() != plain.size() ||
+                        memcmp(unused_byte.data(), plain.data(), plain.size());
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    std::cout << "32bpp BI_ALPHABITFIELDS... ";
+    auto rgba = bmp_writer::make_bmp(3, 1, 32, 6, masks, pixels);
+    auto premultiplied = XILoader::load_raw(rgba.data(), rgba.size(), options);
+    auto straight = XILoader::load_raw(rgba.data(), rgba.size());
+    mismatches = !premultiplied || !premultiplied.premultiplied() || !straight || premultiplied.size() != 12;
+
+    if (!mismatches)
+    {
+        std::vector<uint8_t> expected(straight.data(), straight.data() + straight.size());
+        premultiply(expected.data(), 3, 4);
+        mismatches = expected[0] == straight.data()[0] || memcmp(premultiplied.data(), expected.data(), expected.size());
+    }
+
+    std::cout << (mismatches ? "FAILED" : "PASSED") << std::endl;
+    mismatches ? failed++ : passed++;
+
+    PRINT_END("PREMULTIPLIED LOADING TEST DONE");
+}
+
 int main(int argc, char** argv)
 {
     TEST_BMP();
     TEST_PNG();
+    TEST_RLE();
+    TEST_VIEW();
+    TEST_DIMENSIONS();
+    TEST_EMBEDDED();
+    TEST_PREMULTIPLIED();
+    TEST_MAPPED();
+    TEST_STREAMED();
+    TEST_BATCH();
+    TEST_SEQUENCE();
+    TEST_BUFFER_POOL();
+#ifdef XIL_PMR
+    TEST_MEMORY_RESOURCE();
+#endif
+    TEST_ROW_ALIGNMENT();
+    TEST_PIXEL_VIEWS();
+    TEST_TRANSFORMS();
+    TEST_SHARED_IMAGE();
+    TEST_MIPMAPS();
+    TEST_BLOCK_COMPRESSION();
+    TEST_RESIZE();
+    TEST_IMAGE_CACHE();
     PRINT_TEST_RESULTS(passed, failed);
 
     return 0;